@@ -27,6 +27,70 @@
 //  3.0 Merge various versions of the POPS program to function on balloons, UAV, 
 //  Manta, WB57, etc with writing to either the uSD or usb drive. Config file 
 //  must be on the uSD card.
+//  3.1 The PRU1 point buffer is read by a real-time ingest thread and passed
+//  to the one second loop through a lock-free queue.
+//  3.2 PRU1 counts the peaks it writes. Peaks overwritten before they are read
+//  are counted and reported as LostPart, with the buffer high water, RingHW.
+//  3.3 Remove the 30,000 particles/second maximum. Peaks are kept in pooled
+//  chunks, up to MaxPart per second.
+//  3.4 Version 2 peak file. A file header, a header for each second and 8 byte
+//  records with the raw PRU cycle count. Setting.Peak Format = 1 for the old.
+//  3.5 PRU memory is reached through PRU_Mem (pops_pru.c), from prussdrv or
+//  from an emulator file written by popsfeed (Setting.PRU).
+//  3.6 PRU1 stamps peaks from the free-running IEP timer. The host extends
+//  the stamps to 64 bits and ties them to gFullSec, so every particle has an
+//  absolute time and no cycles are lost between particles.
+//  3.7 Continuous raw A/D capture. PRU1 writes every sample to a DDR ring and
+//  a thread writes RawCapture=N seconds of it to RawADC_*.b.
+//  3.8 Triggered waveform snippets. PRU1 keeps a 128 sample window around
+//  every Nth peak (Setting.Snippet) and the host writes them to Snip_*.b.
+//  3.9 PRU1 keeps the sum and sum of squares of the baseline points and
+//  records them for each block of the buffer, so Calc_Baseline no longer
+//  reads the 512 points. BL and BLTH go to PRU1 as one word.
+//  3.10 Robust baseline estimators, median/MAD or trimmed mean from a
+//  histogram of the baseline buffer (Setting.Baseline Estimator). Both the
+//  mean and the robust estimate are written to HK.
+//  3.11 Long baseline window (Setting.Baseline Window, up to 262144 points).
+//  PRU1 records the sums of each block of 512 baseline points and the host
+//  keeps the sums of the last N blocks, so the mean and STD of the window
+//  cost the host the same for any window.
+//  3.12 Baseline telemetry. Every Calc_Baseline update is kept with its time
+//  and written to BLTel_*.b (Setting.BLTel) and/or sent over UDP (the fifth
+//  Setting.UDP entry, type "B").
+//  3.13 CalcBins takes the bin of each particle from a 65536 entry table
+//  built when the bin settings change, not from log10.
+//  3.14 The ingest thread bins each particle and adds up its width as it
+//  reads it, so closing a second no longer passes over all of its particles.
+//  3.15 HK, the full data and the status each have their own histogram,
+//  summed from one master histogram (Setting.gBins master, full, status).
+//  The nbins command only changes the status bins, so the HK columns keep
+//  their meaning, and the 8 bin iMet/WB57 status no longer overwrites gHist.
+//  3.16 2D histogram of log10(max) against width, binned by the ingest
+//  thread and written once a second to H2D_*.b (Setting.H2D) and/or sent
+//  over UDP (the sixth Setting.UDP entry, type "H").
+//  3.17 Fast histograms. The ingest thread also bins the particles into 2,
+//  5 or 10 slices a second by their peak times (Setting.Fast), written with
+//  their concentration to FastHK_*.csv and/or sent over UDP (the seventh
+//  Setting.UDP entry, type "R").
+//  3.18 Dead time. The ingest thread bins the time between peaks (a log
+//  histogram, to HK with Setting.DT hk_hist) and adds up their dead time.
+//  HK, the full data and the UAV, Manta and WB57 status have the
+//  concentration corrected for coincidences as well as the measured one,
+//  last in Manta and WB57 so their columns do not move.
+//  3.19 Diameter bins. With Setting.Diameter the master bins are diameter
+//  bins, from a calibration curve of peak max against diameter, built into
+//  the same bin table, so all of the histograms are in diameter.
+//  3.20 Peak statistics. The ingest thread keeps the moments and a quantile
+//  sketch of the width, max and dt of the second (pops_stats.c). HK and the
+//  full data have their median, 90th and 99th percentiles, and the mean and
+//  STD of the max and dt. AveWidth and WidthSTD come from the same moments.
+//  3.21 File writer thread. The files are formatted into buffers and
+//  written by a thread that keeps them open (pops_writer.c), so a slow uSD
+//  card no longer holds up the 1 Hz loop (Setting.Writer). HK has the queue
+//  depth and write times.
+//  3.22 Version 3 peak file. Each second is framed with the length of its
+//  records and a CRC32, so ReadPeakFile can skip a second torn by a power
+//  loss and read all the good seconds after it.
 */
 /*DISCLAIMER
 ----------------------------------------------
@@ -108,6 +172,7 @@ the Software.*/
 //
 //******************************************************************************
 
+#define _GNU_SOURCE                         // pthread_setaffinity_np
 #include <stdio.h>
 #include <stdint.h>
 #include <stdlib.h>
@@ -122,8 +187,6 @@ the Software.*/
 #include <unistd.h>
 #include <float.h>
 #include <errno.h>
-#include <prussdrv.h>
-#include <pruss_intc_mapping.h>
 #include <fcntl.h>
 #include <termios.h>
 #include <signal.h>
@@ -135,11 +198,24 @@ the Software.*/
 #include <linux/i2c-dev.h>
 #include <libconfig.h>
 #include "iolib.h"
+#include "pops_pru.h"
+#include "pops_store.h"
+#include "pops_file.h"
+#include "pops_capture.h"
+#include "pops_snip.h"
+#include "pops_baseline.h"
+#include "pops_bltel.h"
+#include "pops_h2d.h"
+#include "pops_bins.h"
+#include "pops_fast.h"
+#include "pops_writer.h"
 #include <linux/watchdog.h>
 #include <netdb.h>
 #include <sys/socket.h>
 #include <arpa/inet.h>
 #include <netinet/in.h>
+#include <pthread.h>
+#include <sched.h>
 
 //******************************************************************************
 //
@@ -148,8 +224,7 @@ the Software.*/
 //******************************************************************************
 
 #define Billion  1000000000L                    // For time conversion
-#define PRU_NUM0 0                              // PRU 0 high byte
-#define PRU_NUM1 1                              // PRU 1 low byte and ctrl
+#define INGEST_BUSY 0x80000000u                 // gIngest.unread being added to
 
 // MAX5802 Constants
 #define MAX5802_I2C_WADDR               (0x0F)  // A1 and A0 to gnd.
@@ -207,9 +282,11 @@ int Read_Serial(int UART);
 void getTimes(void);
 int timeval_subtract (struct timeval *result, struct timeval *x, struct timeval *y);
 void Calc_Baseline(void);
+void Calc_Baseline_Robust(void);
 void Read_RawData(void);
 void CalcBins(void);
-void CompressBins(void);
+void Bin_Setup(void);
+void Bin_LUT_Make(struct Bin_LUT *b);
 void Implement_CMD(int source);
 void Check_Stop(void);
 int MIN (int a, int b);
@@ -237,6 +314,17 @@ unsigned char CRC4(long unsigned int ms5607_prom_coeffs[]);
 int Make_Watchdog( int interval);
 void InitPRU_Mem(void);
 void Read_PRU_Data ( void );
+void Get_Peaks(void);
+int Ingest_Start(void);
+void *Ingest_Thread(void *arg);
+void Ingest_Flush(void);
+void Ingest_Close(void);
+void Raw_Capture_CMD(int seconds);
+void Raw_Capture_Check(bool stop);
+void Write_BL_Telemetry(void);
+void Write_H2D(void);
+void Fast_Poll(void);
+void Write_Fast(void);
 int Open_Socket_Write(int i);
 int Open_Socket_Read(int i);
 int Open_Socket_Broadcast(int i);
@@ -267,9 +355,9 @@ char gStatus_Type[20];                      // iMet, UAV or iMet_ANG
 
 unsigned int gRaw_Data[512];                // Raw data, max of 1024 pts
 unsigned int gRaw_Read[512];                // Raw data read in
-unsigned int gRawBL_Data[512];              // Raw BL Data pts
 
 double gFullSec;                            // Timestamp with partial sec.
+unsigned int gFullSec_IEP;                  // PRU IEP count read with gFullSec
 char gTimestamp[16], gDatestamp[9];         // String YYYYMMDDThhmmss
                                             // String YYYYMMDD
 char gDispTime[25];                         // String "dd Mon YYYY hh:mm:ss"
@@ -287,12 +375,27 @@ char gPeakFShort[25]={""};                  // Short peak file name for display
 char gLogFile[50] = {""};                   // Path for Log File.
 char gMessage[1000] = {""};                 // Message strings.
 char gRawFile[50] = {""};                   // Raw data file. First n pts/sec
+char gDataDir[100] = {""};                  // Directory of today's files
+char gSnipFile[50] = {""};                  // Waveform snippet file
+char gBLTelFile[128] = {""};                // Baseline telemetry file,
+                                            // the data path and name
+char gH2DFile[50] = {""};                   // 2D histogram file
+char gFastFile[128] = {""};                 // Fast HK file, the data path
+                                            // and name
 								
-int gHist[200] = {0};                       // Histogram of particle sizes
+int gHist[BIN_VIEW_MAX] = {0};              // Histogram of particle sizes, HK
+int gHist_Full[BIN_VIEW_MAX] = {0};         // gFull histogram
+int gHist_Status[BIN_VIEW_MAX] = {0};       // gStatus histogram
 unsigned int gPart_Num=0;                   // Particles per second
 double gPartCon_num_cc;                     // Particle concentration, per cc
+double gPartCon_corr;                       // same, dead time corrected
+struct gDT {                                // times between peaks
+    bool hk_hist;                           // dt histogram in HK
+    double factor;                          // true/measured rate, last second
+    unsigned int hist[DT_BINS];             // dt histogram, last second
+} gDT = {false, 1.0, {0}};
 unsigned int i_head = 0, i_tail = 0;        // buffer positions for the data
-unsigned int m_head = 0, m_tail = 0;        // buffer positions Shared Mem
+struct PRU_Ring gRing;                      // host read state of Shared Mem
 unsigned int y_data[10000], nold = 0;       // data and carryover
 
 short unsigned int gBLTH;                   // Baseline plus threshold
@@ -302,6 +405,29 @@ double gSTD;                                // STD of Baseline
 double gTH_Mult;                            // Threshold multiplier * STD
 double gWidthSTD;                           // STD of peak width
 double gAW;                                 // Average Width of peaks
+struct gPeakStat {                          // p50, p90 and p99, last second
+    double w[3];                            // width, points
+    double amp_mean, amp_std, amp[3];       // max
+    double dt_mean, dt_std, dt[3];          // time between peaks, us
+} gPeakStat;
+
+struct gBL_Est {                            // Calc_Baseline estimators
+    int type;                               // BL_EST_MEAN, _MEDIAN, _TRIMMED
+    unsigned int trim;                      // % cut from each end, trimmed
+    unsigned int blocks;                    // window, blocks of 512 points
+    double mean;                            // mean and STD from the PRU1 sums
+    double std;
+    double rbl;                             // robust baseline and STD
+    double rstd;
+} gBL_Est = {BL_EST_MEAN, 10, 1, 0., 0., 0., 0.};
+struct BL_Hist gBL_Hist;                    // histogram of the BL buffer
+struct PRU_BL_Win gBL_Win;                  // BL window from the PRU1 blocks
+struct Writer gWriter;                      // file writer thread
+struct gWr {                                // Setting.Writer
+    unsigned int queue;                     // buffers, to WR_QUEUE_MAX
+    unsigned int fsync;                     // fsync every N s, 0 = never
+    struct Wr_Stats st;                     // last second, for HK
+} gWr = {.queue = 32, .fsync = 0};
 
 int UART1, UART2;                           // Serial port references
 unsigned char gCMD[512] = {""};             // Serial data revieved - UART1 (0-9)
@@ -311,16 +437,46 @@ char gHK[4094] = {""};                      // Housekeeping data to save
 char gRaw_Out[4094] = {""};                 // Raw Data out and save
 char gAC[1024] = {""};                      // Aircraft Data
 
-static void *pru1DRAM;                      // pointer for baseline data RAM
-                                            // memory buffer
-static unsigned int *pru1DRAM_int;          // values at the memory location
-static void *pruSharedMem;                  // pointer to shared pru memory
-static unsigned int *pruSharedMem_int;      // values of the shared memory
-static void *pru0DRAM;                      // pointer to pru0 DRAM
-static unsigned int *pru0DRAM_int;          // value of the memory location
+struct PRU_Mem gPRU;                        // PRU memory, see pops_pru.h
+struct Raw_Capture gCapture;                // DDR raw capture, RawCapture=N
+struct Snip_Queue gSnip_Queue;              // ingest thread to 1 Hz loop
+
+struct gSnip {                              // PRU1 waveform snippets
+    unsigned int every;                     // every N peaks, 0 = off
+    unsigned int post;                      // samples after the peak
+    unsigned int lost;                      // lost, last logged
+} gSnip = {0, SNIP_POST, 0};
+struct BL_Tel_Ring gBL_Tel_Ring;            // Calc_Baseline to 1 Hz loop
+struct gBL_Tel {                            // baseline telemetry
+    bool save;                              // write BLTel_*.b
+    bool use;                               // record, file or UDP on
+    unsigned int lost;                      // lost, last logged
+} gBL_Tel = {false, false, 0};
+struct H2D_Map gH2D_Map;                    // 2D bins of each max and width
+struct gH2D {                               // 2D histogram, max by width
+    bool save;                              // write H2D_*.b
+    bool use;                               // binned, file or UDP on
+    unsigned int amp_bins;                  // rows, divides the master bins
+    unsigned int width_bins;                // columns
+    unsigned int width_max;                 // points, the last column wider
+    unsigned int seq;                       // seconds sent over UDP
+} gH2D = {false, false, 16, 16, 60, 0};
+struct Fast gFast_Ring;                     // ingest thread to main loop
+struct gFast {                              // sub-second histograms
+    bool save;                              // write FastHK_*.csv
+    bool use;                               // binned, file or UDP on
+    unsigned int rate;                      // slices per second, 0 = off
+    unsigned int nbins;                     // bins, divides the master bins
+    unsigned int lost;                      // lost, last logged
+    unsigned int late;                      // late peaks, last logged
+} gFast = {false, false, 0, 8, 0, 0};
+char gFast_Out[16384] = {""};               // slices to write to FastHK
+int gPRU_Backend = PRU_BACKEND_PRUSSDRV;    // real PRUs or the emulator
+char gPRU_Path[50] = {PRU_EMU_PATH};        // emulator file
 
 unsigned int gMinPeakPts;                   // minimum points to make a peak
 unsigned int gMaxPeakPts;                   // maximum points in one peak
+unsigned int gMaxPart = 250000;             // most particles kept per second
 
 long unsigned int ms5607_prom_coeffs[7];
 double	T=0, P=0;                           // Pressure and temperature of P Chip
@@ -379,22 +535,66 @@ struct gSerial_Ports {
 } gSerial_Ports;
 
 struct gBins {                              // structure for the bins
-    unsigned int nbins;
+    unsigned int nbins;                     // HK bins
     double logmin;
     double logmax;
+    unsigned int master;                    // master bins, 0 = worked out
+    unsigned int full;                      // gFull bins, 0 = nbins
+    unsigned int status;                    // gStatus bins, 0 = nbins
+    bool fold;                              // status is 16 folded to 8
 } gBins;
-
-struct Peaks {                              // structure for peak data
-    unsigned int max;
-    unsigned int w;
-    unsigned int dt;
-};
-struct gData {
-    struct Peaks peak[30000];
-} gData;                                    // global data structure
-unsigned int gArray_Size = 0;               // Size of the data array
+struct Bin_View gView_HK;                   // gHist from the master histogram
+struct Bin_View gView_Full;                 // gHist_Full
+struct Bin_View gView_Status;               // gHist_Status
+struct Bin_LUT gBin_LUT[2];                 // bin of each peak max
+unsigned int gBin_LUT_Use = 0;              // table of gBins, the other spare
+bool gBin_LUT_New = false;                  // gBins changed, build the spare
+struct gDiam {                              // diameter bins, Setting.Diameter
+    bool use;                               // master bins are diameter bins
+    unsigned int ncal;                      // calibration points
+    double amp[BIN_CAL_MAX];                // peak max
+    double diam[BIN_CAL_MAX];               // diameter at the max, um
+    unsigned int nedges;                    // bin edges, the master bins + 1
+    double edges[BIN_VIEW_MAX + 1];         // um, so any view can be all bins
+} gDiam;
+struct Bin_Acc gBin_Acc[2];                 // filled by the ingest thread
+struct Bin_Acc gSecond;                     // histogram of the last second
+
+struct Peak_Store gStore;                   // peaks of the current second
+int gPeak_Format = PEAK_FILE_VERSION;       // peak file format, 1 or 3
+struct Peak_Queue gPeak_Queue;              // ingest thread to 1 Hz loop
+
+struct gIngest {                            // PRU ingest thread
+    int priority;                           // SCHED_FIFO priority, 0 = normal
+    int cpu;                                // CPU to pin to, -1 = any
+    unsigned int period_us;                 // time between reads of PRU1
+    unsigned int notify_peaks;              // PRU1 event every N peaks
+    unsigned int notify_fill;               // or when the buffer is % full
+    bool event;                             // wait on PRU1 events, not poll
+    bool running;                           // thread was started
+    volatile bool run;                      // cleared to stop the thread
+    volatile unsigned int flush_req;        // read requests from Get_Peaks
+    volatile unsigned int flush_done;       // last request read
+    volatile unsigned int fill;             // gBin_Acc being filled, the
+                                            // other the last closed
+    volatile unsigned int unread;           // closes in it not read by
+                                            // Get_Peaks, | INGEST_BUSY
+    pthread_t thread;
+    unsigned int drop;                      // peaks over gMaxPart per second
+    double anchor_sec;                      // gFullSec and the IEP count for
+    unsigned int anchor_iep;                // PRU_Ring_Anchor, set by Flush
+} gIngest;
+
+struct gLost {                              // particles lost, last second
+    unsigned int num;                       // overwritten or over the maximum
+    unsigned int total;                     // lost since the start
+    unsigned int ring_hw;                   // point buffer high water, % full
+} gLost;
 
 int UDPStat, UDP0R, UDP1S, UDP1R, UDP2S, UDP2R, UDPAC; // UDP references
+int UDPBL = -1;                             // baseline telemetry out
+int UDPH2D = -1;                            // 2D histogram out
+int UDPFast = -1;                           // fast histograms out
 
 struct UDP {
     char IP[16];                            // IP address to connect to
@@ -406,7 +606,7 @@ struct UDP {
 } UDP;
 
 struct gUDP {
-    struct UDP udp[6];
+    struct UDP udp[7];
 } gUDP;
 
 bool gFlowStepUse;                          // use plow step at low pressure
@@ -455,6 +655,7 @@ void main()
 
     Read_POPS_cfg();
     gStartFlowV = gAO_Data.ao[1].set_V;
+    Bin_Setup();
 
 //******************************
 //If the Status Type is Manta, set flow to 3.0 cc/s
@@ -485,8 +686,8 @@ void main()
     }
     else
     {
-         num = fscanf(fp,"%s", pl);
-         gPumpLife = atof(pl);
+         num = fscanf(fp,"%19s", pl);
+         gPumpLife = (num == 1) ? atof(pl) : 0.0;   // empty file
     }
     fclose(fp);    
 //******************************
@@ -554,6 +755,12 @@ void main()
     if(gUDP.udp[2].use) UDP2S = Open_Socket_Write(2);               //Full Ku
     if(gUDP.udp[2].use) UDP2R = Open_Socket_Read(2);                //Full Ku
     if(gUDP.udp[3].use) UDPAC = Open_Socket_Read(3);                //GH AC in
+    if(gUDP.udp[4].use) UDPBL = Open_Socket_Write(4);               //BL telemetry
+    gBL_Tel.use = gBL_Tel.save || gUDP.udp[4].use;
+    if(gUDP.udp[5].use) UDPH2D = Open_Socket_Write(5);              //2D histogram
+    gH2D.use = gH2D.save || gUDP.udp[5].use;
+    if(gUDP.udp[6].use) UDPFast = Open_Socket_Write(6);             //Fast histograms
+    gFast.use = gFast.rate > 0 && (gFast.save || gUDP.udp[6].use);
     if(gUDP.udp[0].use || gUDP.udp[1].use) strcat(gMessage, "\tUDP sockets opened.\n");
 
 //*****************************
@@ -566,36 +773,16 @@ void main()
 // Initialize the PRUs
 //*****************************
 
-// Initialize structure used by prussdrv_pruintc_intc
-// PRUSS_INTC_INITDATA is found in pruss_intc_mapping.h
-    tpruss_intc_initdata pruss_intc_initdata = PRUSS_INTC_INITDATA;
-
-// Allocate and initialize memory
-    prussdrv_init ();
-	
-    ret = prussdrv_open (PRU_EVTOUT_0);
-    if (ret)
-    {
-        strcat(gMessage,"PRU_EVTOUT_0 failed.\n");
-        return;
-    }
-    ret = prussdrv_open (PRU_EVTOUT_1);
+// Open prussdrv (or the emulator), map the PRU memory and interrupts
+    ret = PRU_Mem_Open(&gPRU, gPRU_Backend, gPRU_Path);
     if (ret)
     {
-        strcat(gMessage,"PRU_EVTOUT_1 failed.\n");
+        if (ret == -1) strcat(gMessage,"PRU_EVTOUT_0 failed.\n");
+        else if (ret == -2) strcat(gMessage,"PRU_EVTOUT_1 failed.\n");
+        else strcat(gMessage,"PRU emulator could not be opened.\n");
         return;
     }
-
-// Map PRU memory
-    prussdrv_map_prumem (PRUSS0_PRU1_DATARAM, &pru1DRAM);
-    pru1DRAM_int = (unsigned int *) pru1DRAM;
-    prussdrv_map_prumem (PRUSS0_SHARED_DATARAM, &pruSharedMem);
-    pruSharedMem_int = (unsigned int *) pruSharedMem;
-    prussdrv_map_prumem (PRUSS0_PRU0_DATARAM, &pru0DRAM);
-    pru0DRAM_int = (unsigned int *) pru0DRAM;
-
-// Map PRU's interrupts
-    prussdrv_pruintc_init(&pruss_intc_initdata);
+    if (gPRU.emu != NULL) strcat(gMessage,"\tUsing the PRU emulator.\n");
 
 //*****************************
 // Program initialization. Initialize the BL and BLTH, and clear the
@@ -603,22 +790,35 @@ void main()
 //*****************************
 
 // Initial value of the Baseline + Threshold
-    pru1DRAM_int[256] = (gBL_Start+0x30);   // BLTH
-    pru1DRAM_int[257] = gBL_Start;          // BL
-    pru1DRAM_int[258] = 0x00010000;         // start of points
-    pru1DRAM_int[259] = 0x00000000;         // stop
+    gPRU.p1->bl_blth = ((unsigned int)(gBL_Start+0x30) << 16) | gBL_Start; // BLTH, BL
+    gPRU.p1->point_ptr = PRU_RING_BASE;     // start of points
+    gPRU.p1->stop = 0x00000000;             // stop
 
-    for(i=0; i<256; i++)
+    for(i=0; i<PRU_BL_WORDS; i++)
     {
-        pru1DRAM_int[i] = 0x75007550;
+        gPRU.bl[i] = 0x75007550;
     }
 
-    for (i=0; i<3072; i++)
+    for (i=0; i<PRU_RING_WORDS; i++)
     {
-        pruSharedMem_int[i] = 0x00000000;
+        gPRU.ring[i] = 0x00000000;
     }
     
-    pru1DRAM_int[260] = ((gMaxPeakPts << 16) | gMinPeakPts); // set the value in memory
+    gPRU.p1->peak_pts = ((gMaxPeakPts << 16) | gMinPeakPts); // set the value in memory
+
+// PRU1 data ready events for the ingest thread
+    gPRU.p1->notify_peaks = gIngest.notify_peaks;               // every N peaks
+    gPRU.p1->notify_fill = (gIngest.notify_fill*4*PRU_RING_WORDS)/100; // fill bytes
+    gPRU.p1->host_count = 0;                                    // peaks read
+    gPRU.p1->peak_count = 0;                                    // peak count
+    gPRU.p1->raw_bytes = 0;                                     // capture off
+    gPRU.p1->raw_count = 0;                                     // raw samples
+    gPRU.p1->snip_every = gSnip.every;                          // snippets
+    gPRU.p1->snip_post = gSnip.post;
+    gPRU.p1->snip_count = 0;
+    gPRU.p1->bl_block_count = 0;                                // BL blocks
+    PRU_BL_Win_Init(&gBL_Win, gBL_Est.blocks);                  // BL window
+    gIngest.event = (gIngest.notify_peaks > 0) || (gIngest.notify_fill > 0);
     
     strcat(gMessage,"\tPRUs initialized.\n");
 
@@ -626,16 +826,28 @@ void main()
 // Start PRU0 and PRU1
 //*****************************
 
-    prussdrv_exec_program (PRU_NUM1, "./PRU1_All.bin");
-    prussdrv_exec_program (PRU_NUM0, "./PRU0_ParData.bin");
+    PRU_Mem_Start(&gPRU, "./PRU1_All.bin", "./PRU0_ParData.bin");
     strcat(gMessage,"\tPRU1 and PRU0 are now running.\n");
 
+//*****************************
+// Start the thread that reads the PRU1 point buffer
+//*****************************
+
+    if (Peak_Store_Init(&gStore, gMaxPart, 32768) != 0)
+        strcat(gMessage,"\tCould not allocate the particle store.\n");
+    if (Writer_Start(&gWriter, gWr.queue, gWr.fsync) == 0)
+        strcat(gMessage,"\tWriter thread started.\n");
+    else strcat(gMessage,"\tWriter thread failed to start, writing in the loop.\n");
+    if (Ingest_Start() == 0) strcat(gMessage,"\tIngest thread started.\n");
+    else strcat(gMessage,"\tIngest thread failed to start.\n");
+
 //*****************************
 // Set up for first loop
 //*****************************
 
     first_call = 1;
     usleep(50);
+    Calc_Baseline_Robust();
     Calc_Baseline();
     Check_Stop();                           // PRU1 r31.b11 P8.30
 
@@ -653,26 +865,29 @@ void main()
 //*****************************
 // Main Loop
 //
-// Maximum of 6.4 ms between Read_PRU_Data for 30,000 particle/second
+// The PRU1 point buffer is read by the ingest thread, so the slow I/O here
+// cannot overrun it. The peaks are collected once a second by Get_Peaks.
 // Loop within 1 ms
 //*****************************
 
     while(!gStop)                           // Main Data Loop
     {
+        Get_Peaks();                        // Peaks for the last second
+        if (gBL_Est.type == BL_EST_MEAN)
+            Calc_Baseline_Robust();         // median for HK, once a second
         if(!first_call)
         {
             CalcBins();
-            // Histogram is compressed for some status outputs
-            if (!strcmp(gStatus_Type, "iMet")) CompressBins();
-            if (!strcmp(gStatus_Type, "iMet_TRM")) CompressBins();
-            if (!strcmp(gStatus_Type, "WB57")) CompressBins();
             Read_RawData();
             POPS_Output();
             Calc_WidthSTD();
+            Raw_Capture_Check(false);
             Write_Files();
+            Write_BL_Telemetry();
+            Write_H2D();
+            Write_Fast();
         }
         
-        Read_PRU_Data();
         first_call = 0;
         getTimes();
 
@@ -683,7 +898,6 @@ void main()
 // Update the Pump Timer********************************************************
         UpdatePumpTime();
         
-        Read_PRU_Data();
         first_call = 0;
         getTimes();
 
@@ -702,15 +916,14 @@ void main()
         }
         else
         gPartCon_num_cc = 0.0;
+        gPartCon_corr = gPartCon_num_cc*gDT.factor;
     
-        Read_PRU_Data();
         Check_Stop();
         if(gStop) goto Shutdown;
 
 // P and T *********************************************************************
         ms5607_read_TP();
 
-        Read_PRU_Data();
         Calc_Baseline();
         Check_Stop();
         if(gStop) goto Shutdown;
@@ -718,7 +931,6 @@ void main()
 // Flow as fcn of Pressure******************************************************
         if(gFlowStepUse) CheckFlowStep();
 
-        Read_PRU_Data();
         Calc_Baseline();
         Check_Stop();
         if(gStop) goto Shutdown;
@@ -731,7 +943,6 @@ void main()
                 gSerial_Ports.serial_port[0].baud);
         }
         
-        Read_PRU_Data();
         Calc_Baseline();
         Check_Stop();
         if(gStop) goto Shutdown;
@@ -742,7 +953,6 @@ void main()
         }
 
         usleep(50);
-        Read_PRU_Data();
         Calc_Baseline();
         Check_Stop();
         if(gStop) goto Shutdown;
@@ -753,7 +963,6 @@ void main()
             if(strlen(gCMD) > 0 ) Implement_CMD(1);
         }
         usleep(50);
-        Read_PRU_Data();
         Calc_Baseline();
         Check_Stop();
         if(gStop) goto Shutdown;
@@ -770,7 +979,6 @@ void main()
             Send_Serial(UART2,gFull);
 			
         usleep(10);
-        Read_PRU_Data();
         Calc_Baseline();
         Check_Stop();
         if(gStop) goto Shutdown;
@@ -780,7 +988,6 @@ void main()
             Send_Serial(UART2, gRaw_Out);
         }
         usleep(10);
-        Read_PRU_Data();
         Calc_Baseline();
         Check_Stop();
         if(gStop) goto Shutdown;
@@ -792,7 +999,6 @@ void main()
         }
         
         usleep(10);
-        Read_PRU_Data();
         Calc_Baseline();
         Check_Stop();
         if(gStop) goto Shutdown;
@@ -807,7 +1013,6 @@ void main()
         }
 
         usleep(10);
-        Read_PRU_Data();
         Calc_Baseline();
         Check_Stop();
         if(gStop) goto Shutdown;
@@ -844,7 +1049,6 @@ void main()
         
 //******************************************************************************
         usleep(10);
-        Read_PRU_Data();
         Calc_Baseline();
         Check_Stop();
         if(gStop) goto Shutdown;
@@ -856,11 +1060,11 @@ void main()
 
         while( !(timeval_subtract(&LoopLeft, &LoopStop, &TimeNow )))
         {
-            Read_PRU_Data();
             Calc_Baseline();
             Check_Stop();
             if(gStop) goto Shutdown;
             Read_RawData();
+            Fast_Poll();
             j+=1;
             iolib_delay_ms(1);
             gettimeofday(&TimeNow, NULL);
@@ -900,12 +1104,22 @@ Shutdown:
     Close_UDP_Socket(UDP2S);
     Close_UDP_Socket(UDP2R);
     Close_UDP_Socket(UDPAC);
+    if(UDPBL >= 0) Close_UDP_Socket(UDPBL);
+    if(UDPH2D >= 0) Close_UDP_Socket(UDPH2D);
+    if(UDPFast >= 0) Close_UDP_Socket(UDPFast);
 	
     close(WD_Timer);
 
-    prussdrv_pru_disable(0);
-    prussdrv_pru_disable(1);
-    prussdrv_exit();
+    if (gIngest.running)
+    {
+        gIngest.run = false;
+        if (gIngest.event) PRU_Mem_Event(&gPRU);
+        pthread_join(gIngest.thread, NULL);
+    }
+    Capture_Stop(&gCapture);
+    Writer_Stop(&gWriter);                  // write what is queued
+
+    PRU_Mem_Close(&gPRU);
 
 // Shutdown or reboot the BBB (Comment these out to prevent shutdown on stop.)
     if (gReboot == true) system ("shutdown -r now");
@@ -949,6 +1163,7 @@ void getTimes(void)
     (gmtNow->tm_sec));
 
     gettimeofday(&tval, NULL);
+    if (gPRU.iep != NULL) gFullSec_IEP = *gPRU.iep; // PRU time of gFullSec
     gFullSec = ((double) tval.tv_sec) + ((double) tval.tv_usec)/1000000.0;
 
     StartTime= tval;
@@ -1092,6 +1307,51 @@ int Read_POPS_cfg()
                 gBins.logmin = logmin;
                 gBins.logmax = logmax;
             }
+// The master, full data and status bins are optional (see Bin_Setup)
+            int master, full, status;
+            if(config_setting_lookup_int(value,"master", &master)
+                && master > 0) gBins.master = master;
+            if(config_setting_lookup_int(value,"full", &full)
+                && full > 0) gBins.full = full;
+            if(config_setting_lookup_int(value,"status", &status)
+                && status > 0) gBins.status = status;
+        }
+    }
+
+//Get the diameter bins, optional. The lists are floats, amp and diam the
+//calibration curve and edges the bin edges, all rising.
+    setting = config_lookup(&cfg, "Setting.Diameter");
+    if(setting != NULL)
+    {
+        count = config_setting_length(setting);
+        for(i = 0; i < count; ++i)
+        {
+            config_setting_t *value = config_setting_get_elem(setting, i);
+            config_setting_t *amp, *diam, *edges;
+            int use, j;
+            if(config_setting_lookup_bool(value,"use", &use))
+                gDiam.use = use;
+            amp = config_setting_get_member(value, "amp");
+            diam = config_setting_get_member(value, "diam");
+            edges = config_setting_get_member(value, "edges");
+            if(amp == NULL || diam == NULL || edges == NULL
+                || config_setting_length(amp) != config_setting_length(diam)
+                || config_setting_length(amp) > BIN_CAL_MAX
+                || config_setting_length(edges) > BIN_VIEW_MAX + 1)
+            {
+                if(gDiam.use) strcat(gMessage,"Diameter bin lists are missing or too long.\n");
+                gDiam.use = false;
+                continue;
+            }
+            gDiam.ncal = config_setting_length(amp);
+            for(j = 0; j < (int)gDiam.ncal; j++)
+            {
+                gDiam.amp[j] = config_setting_get_float_elem(amp, j);
+                gDiam.diam[j] = config_setting_get_float_elem(diam, j);
+            }
+            gDiam.nedges = config_setting_length(edges);
+            for(j = 0; j < (int)gDiam.nedges; j++)
+                gDiam.edges[j] = config_setting_get_float_elem(edges, j);
         }
     }
 
@@ -1267,6 +1527,176 @@ int Read_POPS_cfg()
                 gMinPeakPts = MinPeakPts;
                 gMaxPeakPts = MaxPeakPts;
             }
+// Particles kept per second is optional, it limits the memory used
+            int MaxPart;
+            if(config_setting_lookup_int(value,"MaxPart", &MaxPart)
+                && MaxPart > 0) gMaxPart = MaxPart;
+// Peak file format is optional, 1 is the format before version 3.4
+            int Format;
+            if(config_setting_lookup_int(value,"Format", &Format))
+                gPeak_Format = (Format == 1) ? 1 : PEAK_FILE_VERSION;
+        }
+    }
+
+//Get Ingest thread settings
+    setting = config_lookup(&cfg, "Setting.Ingest");
+    gIngest.priority = 50;
+    gIngest.cpu = 0;
+    gIngest.period_us = 1000;
+    gIngest.notify_peaks = 64;
+    gIngest.notify_fill = 50;
+    if(setting != NULL)
+    {
+        count = config_setting_length(setting);
+        for(i = 0; i < count; ++i)
+        {
+            config_setting_t *value = config_setting_get_elem(setting, i);
+// Only output the settings if all of the expected fields are present.
+            int priority, cpu, period_us;
+            if(!(config_setting_lookup_int(value,"priority", &priority)
+                && config_setting_lookup_int(value,"cpu", &cpu)
+                && config_setting_lookup_int(value,"period_us", &period_us)))
+            {
+                strcat(gMessage,"Using default ingest priority, cpu and period.\n");
+            }
+            else
+            {
+                gIngest.priority = priority;
+                gIngest.cpu = cpu;
+                if (period_us > 0) gIngest.period_us = period_us;
+            }
+// PRU1 events are optional, 0 and 0 polls every period_us
+            int notify_peaks, notify_fill;
+            if(config_setting_lookup_int(value,"notify_peaks", &notify_peaks)
+                && config_setting_lookup_int(value,"notify_fill", &notify_fill))
+            {
+                gIngest.notify_peaks = (notify_peaks > PRU1_PARAM_MAX) ?
+                    PRU1_PARAM_MAX : notify_peaks;
+                gIngest.notify_fill = (notify_fill > 100) ? 100 : notify_fill;
+            }
+        }
+    }
+
+//Get PRU backend settings, optional. "emulator" reads the PRU memory from a
+//file written by popsfeed instead of the PRUs.
+    setting = config_lookup(&cfg, "Setting.PRU");
+    if(setting != NULL)
+    {
+        count = config_setting_length(setting);
+        for(i = 0; i < count; ++i)
+        {
+            config_setting_t *value = config_setting_get_elem(setting, i);
+            const char *backend, *path;
+            if(config_setting_lookup_string(value, "backend", &backend))
+            {
+                if (!strcmp(backend, "emulator")) gPRU_Backend = PRU_BACKEND_EMU;
+                else gPRU_Backend = PRU_BACKEND_PRUSSDRV;
+            }
+            if(config_setting_lookup_string(value, "path", &path))
+            {
+                strncpy(gPRU_Path, path, sizeof(gPRU_Path) - 1);
+            }
+        }
+    }
+
+//Get waveform snippet settings, optional. Every = 0 turns them off.
+    setting = config_lookup(&cfg, "Setting.Snippet");
+    if(setting != NULL)
+    {
+        count = config_setting_length(setting);
+        for(i = 0; i < count; ++i)
+        {
+            config_setting_t *value = config_setting_get_elem(setting, i);
+            int Every, Post;
+            if(config_setting_lookup_int(value,"Every", &Every) && Every >= 0)
+                gSnip.every = (Every > PRU1_PARAM_MAX) ? PRU1_PARAM_MAX : Every;
+            if(config_setting_lookup_int(value,"Post", &Post)
+                && Post > 0 && Post < PRU_SNIP_SAMPLES) gSnip.post = Post;
+        }
+    }
+
+//Get baseline telemetry settings, optional. The UDP stream is the fifth
+//Setting.UDP entry.
+    setting = config_lookup(&cfg, "Setting.BLTel");
+    if(setting != NULL)
+    {
+        count = config_setting_length(setting);
+        for(i = 0; i < count; ++i)
+        {
+            config_setting_t *value = config_setting_get_elem(setting, i);
+            int save;
+            if(config_setting_lookup_bool(value,"save", &save))
+                gBL_Tel.save = save;
+        }
+    }
+
+//Get 2D histogram settings, optional. The UDP stream is the sixth
+//Setting.UDP entry.
+    setting = config_lookup(&cfg, "Setting.H2D");
+    if(setting != NULL)
+    {
+        count = config_setting_length(setting);
+        for(i = 0; i < count; ++i)
+        {
+            config_setting_t *value = config_setting_get_elem(setting, i);
+            int save, amp_bins, width_bins, width_max;
+            if(config_setting_lookup_bool(value,"save", &save))
+                gH2D.save = save;
+            if(config_setting_lookup_int(value,"amp_bins", &amp_bins)
+                && amp_bins > 0) gH2D.amp_bins = amp_bins;
+            if(config_setting_lookup_int(value,"width_bins", &width_bins)
+                && width_bins > 0) gH2D.width_bins = width_bins;
+            if(config_setting_lookup_int(value,"width_max", &width_max)
+                && width_max > 0) gH2D.width_max = width_max;
+        }
+    }
+
+//Get fast histogram settings, optional. The UDP stream is the seventh
+//Setting.UDP entry.
+    setting = config_lookup(&cfg, "Setting.Fast");
+    if(setting != NULL)
+    {
+        count = config_setting_length(setting);
+        for(i = 0; i < count; ++i)
+        {
+            config_setting_t *value = config_setting_get_elem(setting, i);
+            int save, rate, nbins;
+            if(config_setting_lookup_bool(value,"save", &save))
+                gFast.save = save;
+            if(config_setting_lookup_int(value,"rate", &rate)
+                && rate >= 0) gFast.rate = rate;
+            if(config_setting_lookup_int(value,"nbins", &nbins)
+                && nbins > 0) gFast.nbins = nbins;
+        }
+    }
+
+//Get the file writer settings, optional.
+    setting = config_lookup(&cfg, "Setting.Writer");
+    if(setting != NULL)
+    {
+        count = config_setting_length(setting);
+        for(i = 0; i < count; ++i)
+        {
+            config_setting_t *value = config_setting_get_elem(setting, i);
+            int queue, fsync;
+            if(config_setting_lookup_int(value,"queue", &queue)
+                && queue > 0) gWr.queue = queue;
+            if(config_setting_lookup_int(value,"fsync", &fsync)
+                && fsync >= 0) gWr.fsync = fsync;
+        }
+    }
+
+//Get dead time settings, optional.
+    setting = config_lookup(&cfg, "Setting.DT");
+    if(setting != NULL)
+    {
+        count = config_setting_length(setting);
+        for(i = 0; i < count; ++i)
+        {
+            config_setting_t *value = config_setting_get_elem(setting, i);
+            int hk_hist;
+            if(config_setting_lookup_bool(value,"hk_hist", &hk_hist))
+                gDT.hk_hist = hk_hist;
         }
     }
 
@@ -1293,6 +1723,30 @@ int Read_POPS_cfg()
                 gBL_Start = BL_Start;
                 gTH_Mult = TH_Mult;
             }
+// The estimator is optional, "mean" (the default), "median" or "trimmed"
+            const char *Estimator;
+            int Trim;
+            if(config_setting_lookup_string(value,"Estimator", &Estimator))
+            {
+                if (!strcmp(Estimator, "median")) gBL_Est.type = BL_EST_MEDIAN;
+                else if (!strcmp(Estimator, "trimmed"))
+                    gBL_Est.type = BL_EST_TRIMMED;
+                else gBL_Est.type = BL_EST_MEAN;
+            }
+            if(config_setting_lookup_int(value,"Trim", &Trim)
+                && Trim >= 0 && Trim <= 45) gBL_Est.trim = Trim;
+// The window is optional, points rounded up to blocks of 512 (the default)
+            int Window;
+            if(config_setting_lookup_int(value,"Window", &Window)
+                && Window > 0)
+            {
+                gBL_Est.blocks = (Window + PRU_BL_POINTS - 1)/PRU_BL_POINTS;
+                if (gBL_Est.blocks > PRU_BL_BLOCKS_MAX)
+                {
+                    gBL_Est.blocks = PRU_BL_BLOCKS_MAX;
+                    strcat(gMessage,"Baseline window cut to 262144 points.\n");
+                }
+            }
         }
     }
 
@@ -1317,8 +1771,6 @@ int Read_POPS_cfg()
         }
     }
 
-    if(!strcmp(gStatus_Type, "iMet")) gBins.nbins = 16;		// must be 16 for this to work
-
 //Get Raw Data settings
     setting = config_lookup(&cfg, "Setting.Raw");
     if(setting != NULL)
@@ -1360,6 +1812,7 @@ int Read_POPS_cfg()
     if(setting != NULL)
     {
         count = config_setting_length(setting);
+        if(count > 7) count = 7;            // gUDP.udp entries
         for(i = 0; i < count; ++i)
         {
             config_setting_t *net = config_setting_get_elem(setting, i);
@@ -1430,6 +1883,12 @@ Defaults:
     gMinPeakPts = 5;
     gMaxPeakPts = 255;
     strcat(gMessage,"Using default min and max peak points.\n");
+    gIngest.priority = 50;
+    gIngest.cpu = 0;
+    gIngest.period_us = 1000;
+    gIngest.notify_peaks = 64;
+    gIngest.notify_fill = 50;
+    strcat(gMessage,"Using default ingest priority, cpu and period.\n");
     gBL_Start = 2000;
     gTH_Mult = 2.;
     strcat(gMessage,"Using default min and max peak points.\n");
@@ -1463,9 +1922,11 @@ void makeFileNames(void)
     int n=0, i=0, j;                        // version number as int
     char num[] = "000";                     // used to conver to integer
     char blk[] = {""};                      // blank string for initialization
-    char HK_Header[2000] ={""};             // HK header, comma del
+    char HK_Header[3000] ={""};             // HK header, comma del
     char ch;                                // for file copy
     char binNames[1000] = {""};             // Histogram Bin names (max = 883)
+    char dtNames[600] = {""};               // dt bin names, lower edge in us
+    char dtName[20];
     char str[] = {""};                      // string dummy
 
     char config[] ="/media/uSD/POPS_BBB.cfg";
@@ -1487,9 +1948,12 @@ void makeFileNames(void)
     strcpy(gLogFile, blk);
     strcpy(gPOPS_BBB_cfg, blk);
     strcpy(gRawFile, blk);
+    strcpy(gSnipFile, blk);
+    strcpy(gH2DFile, blk);
     strcpy(gPeakFShort, blk);
 
     strcat(FileAddr, "/");
+    strcpy(gDataDir, FileAddr);
     strcat(FileVersion, FileAddr);
     strcat(FileVersion, "Version");
 
@@ -1540,7 +2004,12 @@ void makeFileNames(void)
         strcat(HK_Header, gAO_Data.ao[i].name);
     }
     strcat(HK_Header,",BL_Start,TH_Mult,nbins,logmin,logmax,Skip_Save,");
-    strcat(HK_Header,"MinPeakPts,MaxPeakPts,RawPts,");
+    strcat(HK_Header,"MinPeakPts,MaxPeakPts,RawPts,LostPart,RingHW,");
+    strcat(HK_Header,"BLMean,STDMean,BLRobust,STDRobust,");
+    strcat(HK_Header,"PartConCorr,DeadFactor,");
+    strcat(HK_Header,"WidthP50,WidthP90,WidthP99,AmpMean,AmpSTD,AmpP50,AmpP90,AmpP99,");
+    strcat(HK_Header,"DtMean_us,DtSTD_us,DtP50_us,DtP90_us,DtP99_us,");
+    strcat(HK_Header,"WrQueue,WrLat_ms,WrLatMax_ms,WrDrop,WrErr,");
     if(gUDP.udp[3].use)     // add the aircraft header if data is used
     {
     strcat(HK_Header,"ACDateTime,Lat,Lon,GPS_MSL_Alt,WGS_84_Alt,Press_Alt,Radar_Alt,");
@@ -1550,6 +2019,15 @@ void makeFileNames(void)
     strcat(HK_Header,"SolarZenith,SunElevAC,SunAzGrnd,SunAz_AC");
     }
     strcat(HK_Header,binNames);
+    if(gDT.hk_hist)
+    {
+        for (i=0; i<DT_BINS; i++)
+        {
+            sprintf(dtName,",dt%g",DT_Bin_Edge(i)/(PRU_CLOCK_HZ/1e6));
+            strcat(dtNames,dtName);
+        }
+        strcat(HK_Header,dtNames);
+    }
     strcat(HK_Header,"\r\n");
     fprintf( fp, HK_Header);
 
@@ -1577,6 +2055,24 @@ void makeFileNames(void)
     strcat(gRawFile, ver);
     strcat(gRawFile, ".b");
 
+    strcat(gSnipFile, FileAddr);
+    strcat(gSnipFile, "Snip_");
+    strcat(gSnipFile, gDatestamp);
+    strcat(gSnipFile, ver);
+    strcat(gSnipFile, ".b");
+
+    snprintf(gBLTelFile, sizeof(gBLTelFile), "%sBLTel_%s%s.b", FileAddr,
+        gDatestamp, ver);                   // bounded, made again each day
+
+    strcat(gH2DFile, FileAddr);
+    strcat(gH2DFile, "H2D_");
+    strcat(gH2DFile, gDatestamp);
+    strcat(gH2DFile, ver);
+    strcat(gH2DFile, ".b");
+
+    snprintf(gFastFile, sizeof(gFastFile), "%sFastHK_%s%s.csv", FileAddr,
+        gDatestamp, ver);                   // bounded, made again each day
+
 }
 
 //******************************************************************************
@@ -1590,14 +2086,13 @@ void makeFileNames(void)
 void UpdatePumpTime (void)
 {
     FILE *fp;
-    int num;
-    fp =fopen(gPumpFile,"r+" );
 
     gPumpLife+= 0.000277778;          //increment the pump life
-    
-    fseek(fp,0,SEEK_SET);
+
+    fp = Writer_Open(&gWriter, WR_PUMP, gPumpFile, NULL, 0, 1);
+    if (fp == NULL) return;           // queue full, next second
     fprintf(fp,"%4.8f\r\n",gPumpLife);
-    fclose(fp);
+    Writer_Close(&gWriter, fp);
 }
 
 //******************************************************************************
@@ -1721,10 +2216,7 @@ void POPS_Output (void)
     unsigned int i, Bins, temp_out;
     int nantest;
 
-    Bins=gBins.nbins;
-    if(!strcmp(gStatus_Type,"iMet")) Bins=8;
-    if(!strcmp(gStatus_Type,"iMet_TRM")) Bins=8;
-    if(!strcmp(gStatus_Type,"WB57")) Bins=8;
+    Bins=gView_Status.nbins;                // 8 from 16 for iMet and WB57
 
 // Full dat and HK
 
@@ -1772,6 +2264,29 @@ void POPS_Output (void)
     sprintf(str, ",%i,%u,%u,%i",gSkip_Save,gMinPeakPts,gMaxPeakPts,gRaw.pts);
     strcat(fullstr, str);
 
+    sprintf(str, ",%u,%u",gLost.num,gLost.ring_hw);     //Lost particles
+    strcat(fullstr, str);
+
+    sprintf(str, ",%.2f,%.2f,%.2f,%.2f",gBL_Est.mean,gBL_Est.std,
+        gBL_Est.rbl,gBL_Est.rstd);                      //Both BL estimates
+    strcat(fullstr, str);
+
+    sprintf(str, ",%.2f,%.4f",gPartCon_corr,gDT.factor);   //Dead time
+    strcat(fullstr, str);
+
+    sprintf(str, ",%.0f,%.0f,%.0f,%.1f,%.1f,%.0f,%.0f,%.0f",   //Peak statistics
+        gPeakStat.w[0],gPeakStat.w[1],gPeakStat.w[2],gPeakStat.amp_mean,
+        gPeakStat.amp_std,gPeakStat.amp[0],gPeakStat.amp[1],gPeakStat.amp[2]);
+    strcat(fullstr, str);
+    sprintf(str, ",%.2f,%.2f,%.2f,%.2f,%.2f",gPeakStat.dt_mean,
+        gPeakStat.dt_std,gPeakStat.dt[0],gPeakStat.dt[1],gPeakStat.dt[2]);
+    strcat(fullstr, str);
+
+    Writer_Stats(&gWriter, &gWr.st);                    //File writer
+    sprintf(str, ",%u,%.2f,%.2f,%u,%u",gWr.st.depth,gWr.st.lat_mean,
+        gWr.st.lat_max,gWr.st.dropped,gWr.st.errors);
+    strcat(fullstr, str);
+
     strcat(gFull,fullstr);
     strcat(gHK, fullstr);
     strcat(gHK, ",");
@@ -1783,10 +2298,19 @@ void POPS_Output (void)
         strcat(gHK,",");
     }
     
-    for (i=0; i<gBins.nbins; i++)           //Histogram
+    for (i=0; i<gView_Full.nbins; i++)      //Histogram
     {	
-        sprintf(str, ",%d", gHist[i]);
+        sprintf(str, ",%d", gHist_Full[i]);
         strcat(gFull, str);
+    }
+    for (i=0; i<gBins.nbins; i++)
+    {	
+        sprintf(str, ",%d", gHist[i]);
+        strcat(gHK, str);
+    }
+    for (i=0; gDT.hk_hist && i<DT_BINS; i++)   //dt histogram
+    {
+        sprintf(str, ",%u", gDT.hist[i]);
         strcat(gHK, str);
     }
     sprintf(str,"\r\n");
@@ -1833,7 +2357,7 @@ void POPS_Output (void)
 
         for (i=0; i<Bins; i++)              //Histogram
         {
-            sprintf(str, "%04X", gHist[i]);
+            sprintf(str, "%04X", gHist_Status[i]);
             strcat(gStatus, str);
         }
             sprintf(str,"\r\n");            //add cr lf
@@ -1853,7 +2377,7 @@ void POPS_Output (void)
 
         for (i=0; i<Bins; i++)          //Histogram
         {
-            sprintf(str, "%04X", gHist[i]);
+            sprintf(str, "%04X", gHist_Status[i]);
             strcat(gStatus, str);
         }
             sprintf(str,"\r\n");            //add cr lf
@@ -1896,7 +2420,7 @@ void POPS_Output (void)
 			
         for (i=0; i<Bins; i++)                              //Histogram
         {
-            sprintf(str, "%04X", gHist[i]);
+            sprintf(str, "%04X", gHist_Status[i]);
             strcat(gStatus, str);
         }
         sprintf(str,"\r\n");                                //add cr lf
@@ -1921,9 +2445,13 @@ void POPS_Output (void)
         strcat(gStatus,str);
         sprintf(str,",%.2f",gAI_Data.ai[5].value);          //AI Temp
         strcat(gStatus,str);
+        sprintf(str,",%u,%u",gLost.num,gLost.ring_hw);      //Lost particles
+        strcat(gStatus,str);
+        sprintf(str,",%.2f",gPartCon_corr);                 //Dead time corrected
+        strcat(gStatus,str);
         // for (i=0; i<Bins; i++)                              //Histogram
         // {	
-        //     sprintf(str, ",%d", gHist[i]);
+        //     sprintf(str, ",%d", gHist_Status[i]);
         //     strcat(gStatus, str);
         // }
         sprintf(str,"\r\n");                                //add cr lf
@@ -1943,9 +2471,11 @@ void POPS_Output (void)
         
         for (i=0; i<Bins; i++)                              //Histogram
         {	
-            sprintf(str, ",%d", gHist[i]);
+            sprintf(str, ",%d", gHist_Status[i]);
             strcat(gStatus, str);
         }
+        sprintf(str,",%.2f",gPartCon_corr);                 //Dead time corrected
+        strcat(gStatus,str);
         sprintf(str,"\r\n");                                //add cr lf
         strcat(gStatus, str);
     }		
@@ -1958,9 +2488,11 @@ void POPS_Output (void)
 
         for (i=0; i<Bins; i++)                              //Histogram
         {	
-            sprintf(str, ",%d", gHist[i]);
+            sprintf(str, ",%d", gHist_Status[i]);
             strcat(gStatus, str);
         }
+        sprintf(str,",%.2f",gPartCon_corr);                 //Dead time corrected
+        strcat(gStatus,str);
         sprintf(str,"\r\n");                                //add cr lf
         strcat(gStatus, str);
     }
@@ -1981,7 +2513,7 @@ void POPS_Output (void)
         strcat(gStatus,str);
         sprintf(str,",%d",gSkip_Save);                       //SkipSave
         strcat(gStatus,str);
-        sprintf(str,",%d",gBins.nbins);                     //Bin info
+        sprintf(str,",%d",gView_Status.nbins);              //Bin info
         strcat(gStatus,str);
         sprintf(str,",%.3f",gBins.logmin);
         strcat(gStatus,str);                
@@ -1992,7 +2524,7 @@ void POPS_Output (void)
         
         for (i=0; i<Bins; i++)                              //Histogram
         {	
-            sprintf(str, ",%d", gHist[i]);
+            sprintf(str, ",%d", gHist_Status[i]);
             strcat(gStatus, str);
         }
         sprintf(str,"\r\n");                                //add cr lf
@@ -2024,7 +2556,7 @@ void POPS_Output (void)
 
         for (i=0; i<Bins; i++)                          //Histogram
         {
-             sprintf(str, "%04X", gHist[i]);
+             sprintf(str, "%04X", gHist_Status[i]);
              strcat(gStatus, str);
         }
         sprintf(str,"\r\n");                            // add cr lf
@@ -2199,41 +2731,80 @@ int Read_Serial(int UART)
 //
 //  Calculate the baseline for the high speed analog in,
 //  and load baseline + threshold for use by PRU1.
-//  Use 16 bit packed data into 1 KB. (512 points).
+//  PRU1 keeps the sum and sum of squares of its baseline points, and
+//  records them at the end of each block of 512 points. The host moves
+//  the window (gBL_Win) on by the new blocks, so the mean and STD cost the
+//  same for any window (PRU_BL_Window). With a robust estimator (gBL_Est.type)
+//  the baseline and STD are those of the histogram of the buffer, brought
+//  up to date by Calc_Baseline_Robust each time PRU1 has finished a block,
+//  so BLTH moves as often as with the mean.
+//  With telemetry on each update is kept in gBL_Tel_Ring.
 //
 //******************************************************************************
 
 void Calc_Baseline( void )
 {
-    double bl = 0.;                         // calculation of Baseline
-    double var = 0.;                        // varience of Baseline
-    int i;                                  // Step for baseline address
-
-/* Read PRU1 RAM memory. */
+    static unsigned int blocks = 0;         // PRU1 blocks at the last robust
+    double bl;                              // calculation of Baseline
+    unsigned int n;                         // points in the window
+    double t;                               // time of the update
 
-    for (i=0; i<256; i++)                   // Read 0..255
+    PRU_BL_Window(&gPRU, &gBL_Win, &gBL_Est.mean, &gBL_Est.std, &n);
+    if (gBL_Est.type != BL_EST_MEAN && gPRU.p1->bl_block_count != blocks)
     {
-        gRawBL_Data[2*i] = (double)((pru1DRAM_int[i] & 0xFFFF0000) >> 16);
-        gRawBL_Data[2*i+1] = (double)(pru1DRAM_int[i] & 0x0000FFFF);
-        bl = bl + (gRawBL_Data[2*i] + gRawBL_Data[2*i+1]);
+        blocks = gPRU.p1->bl_block_count;
+        Calc_Baseline_Robust();             // new buffer, about 2-4 us
     }
-
-    bl = bl/512.0;
-
-    for (i=0;i<512; i++)
+    if (gBL_Est.type == BL_EST_MEAN)
     {
-        var += (gRawBL_Data[i]-bl)*(gRawBL_Data[i]-bl);
+        bl = gBL_Est.mean;
+        gSTD = gBL_Est.std;
+    }
+    else
+    {
+        bl = gBL_Est.rbl;
+        gSTD = gBL_Est.rstd;
     }
-    gSTD = sqrt(var/511.);
     gBLTH = (unsigned int) (bl+gTH_Mult*gSTD);
     gBaseline = (unsigned int)bl;
 
 //Write the new baseline to the PRU
-    pru1DRAM_int[256] = gBLTH;
-    pru1DRAM_int[257] = gBaseline;
+    gPRU.p1->bl_blth = ((unsigned int)gBLTH << 16) | gBaseline;
+
+//Keep the update for the telemetry, timed by the PRU clock from gFullSec
+    if (gBL_Tel.use)
+    {
+        t = gFullSec;
+        if (gPRU.iep != NULL)
+            t += (double)(*gPRU.iep - gFullSec_IEP)/PRU_CLOCK_HZ;
+        BL_Tel_Add(&gBL_Tel_Ring, t, gBaseline, gBLTH, gSTD);
+    }
 }
 
 
+//******************************************************************************
+//
+//  Calc_Baseline_Robust
+//
+//  Bring the histogram of the baseline buffer up to date, only the points
+//  PRU1 has replaced move, and take the robust baseline and STD from it.
+//  With the mean estimator the median is taken, for HK, once a second from
+//  the main loop. With a robust estimator Calc_Baseline calls it when PRU1
+//  has finished a block, which has replaced the whole buffer anyway, so the
+//  compare of all 512 points is no waste.
+//
+//******************************************************************************
+
+void Calc_Baseline_Robust( void )
+{
+    int est = (gBL_Est.type == BL_EST_MEAN) ? BL_EST_MEDIAN : gBL_Est.type;
+
+    if (gBL_Hist.n == 0) BL_Hist_Init(&gBL_Hist);
+    BL_Hist_Update(&gBL_Hist, gPRU.bl);
+    BL_Hist_Robust(&gBL_Hist, est, gBL_Est.trim, &gBL_Est.rbl,
+        &gBL_Est.rstd);
+}
+
 //******************************************************************************
 //
 //  Read_RawData
@@ -2251,10 +2822,10 @@ void Read_RawData( void )
     
 /* Read PRU0 RAM memory. */
 
-    for (i=0; i<256; i++)                   // Read 0..255
+    for (i=0; i<PRU_RAW_WORDS; i++)         // Read 0..255
     {
-        gRaw_Read[2*i+1] = (double)((pru0DRAM_int[i] & 0xFFFF0000) >> 16);
-        gRaw_Read[2*i] = (double)(pru0DRAM_int[i] & 0x0000FFFF);
+        gRaw_Read[2*i+1] = (double)((gPRU.raw[i] & 0xFFFF0000) >> 16);
+        gRaw_Read[2*i] = (double)(gPRU.raw[i] & 0x0000FFFF);
     }
     for(i=0; i<512; i++)
     {
@@ -2280,79 +2851,180 @@ void Read_RawData( void )
 //  CalcBins
 //
 //  Calculate the Histogram BINS.  The are binned in raw log10(16 bit AI value).
+//  The bin of each max is looked up in gBin_LUT, built from gBins when it
+//  changes (pops_bins.c). The ingest thread has already binned the second
+//  (gSecond), unless the table was built again since, when the stored
+//  particles are binned again. gHist, gHist_Full and gHist_Status are summed from
+//  these master bins.
 //
 //******************************************************************************
 
 void CalcBins(void)
 {
-    double logdelta, dbin;
-    int i, bin;
+    static unsigned int master[BIN_LUT_MAX_BINS];
+    const unsigned int *h = gSecond.hist;
+    struct Peak_Chunk *c;
 
-//	clear the Bins
-    for(i=0; i<gBins.nbins;i++)
+    if (gSecond.gen != gBin_LUT[gBin_LUT_Use].gen)
     {
-    gHist[i]=0;
-    }
-    if(gArray_Size == 0) return;        // Don't try binning if there are no particles
-//	make the bins in log space
-    logdelta=(gBins.logmax - gBins.logmin)/(double)gBins.nbins;
-
+        memset(master, 0, sizeof(master));
 //	process all of the data into the bins
-    for (i=0; i<gArray_Size; i++)
-    {
-        dbin = (log10(gData.peak[i].max)-gBins.logmin)/logdelta;
-        bin = (int)dbin;
-        if((dbin>=0) && (bin<gBins.nbins)) gHist[bin]++;
+        for (c = gStore.first; c != NULL; c = c->next)
+        {
+            Bin_LUT_Count(&gBin_LUT[gBin_LUT_Use], c->max, c->n, master);
+        }
+        h = master;
     }
+
+//	sum the master bins into each output
+    Bin_View_Fill(&gView_HK, h, gHist);
+    Bin_View_Fill(&gView_Full, h, gHist_Full);
+    Bin_View_Fill(&gView_Status, h, gHist_Status);
     return;
 }
 
 //******************************************************************************
 //
-//  CompressBins
+//  Bin_Setup
 //
-//  Compress 16 BINS to 8.  Used on some balloon or aircraft Status outputs.
+//  Set up the master histogram and the HK (nbins), full data (full) and
+//  status (status) histograms summed from it. iMet, iMet_TRM and WB57
+//  status have 8 bins, 0..5 of 16 and then 6..9 and 10..15, as the old
+//  CompressBins. Unless it is set, the master has the fewest bins that all
+//  three divide, times BIN_MASTER_DEFAULT if that fits, so every BinsSet
+//  choice of the display is exact too. Builds the first bin table.
 //
-//  gHist 0..5 are 16 bin data
-//  gHist 6 is 6+7+8+9
-//  gHist 7 is 10+11+12+13+14+15
+//  With diameter bins the master is the diameter bins, and a view that
+//  does not divide them falls back to all of them. The HK bin edges go to
+//  the log.
 //
 //******************************************************************************
 
-void CompressBins(void)
+void Bin_Setup(void)
 {
-    gHist[6] = gHist[6] + gHist[7] + gHist[8] + gHist[9];
-    gHist[7] = gHist[10] + gHist[11] + gHist[12] + gHist[13] + gHist[14] + gHist[15];
+    static const unsigned char fold[8] = {1, 1, 1, 1, 1, 1, 4, 6};
+    unsigned int m, i;
+    int ret;
+    char str[40];
 
-    return;
+    if (gDiam.use && Bin_LUT_Build_Cal(&gBin_LUT[0], gDiam.amp, gDiam.diam,
+        gDiam.ncal, gDiam.edges, gDiam.nedges) != 0)
+    {
+        strcat(gMessage,"Diameter calibration or edges are not rising, using log bins.\n");
+        gDiam.use = false;
+    }
+
+    gBins.fold = !strcmp(gStatus_Type, "iMet")
+        || !strcmp(gStatus_Type, "iMet_TRM") || !strcmp(gStatus_Type, "WB57");
+    if (gBins.nbins < 1 || gBins.nbins > BIN_VIEW_MAX)
+    {
+        strcat(gMessage,"nbins out of range, using 8.\n");
+        gBins.nbins = 8;
+    }
+    if (gBins.full == 0 || gBins.full > BIN_VIEW_MAX) gBins.full = gBins.nbins;
+    if (gBins.status == 0 || gBins.status > BIN_VIEW_MAX)
+        gBins.status = gBins.nbins;
+    if (gBins.fold) gBins.status = 16;
+    if (gDiam.use)
+    {
+        gBins.master = gDiam.nedges - 1;
+        if (gBins.master % gBins.nbins != 0) gBins.nbins = gBins.master;
+        if (gBins.master % gBins.full != 0) gBins.full = gBins.master;
+        if (gBins.master % gBins.status != 0) gBins.status = gBins.master;
+    }
+
+    if (gBins.master == 0)
+    {
+        m = Bin_LCM(Bin_LCM(gBins.nbins, gBins.full), gBins.status);
+        if (Bin_LCM(m, BIN_MASTER_DEFAULT) <= BIN_LUT_MAX_BINS)
+            m = Bin_LCM(m, BIN_MASTER_DEFAULT);
+        gBins.master = m;
+    }
+    if (gBins.master > BIN_LUT_MAX_BINS
+        || Bin_View_Set(&gView_HK, gBins.master, gBins.nbins, NULL, 0) != 0)
+    {
+        strcat(gMessage,"Master bins are not a multiple of nbins, using nbins.\n");
+        gBins.master = gBins.nbins;
+        Bin_View_Set(&gView_HK, gBins.master, gBins.nbins, NULL, 0);
+    }
+    if (Bin_View_Set(&gView_Full, gBins.master, gBins.full, NULL, 0) != 0)
+    {
+        strcat(gMessage,"Full data bins do not divide the master, using nbins.\n");
+        gBins.full = gBins.nbins;
+        gView_Full = gView_HK;
+    }
+    if (gBins.fold) ret = Bin_View_Set(&gView_Status, gBins.master, 16, fold, 8);
+    else ret = Bin_View_Set(&gView_Status, gBins.master, gBins.status, NULL, 0);
+    if (ret != 0)
+    {
+        strcat(gMessage,"Status bins do not divide the master, using nbins.\n");
+        gBins.status = gBins.nbins;
+        gBins.fold = false;
+        gView_Status = gView_HK;
+    }
+
+    Bin_LUT_Make(&gBin_LUT[0]);
+    if (!gDiam.use) return;
+    strcat(gMessage,"\tDiameter bins, HK edges (um)");
+    for (i = 0; i <= gView_HK.nbins; i++)
+    {
+        if (i == 16 && gView_HK.nbins > 32)    // gMessage room, skip to the end
+        {
+            strcat(gMessage," ...");
+            i = gView_HK.nbins - 16;
+        }
+        sprintf(str," %g",gDiam.edges[gView_HK.edge[i]]);
+        strcat(gMessage, str);
+    }
+    strcat(gMessage,".\n");
+}
+
+//******************************************************************************
+//
+//  Bin_LUT_Make
+//
+//  Build a bin table for the master bins, of log10(max) from gBins, or of
+//  diameter from the calibration curve.
+//
+//  Parameters: struct Bin_LUT *b
+//
+//******************************************************************************
+
+void Bin_LUT_Make(struct Bin_LUT *b)
+{
+    if (gDiam.use) Bin_LUT_Build_Cal(b, gDiam.amp, gDiam.diam, gDiam.ncal,
+        gDiam.edges, gDiam.nedges);
+    else Bin_LUT_Build(b, gBins.master, gBins.logmin, gBins.logmax);
 }
 
 //******************************************************************************
 //
 //  Calc_WidthSTD
 //
-//  Calculate the standard deviation of the width of the particles.
+//  Calculate the average and standard deviation of the width of the
+//  particles, and the other peak statistics, from the moments and sketches
+//  the ingest thread kept for the second (gSecond).
 //
 //******************************************************************************
 void Calc_WidthSTD(void)
 {
-    double var;
+    static const double q[3] = {0.5, 0.9, 0.99};
+    const double us = PRU_CLOCK_HZ/1e6;     // PRU cycles a us
     int i;
-    
-    for ( i =0; i< gArray_Size; i++)
-    {
-        gAW += gData.peak[i].w;
-    }
-    if(gArray_Size > 0) gAW =gAW/gArray_Size;
-    else gAW = 0;	
-    
-    for (i = 0; i < gArray_Size; i++)
+
+    gAW = gSecond.width.mean;
+    gWidthSTD = Stat_STD(&gSecond.width);
+
+    gPeakStat.amp_mean = gSecond.amp.mean;
+    gPeakStat.amp_std = Stat_STD(&gSecond.amp);
+    gPeakStat.dt_mean = gSecond.cycles.mean/us;
+    gPeakStat.dt_std = Stat_STD(&gSecond.cycles)/us;
+    for (i = 0; i < 3; i++)
     {
-        var += (gData.peak[i].w-gAW)*(gData.peak[i].w-gAW);
+        gPeakStat.w[i] = Stat_Quantile(&gSecond.width, q[i]);
+        gPeakStat.amp[i] = Stat_Quantile(&gSecond.amp, q[i]);
+        gPeakStat.dt[i] = Stat_Quantile(&gSecond.cycles, q[i])/us;
     }
-    if(gArray_Size > 2) gWidthSTD = sqrt(var/(gArray_Size-1));
-    else gWidthSTD = 0;	
-    
     return;
 }
 
@@ -2360,7 +3032,10 @@ void Calc_WidthSTD(void)
 //
 //  Write Files
 //
-//  Write the data to files.
+//  Write the data to files. Each file's data is formatted into a buffer
+//  and queued for the writer thread (pops_writer.c), which keeps the files
+//  open. The file headers go at the start of the buffers and are written
+//  only to a new file. If the queue is full that file misses the second.
 //
 //******************************************************************************
 
@@ -2369,80 +3044,102 @@ void Write_Files(void)
 //	Get the Peak File size in bytes, and start new files if it is too big.
 //	Set at 50 MB for now.
 
-    struct stat st;
-    int status;
-    size_t M_length;
+    struct Peak_File_Header ph;
+    struct Snip_File_Header sh;
 
     FILE *fpb;          // binary file pointer
     FILE *fph;          // housekeeping file pointer
     FILE *fpl;          // log file pointer
     FILE *fpr;          // raw data file pointer
+    FILE *fps;          // snippet file pointer
+    char str[100];
 
-    status = stat(gPeakFile, &st);
-    if(status == 0)
+    if (Writer_Queued(&gWriter, WR_PEAK) >= 51200000)
     {
-        if (st.st_size >= 51200000)
-        {
-            makeFileNames();
-        }
+        makeFileNames();
     }
 
-    fph = fopen (gHK_File, "a+");
-    if (fph == NULL) strcat(gMessage, "HK file could not be opened.\n");
+    fph = Writer_Open(&gWriter, WR_HK, gHK_File, NULL, 0, 0);
+    if (fph == NULL) strcat(gMessage, "HK file could not be queued.\n");
     else
     {
-        fprintf(fph,"%s",&gHK);
+        fprintf(fph,"%s",gHK);
+        Writer_Close(&gWriter, fph);
     }
-    fclose (fph);
 
     if (strlen(gMessage) > 0)
     {
-        fpl = fopen(gLogFile, "a+");
-        if (fpl == NULL) strcat(gMessage,"Could not opem message file");
-        else
+        fpl = Writer_Open(&gWriter, WR_LOG, gLogFile, NULL, 0, 0);
+        if (fpl != NULL)
         {
-            fprintf(fpl, "%s",&gMessage);
+            fprintf(fpl, "%s",gMessage);
+            Writer_Close(&gWriter, fpl);
         }
-        fclose (fpl);
     }
     strcpy(gMessage,"");                    // Clear the messages
 
-// Write binary peak data file (size of array, then data)
+// Write binary peak data file (see pops_file.h for the formats)
 
-    fpb = fopen( gPeakFile, "a+");
+    Peak_File_Header_Set(&ph, gPOPS_SN);
+    if (gPeak_Format == 1)
+        fpb = Writer_Open(&gWriter, WR_PEAK, gPeakFile, NULL, 0, 0);
+    else fpb = Writer_Open(&gWriter, WR_PEAK, gPeakFile, &ph, sizeof(ph), 0);
     if (fpb == NULL)
     {
-        strcat(gMessage,"Binary file could not be opened.\n");
+        strcat(gMessage,"Binary file could not be queued.\n");
     }
     else
     {
-        size_t gdatasize, size_array, size_time;
-        size_time = sizeof(double);
-        size_array = sizeof(unsigned int);
-
-        gdatasize = (gArray_Size)*(3*sizeof(unsigned int));
-
-        fwrite(&gArray_Size, size_array,1,fpb);
-        fwrite(&gFullSec,size_time,1,fpb);
-        fwrite(&gData, gdatasize, 1, fpb);
+        if (gPeak_Format == 1)
+        {
+            if (Peak_File_Write_V1(fpb, &gStore, gFullSec) != 0)
+                strcat(gMessage,"Binary file write failed.\n");
+        }
+        else
+        {
+            if (Peak_File_Write(fpb, &gStore, gFullSec, gPOPS_SN) != 0)
+                strcat(gMessage,"Binary file write failed.\n");
+        }
+        Writer_Close(&gWriter, fpb);
     }
 
-    fclose (fpb);
-
 // Write raw data file if save is true
     if(gRaw.save)
     {
-        fpr = fopen(gRawFile, "a+");
-        if (fpr == NULL) strcat(gMessage,"Raw Data file could not be opened.\n");
+        fpr = Writer_Open(&gWriter, WR_RAW, gRawFile, NULL, 0, 0);
+        if (fpr == NULL) strcat(gMessage,"Raw Data file could not be queued.\n");
         else
         {
             fwrite(&gRaw_Data, gRaw.pts*sizeof(unsigned int),1,fpr);
+            Writer_Close(&gWriter, fpr);
+        }
+    }
+
+// Write the waveform snippets PRU1 kept this second (see pops_snip.h)
+    if (gSnip_Queue.head != gSnip_Queue.tail)
+    {
+        Snip_File_Header_Set(&sh, gPOPS_SN);
+        fps = Writer_Open(&gWriter, WR_SNIP, gSnipFile, &sh, sizeof(sh), 0);
+        if (fps == NULL) strcat(gMessage,"Snippet file could not be queued.\n");
+        else
+        {
+            if (Snip_File_Write(fps, &gSnip_Queue, gPOPS_SN) < 0)
+                strcat(gMessage,"Snippet file write failed.\n");
+            Writer_Close(&gWriter, fps);
         }
-        fclose (fpr);
+    }
+    if (gSnip_Queue.lost != gSnip.lost)
+    {
+        sprintf(str,"\tLost %u waveform snippets.\n",
+            gSnip_Queue.lost - gSnip.lost);
+        strcat(gMessage, str);
+        gSnip.lost = gSnip_Queue.lost;
     }
 
-    gPart_Num = gArray_Size;                // Pass the value for in-lineing
-    gArray_Size = 0;                        // Clear these for the next counts
+    gPart_Num = gSecond.n;                  // Pass the value for in-lineing
+    gDT.factor = Bin_Acc_Dead_Factor(&gSecond);
+    memcpy(gDT.hist, gSecond.dt, sizeof(gDT.hist));
+    Peak_Store_Clear(&gStore);              // Clear these for the next counts
     gRaw.ct = 0;
 
 }
@@ -2460,7 +3157,7 @@ void Write_Files(void)
 
 void Implement_CMD(int source)
 {
-    char CMD[20], sValue[20];
+    char CMD[20], sValue[20], str[100];
     char *pch;
     int Eq_pos;
     float value;
@@ -2503,19 +3200,33 @@ void Implement_CMD(int source)
 
         if (!strcmp(CMD, "NewFile"))    makeFileNames();
         if (!strcmp(CMD, "Skip"))       gSkip_Save = (int) value;
-        if (!strcmp(CMD, "nbins"))      gBins.nbins = (int) value;
+        if (!strcmp(CMD, "nbins"))      // status bins, HK keeps nbins
+        {
+            if (gBins.fold)
+                strcat(gMessage,"\tStatus bins are fixed at 8.\n");
+            else if (Bin_View_Set(&gView_Status, gBins.master, (int) value,
+                NULL, 0) == 0) gBins.status = (int) value;
+            else
+            {
+                sprintf(str,"\tnbins=%d does not divide the %u master bins.\n",
+                    (int) value, gBins.master);
+                strcat(gMessage, str);
+            }
+        }
         if (!strcmp(CMD, "logmin"))     gBins.logmin = value;
         if (!strcmp(CMD, "logmax"))     gBins.logmax = value;
+        if (!strcmp(CMD, "logmin") || !strcmp(CMD, "logmax"))
+            gBin_LUT_New = true;            // built by Get_Peaks
         if (!strcmp(CMD, "TH_mult"))    gTH_Mult =  value;
         if (!strcmp(CMD, "MaxPts"))     
         {
             gMaxPeakPts = (int) value;
-            pru1DRAM_int[260] = ((gMaxPeakPts <<16) | gMinPeakPts);
+            gPRU.p1->peak_pts = ((gMaxPeakPts <<16) | gMinPeakPts);
         }
         if (!strcmp(CMD, "MinPts"))
         {
             gMinPeakPts = (int) value;
-            pru1DRAM_int[260] = ((gMaxPeakPts <<16) | gMinPeakPts);
+            gPRU.p1->peak_pts = ((gMaxPeakPts <<16) | gMinPeakPts);
         }    
         if (!strcmp(CMD, "AO0"))
         {
@@ -2537,6 +3248,13 @@ void Implement_CMD(int source)
             else gRaw.view = false;
         }
         if (!strcmp(CMD, "RawPts"))     gRaw.pts = (int) value;
+        if (!strcmp(CMD, "RawCapture")) Raw_Capture_CMD((int) value);
+        if (!strcmp(CMD, "Snippet") && value >= 0)
+        {
+            gSnip.every = (value > PRU1_PARAM_MAX) ? PRU1_PARAM_MAX
+                : (unsigned int) value;
+            gPRU.p1->snip_every = gSnip.every;
+        }
         if (!strcmp(CMD, "Shutdown"))   gStop = true;
         if (!strcmp(CMD, "Reboot"))
         {
@@ -2559,10 +3277,10 @@ void Check_Stop( void)
 {
 //	Check the stop bit on PRU1 (r31.b11)
 
-    if (pru1DRAM_int[259] > 0) 
+    if (gPRU.p1->stop > 0) 
    {
       usleep(1);
-     if(pru1DRAM_int[259] > 0) gStop = 1;
+     if(gPRU.p1->stop > 0) gStop = 1;
      else gStop = 0;
     }
 
@@ -3493,18 +4211,17 @@ void InitPRU_Mem(void)
 
 // Initial value of the Baseline + Threshold
 
-    pru1DRAM_int[256] = (gBL_Start+0x30);    // BLTH
-    pru1DRAM_int[257] = gBL_Start;           // BL
-//	 pru1DRAM_int[258] = 0x00010000;         // start of points
+    gPRU.p1->bl_blth = ((unsigned int)(gBL_Start+0x30) << 16) | gBL_Start; // BLTH, BL
+//	 gPRU.p1->point_ptr = PRU_RING_BASE;     // start of points
 
-    for(i=0; i<256; i++)
+    for(i=0; i<PRU_BL_WORDS; i++)
     {
-        pru1DRAM_int[i] = 0x75007550;
+        gPRU.bl[i] = 0x75007550;
     }
 
-//  for (i=0; i<3072; i++)
+//  for (i=0; i<PRU_RING_WORDS; i++)
 //  {
-//	    pruSharedMem_int[i] = 0x00000000;
+//	    gPRU.ring[i] = 0x00000000;
 //  }
 
 }
@@ -3513,72 +4230,536 @@ void InitPRU_Mem(void)
 //
 // Read PRU Peak Data dt version
 //
-// Read the current m_tail of the Shared Memory buffer m_head is the next 
-// buffer point to read and is carried over from the last read.
-// The base address is 0x00010000 and needs to be subtracted.
-// 4 bytes read at a time. Do not read the point at M_tail, it may have only
-// 2 bytes of data. Read it next time.
+// Read the PRU1 peak count. Everything between the host count (gRing.seq)
+// and the PRU1 count is new. If PRU1 has written more than the buffer holds
+// since the last read, the overwritten peaks are counted in gRing.lost.
+// PRU1 writes the count after the peak, so a counted peak is complete.
+//
+// Called only from the ingest thread. The peaks are decoded in place from the
+// shared memory into gPeak_Queue (see pops_pru.c), with the cycles since the
+// last peak and the absolute time of each peak from its IEP stamp. If the
+// queue is full the rest is left in the buffer for the next call.
+// The read count is passed back to PRU1 for its fill level event.
+// Nothing is read before the first flush anchors the IEP count to the host
+// clock, the peaks and snippets wait in PRU1 memory, so no peak is timed
+// from an epoch of 0 (1970). Any PRU1 overwrites meanwhile count as lost.
+//
+// The new peaks are binned and their widths added up in the histogram of the
+// second being read (gBin_Acc), while they are still in the cache. Once the
+// peak times are anchored, they are also binned into the fast slices, and the
+// slices that have ended by the IEP count are closed.
 //
-// There is a 30,000 particle/second maximum.  Any more than this and the data
-// is invalid, the particles would be overlapping.
+// The waveform snippets PRU1 has kept are copied to gSnip_Queue. Their count
+// is read before the IEP count, so their stamps are older than it.
 //
 //******************************************************************************
 void Read_PRU_Data (void)
 {
-    unsigned int i, j, jmax, m, mmax = 3072, n;
-    unsigned int y_all[3072];
+    unsigned int snips = gPRU.p1->snip_count, head = gPeak_Queue.head;
+    struct Bin_Acc *a;
 
-// Read the current m_tail of the Shared Memory buffer
-// m_head is the next buffer point to read and is
-// carried over from the last read.
-// The base address is 0x00010000 and needs to be subtracted.
-// 4 bytes read at a time. Do not read the point at M_tail, it may have only
-// 2 bytes of data. Read it next time.
+    if (gRing.anchors == 0) return;         // no peak times yet
+    if (PRU_Ring_Read(gPRU.ring, gPRU.p1->peak_count, gPRU.iep, &gRing,
+        &gPeak_Queue) > 0)
+    {
+        gPRU.p1->host_count = gRing.seq;                    // host read count
+    }
+    a = &gBin_Acc[gIngest.fill];
+    Bin_Acc_Queue(a, &gPeak_Queue, head);
+    if (gFast.use && gRing.anchors > 0)
+    {
+        Fast_Queue(&gFast_Ring, a->lut, &gPeak_Queue, head);
+        Fast_Advance(&gFast_Ring, gRing.now - gRing.epoch);
+    }
+    Snip_Read(&gSnip_Queue, &gPRU, snips, &gRing);
+}
 
-    m = pru1DRAM_int[258];
+//******************************************************************************
+//
+//  Get_Peaks
+//
+//  Move the peaks read by the ingest thread into gStore for the 1 Hz
+//  processing.
+//
+//  The flush closes the second on the ingest thread, which hands over its
+//  histogram (gSecond) and the queue head it ends at. Only the peaks up to
+//  that head are taken, so the store and the histogram hold the same
+//  particles. If the thread did not close the second in time its peaks are
+//  left for the next one, and if it closed two, the second one was added to
+//  the first, so no histogram is skipped. Either goes to the log, from the
+//  seconds in the histogram. It is taken with a compare and swap of the
+//  closes, which fails if the thread closed another meanwhile. A new bin
+//  table is built here, when the thread is done with the spare.
+//
+//  The store grows in chunks up to gMaxPart particles/second (Setting.Peak
+//  MaxPart), which only limits the memory used. Any more are dropped, but
+//  are still counted and binned.
+//
+//  The particles lost in the second, overwritten in the point buffer or over
+//  the maximum, and the buffer high water go to gLost and the log.
+//
+//******************************************************************************
 
-    m_tail = (unsigned int)(((double)(m - 0x00010000))/4.0);
+void Get_Peaks(void)
+{
+    static unsigned int steps = 0;
+    struct Bin_Acc a;
+    unsigned int total, n, high, i;
+    char str[100];
+
+    Ingest_Flush();                         // everything up to now
+    n = gSecond.head;
+    Bin_Acc_Clear(&gSecond, NULL, NULL);    // empty unless closed
+    gSecond.head = n;
+    for (i = 0; i < 4; i++)                 // again if closed meanwhile
+    {
+        n = gIngest.unread;
+        if (n == 0) break;
+        __sync_synchronize();               // count before the histogram
+        if (n & INGEST_BUSY) continue;      // being added to
+        a = gBin_Acc[gIngest.fill ^ 1];
+        __sync_synchronize();               // histogram before the take
+        if (__sync_bool_compare_and_swap(&gIngest.unread, n, 0))
+        {
+            gSecond = a;
+            break;
+        }
+    }
+    if (gIngest.running && gSecond.secs != 1)
+    {
+        sprintf(str,"\tIngest closed %u seconds, not 1.\n", gSecond.secs);
+        strcat(gMessage, str);
+    }
+    Peak_Store_Fill(&gStore, &gPeak_Queue, gSecond.head);
 
-// y_all is the new y data, 16 bytes at a time
+// ignore any data over the maximum in one second
+    if (gStore.n >= gStore.max_peaks)
+        gIngest.drop += Peak_Queue_Flush(&gPeak_Queue, gSecond.head);
 
+    if (gBin_LUT_New && gIngest.flush_done == gIngest.flush_req)
+    {
+        Bin_LUT_Make(&gBin_LUT[gBin_LUT_Use ^ 1]);
+        gBin_LUT_Use ^= 1;                  // from the next close
+        gBin_LUT_New = false;
+    }
 
-    if (m_head == m_tail) return;                          // no new data
+    total = gRing.lost + gIngest.drop;
+    gLost.num = total - gLost.total;
+    gLost.total = total;
+    high = __sync_lock_test_and_set(&gRing.high, 0);   // and restart it
+    gLost.ring_hw = (100*high)/PRU_RING_RECS;
+    if (gLost.num > 0)
+    {
+        sprintf(str,"\tLost %u particles, point buffer %u%% full.\n",
+            gLost.num, gLost.ring_hw);
+        strcat(gMessage, str);
+    }
+    if (gRing.steps != steps)               // PRU clock reset to gFullSec
+    {
+        steps = gRing.steps;
+        strcat(gMessage, "\tParticle times stepped to the system clock.\n");
+    }
+}
 
-    if (m_tail > m_head)                                   // read buffer continuous
+//******************************************************************************
+//
+//  Ingest_Start
+//
+//  Start the thread that reads the PRU1 point buffer. It runs SCHED_FIFO at
+//  gIngest.priority, pinned to gIngest.cpu. If the real-time policy is
+//  refused it is started as a normal thread. The first histogram it fills
+//  is set up here, with the 2D bins if the 2D histogram is on, and the fast
+//  slices if they are on.
+//
+//  Returns: int (0 started, -1 error)
+//
+//******************************************************************************
+
+int Ingest_Start(void)
+{
+    pthread_attr_t attr;
+    struct sched_param param;
+    cpu_set_t cpus;
+    int ret = -1;
+
+    if (gH2D.use && H2D_Map_Build(&gH2D_Map, gBins.master, gH2D.amp_bins,
+        gH2D.width_bins, gH2D.width_max) != 0)
     {
-        i_tail = m_tail - m_head;
-        for(i = m_head; i < m_tail; i++)                   // m_head..m_tail-1
-        {
-            y_all[i-m_head] = pruSharedMem_int[i];
-        }
+        strcat(gMessage,"\t2D histogram bins are out of range, 2D is off.\n");
+        gH2D.use = false;
     }
-    else                                                   // to end of buffer and start of next
+    Bin_Acc_Clear(&gBin_Acc[0], &gBin_LUT[0], gH2D.use ? &gH2D_Map : NULL);
+    if (gFast.use && Fast_Init(&gFast_Ring, gFast.rate, gBins.master,
+        gFast.nbins) != 0)
     {
-        i_tail = mmax - m_head + m_tail - 1;               // the -1 is because the buffer
-                                                           // is 0..3071
-        for (i = m_head; i < mmax; i++)                    // m_head..3071
+        strcat(gMessage,"\tFast rate or bins are out of range, fast is off.\n");
+        gFast.use = false;
+    }
+
+    gIngest.run = true;
+    pthread_attr_init(&attr);
+    if (gIngest.priority > 0)
+    {
+        param.sched_priority = gIngest.priority;
+        pthread_attr_setinheritsched(&attr, PTHREAD_EXPLICIT_SCHED);
+        pthread_attr_setschedpolicy(&attr, SCHED_FIFO);
+        pthread_attr_setschedparam(&attr, &param);
+        ret = pthread_create(&gIngest.thread, &attr, Ingest_Thread, NULL);
+        if (ret != 0) strcat(gMessage,"\tIngest: SCHED_FIFO refused.\n");
+    }
+    if (ret != 0) ret = pthread_create(&gIngest.thread, NULL, Ingest_Thread, NULL);
+    pthread_attr_destroy(&attr);
+    if (ret != 0)
+    {
+        gIngest.run = false;
+        return -1;
+    }
+    gIngest.running = true;
+
+    if (gIngest.cpu >= 0)
+    {
+        CPU_ZERO(&cpus);
+        CPU_SET(gIngest.cpu, &cpus);
+        if (pthread_setaffinity_np(gIngest.thread, sizeof(cpus), &cpus) != 0)
+            strcat(gMessage,"\tIngest: could not pin to the cpu.\n");
+    }
+    return 0;
+}
+
+//******************************************************************************
+//
+//  Ingest_Flush
+//
+//  Have the ingest thread read the point buffer now, so the second being
+//  closed has every peak PRU1 has written. In event mode the thread is woken
+//  with the same event PRU1 sends. Waits at most 2 ms.
+//
+//  The last gFullSec and its IEP count go with the request, for the thread
+//  to tie the peak times to.
+//
+//******************************************************************************
+
+void Ingest_Flush(void)
+{
+    unsigned int req;
+    int i;
+
+    if (!gIngest.running) return;
+    gIngest.anchor_sec = gFullSec;
+    gIngest.anchor_iep = gFullSec_IEP;
+    __sync_synchronize();                   // anchor before the request
+    req = gIngest.flush_req + 1;
+    gIngest.flush_req = req;
+    if (gIngest.event) PRU_Mem_Event(&gPRU);
+    for (i = 0; i < 40 && gIngest.flush_done != req; i++) usleep(50);
+}
+
+//******************************************************************************
+//
+//  Ingest_Close
+//
+//  Close the second. The histogram being filled keeps the queue head it
+//  ends at, for Get_Peaks, and the other one is emptied for the next
+//  second, to be binned by the table of gBins. If Get_Peaks has not read
+//  the last second yet, this one is added to it instead, and the same
+//  histogram is emptied. The last second is held with INGEST_BUSY while it
+//  is added to, taken from the count Get_Peaks swaps to 0, so the two never
+//  both have it.
+//
+//******************************************************************************
+
+void Ingest_Close(void)
+{
+    unsigned int f = gIngest.fill, n = gIngest.unread;
+    struct Bin_Acc *a = &gBin_Acc[f];
+
+    a->head = gPeak_Queue.head;
+    a->secs = 1;
+    if (n != 0 && __sync_bool_compare_and_swap(&gIngest.unread, n,
+        n | INGEST_BUSY))                   // last second not read
+    {
+        Bin_Acc_Sum(&gBin_Acc[f ^ 1], a);
+    }
+    else
+    {
+        n = 0;                              // read, or none yet
+        f ^= 1;
+        gIngest.fill = f;
+    }
+    Bin_Acc_Clear(&gBin_Acc[f], &gBin_LUT[gBin_LUT_Use],
+        gH2D.use ? &gH2D_Map : NULL);
+    __sync_synchronize();                   // histograms before the count
+    gIngest.unread = n + 1;
+}
+
+//******************************************************************************
+//
+//  Ingest_Thread
+//
+//  Read the PRU1 point buffer, independent of the slow I/O in the main loop.
+//  In event mode the thread sleeps in PRU_Mem_Wait until PRU1 has
+//  written notify_peaks peaks or the buffer passes notify_fill. Otherwise it
+//  polls every gIngest.period_us on an absolute schedule. Only touches
+//  gRing, gBin_Acc and the producer side of gPeak_Queue. A flush request
+//  also anchors the peak times to gFullSec, and closes the second once the
+//  buffer is read.
+//
+//******************************************************************************
+
+void *Ingest_Thread(void *arg)
+{
+    struct timespec next;
+    unsigned int req;
+
+    clock_gettime(CLOCK_MONOTONIC, &next);
+    while (gIngest.run)
+    {
+        req = gIngest.flush_req;
+        if (gIngest.event)
         {
-            y_all[i-m_head] = pruSharedMem_int[i];
+            PRU_Mem_Wait(&gPRU);
+            req = gIngest.flush_req;
         }
+        if (req != gIngest.flush_done)
+        {
+            __sync_synchronize();           // request before the anchor
+            PRU_Ring_Anchor(&gRing, gIngest.anchor_iep, gIngest.anchor_sec);
+        }
+        Read_PRU_Data();
+        if (req != gIngest.flush_done) Ingest_Close();
+        gIngest.flush_done = req;
+        if (gIngest.event) continue;
+
+        next.tv_nsec += gIngest.period_us*1000L;
+        while (next.tv_nsec >= Billion)
+        {
+            next.tv_nsec -= Billion;
+            next.tv_sec += 1;
+        }
+        clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &next, NULL);
+    }
+    return NULL;
+}
+
+//******************************************************************************
+//
+//  Raw_Capture_CMD
+//
+//  RawCapture=N: capture N seconds of every A/D sample to
+//  RawADC_<timestamp>.b in today's directory. N = 0 stops a capture.
+//  A running capture is stopped before a new one starts.
+//
+//  Parameters: int seconds (seconds to capture, 0 = stop)
+//
+//******************************************************************************
+
+void Raw_Capture_CMD(int seconds)
+{
+    char path[150], str[200];
+    int ret;
+
+    Raw_Capture_Check(true);                // stop and log the last one
+    if (seconds <= 0) return;
+
+    sprintf(path, "%sRawADC_%s.b", gDataDir, gTimestamp);
+    ret = Capture_Start(&gCapture, &gPRU, path, seconds);
+    if (ret == 0) sprintf(str, "\tRaw capture of %d s to %s.\n", seconds, path);
+    else if (ret == -2) sprintf(str, "\tRaw capture: no DDR ring (extmem).\n");
+    else sprintf(str, "\tRaw capture could not start (%d).\n", ret);
+    strcat(gMessage, str);
+}
+
+//******************************************************************************
+//
+//  Raw_Capture_Check
+//
+//  Once the capture thread is done, or to stop it, wait for it and log the
+//  samples written and lost.
+//
+//  Parameters: bool stop (stop a capture that is still running)
+//
+//******************************************************************************
+
+void Raw_Capture_Check(bool stop)
+{
+    char str[200];
+
+    if (!gCapture.running) return;
+    if (!gCapture.done && !stop) return;
+    Capture_Stop(&gCapture);
+    sprintf(str, "\tRaw capture done: %llu samples, %llu lost, %llu torn",
+        gCapture.samples, gCapture.lost, gCapture.torn);
+    strcat(gMessage, str);
+    if (gCapture.err != 0)
+    {
+        sprintf(str, ", write error %d", gCapture.err);
+        strcat(gMessage, str);
+    }
+    strcat(gMessage, ".\n");
+}
+
+//******************************************************************************
+//
+//  Write_BL_Telemetry
+//
+//  Once a second, write the Calc_Baseline updates kept since the last call
+//  to the telemetry file and send them over UDP, and log any lost. The
+//  window in the header is that of the estimator, the 512 point buffer for
+//  the robust ones.
+//
+//******************************************************************************
 
-        for (i = 0; i < m_tail; i++)                       // 0..m_tail-1
+void Write_BL_Telemetry(void)
+{
+    struct BL_Tel_File_Header h;
+    FILE *fpt = NULL;
+    char str[100];
+
+    if (!gBL_Tel.use) return;
+    BL_Tel_File_Header_Set(&h, gPOPS_SN, gBL_Est.type,
+        (gBL_Est.type == BL_EST_MEAN) ? gBL_Est.blocks*PRU_BL_POINTS
+        : PRU_BL_POINTS, gTH_Mult);
+    if (gBL_Tel.save)
+    {
+        fpt = Writer_Open(&gWriter, WR_BLTEL, gBLTelFile, &h, sizeof(h), 0);
+        if (fpt == NULL) strcat(gMessage,"BL telemetry file could not be queued.\n");
+    }
+    if (BL_Tel_Write(&gBL_Tel_Ring, fpt, &h, UDPBL, &gUDP.udp[4].remaddr,
+        sizeof(gUDP.udp[4].remaddr)) < 0)
+        strcat(gMessage,"BL telemetry file write failed.\n");
+    if (fpt != NULL) Writer_Close(&gWriter, fpt);
+
+    if (gBL_Tel_Ring.lost != gBL_Tel.lost)
+    {
+        sprintf(str,"\tLost %u baseline telemetry updates.\n",
+            gBL_Tel_Ring.lost - gBL_Tel.lost);
+        strcat(gMessage, str);
+        gBL_Tel.lost = gBL_Tel_Ring.lost;
+    }
+}
+
+//******************************************************************************
+//
+//  Write_H2D
+//
+//  Once a second, write the 2D histogram of the last second (gSecond) to
+//  the 2D file and send it over UDP.
+//
+//  The header describes the bin table in use. When it changes (the logmin
+//  and logmax commands) it is written to the file again. The second binned
+//  by the old table, or a mix of both, is written with no cells.
+//
+//******************************************************************************
+
+void Write_H2D(void)
+{
+    static struct H2D_File_Header last;     // bins last written to the file
+    const struct Bin_LUT *b = &gBin_LUT[gBin_LUT_Use];
+    struct H2D_File_Header h;
+    FILE *fph = NULL;
+    int newh;
+
+    if (!gH2D.use) return;
+    H2D_File_Header_Set(&h, &gH2D_Map, b->logmin, b->logmax,
+        gDiam.use ? gDiam.edges : NULL, gBins.master, gPOPS_SN);
+    newh = (last.header_bytes != 0 && memcmp(&h, &last, sizeof(h)) != 0);
+    if (gH2D.save)
+    {
+        fph = Writer_Open(&gWriter, WR_H2D, gH2DFile, &h, h.header_bytes, 0);
+        if (fph == NULL) strcat(gMessage,"2D histogram file could not be queued.\n");
+    }
+    if (H2D_Write(&gH2D_Map, (gSecond.map != NULL && gSecond.gen == b->gen)
+        ? gSecond.h2d : NULL, gSecond.n, gFullSec, fph, &h, newh, UDPH2D,
+        &gUDP.udp[5].remaddr, sizeof(gUDP.udp[5].remaddr), gH2D.seq) < 0)
+        strcat(gMessage,"2D histogram file write failed.\n");
+    if (UDPH2D >= 0) gH2D.seq++;
+    if (fph == NULL) return;
+    Writer_Close(&gWriter, fph);
+    last = h;                               // in the file
+}
+
+//******************************************************************************
+//
+//  Fast_Poll
+//
+//  Take the slices the ingest thread has closed, send each one over UDP as
+//  it comes, and keep it for the fast HK file. Called every ms in the wait
+//  for the next second, so the slices go out within a few ms of their end.
+//  A line is "DateTime,PartCt,PartCon,b0,...", the time the start of the
+//  slice and the concentration per cc from the last flow. If gFast_Out is
+//  full the slices wait in the ring for the next Write_Fast.
+//
+//******************************************************************************
+
+void Fast_Poll(void)
+{
+    struct Fast_Rec r;
+    char line[512], str[20];
+    unsigned int i;
+    double con;
+
+    if (!gFast.use) return;
+    while (strlen(gFast_Out) + sizeof(line) < sizeof(gFast_Out)
+        && Fast_Get(&gFast_Ring, &r))
+    {
+        con = 0.0;
+        if (gAI_Data.ai[0].value > 0.0)     // flow rate cc/s
+            con = r.n*(double)gFast.rate/gAI_Data.ai[0].value;
+        sprintf(line,"%.3f,%u,%.2f",r.t,r.n,con);
+        for (i = 0; i < gFast.nbins; i++)
         {
-            y_all[i+mmax-m_head] = pruSharedMem_int[i];
+            sprintf(str,",%u",r.hist[i]);
+            strcat(line,str);
         }
+        strcat(line,"\r\n");
+        if (UDPFast >= 0) Write_UDP(UDPFast, 6, line);
+        strcat(gFast_Out, line);
     }
-    m_head=m_tail;                                         // Start of next time through
-    for (j=0; j< i_tail; j+=2)
+}
+
+//******************************************************************************
+//
+//  Write_Fast
+//
+//  Once a second, write the slices taken so far to the fast HK file, with
+//  the header when the file is new.
+//
+//******************************************************************************
+
+void Write_Fast(void)
+{
+    FILE *fpf;
+    unsigned int i;
+    char str[100], header[400];
+
+    if (!gFast.use) return;
+    Fast_Poll();
+    if (gFast.save && strlen(gFast_Out) > 0)
     {
-        if(gArray_Size < 29999) // ignore any data over 30,000 particles in one second
+        strcpy(header,"DateTime,PartCt,PartCon");
+        for (i = 0; i < gFast.nbins; i++)
         {
-        gData.peak[gArray_Size].w =(unsigned int) ((y_all[j] &  0xFFFF0000) >>16) ;	    
-        //lower 2 bytes
-        gData.peak[gArray_Size].max = (unsigned int) (y_all[j] &  0x0000FFFF) ;			
-        //top 2 bytes
-        gData.peak[gArray_Size].dt =(unsigned int) (((double)(y_all[j+1] + 16))/200.) ;		
-        //4 bytes to dt in uS. 16 added to make up for lost cycles. Divide by 200 MHz.
-        gArray_Size+=1;
+            sprintf(str,",b%u",i);
+            strcat(header,str);
         }
+        strcat(header,"\r\n");
+        fpf = Writer_Open(&gWriter, WR_FAST, gFastFile, header, strlen(header), 0);
+        if (fpf == NULL) strcat(gMessage,"Fast HK file could not be queued.\n");
+        else
+        {
+            fprintf(fpf,"%s",gFast_Out);
+            Writer_Close(&gWriter, fpf);
+        }
+    }
+    gFast_Out[0] = '\0';
+
+    if (gFast_Ring.lost != gFast.lost || gFast_Ring.late != gFast.late)
+    {
+        sprintf(str,"\tFast slices lost %u, late particles %u.\n",
+            gFast_Ring.lost - gFast.lost, gFast_Ring.late - gFast.late);
+        strcat(gMessage, str);
+        gFast.lost = gFast_Ring.lost;
+        gFast.late = gFast_Ring.late;
     }
 }
 
@@ -0,0 +1,746 @@
+/*
+// Filename: POPS_Bench.c
+// Version: 1.0
+//
+// Project: NOAA - POPS
+//
+// Description - Micro-benchmarks for the host side of the POPS program.
+// These run on the BBB or on any Linux box, without the PRUs. Synthetic
+// particle data is generated at a set rate and the time taken by the
+// host code is reported as ns/particle.
+//
+//  ring    Decode the PRU1 point buffer (Read_PRU_Data). The legacy copy to
+//          y_all and double conversion is timed against PRU_Ring_Decode.
+//  store   Stress the per second particle store at 100k particles/s, through
+//          PRU_Ring_Read, the queue and Peak_Store_Fill. Checks that no
+//          particle is lost under the limit, and that memory stays bounded
+//          when the limit (MaxPart) is below the rate.
+//  baseline  Calc_Baseline: the legacy scan of the 512 baseline points
+//          through doubles against the PRU1 block records (PRU_BL_Stats),
+//          with the buffer recorded as the last block, and the
+//          robust estimators (pops_baseline.c), with 64 or 512 new points
+//          per call, clean and with 20% peak tails under BLTH.
+//  bins    CalcBins of one second of 30k particles in the per second store,
+//          log10 and a divide per particle against the lookup table
+//          (pops_bins.c), with the histograms checked to be the same, and
+//          the cost of building the table. The 8 to 200 bin histograms
+//          summed from the 400 bin master are checked against binning each
+//          one directly.
+//  pipe    The host pipeline against the PRU emulator in real time. Start
+//          popsfeed first, e.g. "popsfeed /dev/shm/pops_pru 100000 &", then
+//          "popsbench pipe 10". Not part of "all".
+//
+// Usage: popsbench [name] [seconds]   (default: all, 10 simulated seconds)
+//
+// See SOFTWARE DISCLAIMER.md.
+*/
+
+//******************************************************************************
+//
+// Include files:
+//
+//******************************************************************************
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <time.h>
+#include <sys/resource.h>
+#include "pops_pru.h"
+#include "pops_store.h"
+#include "pops_baseline.h"
+#include "pops_bins.h"
+
+//******************************************************************************
+//
+// Definitions
+//
+//******************************************************************************
+
+#define BENCH_MAX_RATE 100000               // particles/second
+#define BENCH_READS 1000                    // host reads per second (1 ms loop)
+#define BENCH_BL_CALLS 20000                // Calc_Baseline calls per case
+#define BENCH_BL 1500                       // baseline and its noise STD
+#define BENCH_BL_STD 8.
+#define BENCH_BIN_RATE 30000                // particles/second to bin
+#define BENCH_NBINS 16                      // bin settings, iMet
+#define BENCH_VIEWS 5                       // views of the master checked
+#define BENCH_LOGMIN 1.4
+#define BENCH_LOGMAX 4.817
+
+struct Peaks {                              // legacy peak data (POPS_BBB 2.0)
+    unsigned int max;
+    unsigned int w;
+    unsigned int dt;
+};
+
+//******************************************************************************
+//
+// Function prototypes:
+//
+//******************************************************************************
+
+void Bench_Ring(int seconds);
+void Bench_Store(int seconds);
+void Bench_Pipe(int seconds);
+void Bench_Baseline(void);
+void Bench_Bins(int seconds);
+double Now_ns(void);
+unsigned int Bench_Rand(void);
+unsigned int Ring_Feed(unsigned int *ring, unsigned int tail, unsigned int n,
+    unsigned int rate);
+unsigned int Legacy_Read(unsigned int *ring, unsigned int m_head,
+    unsigned int m_tail, struct Peaks *peak, unsigned int size);
+void Legacy_Baseline(const volatile unsigned int *bl, double *mean,
+    double *std);
+unsigned int BL_Point(unsigned int tails);
+void Legacy_CalcBins(const struct Peak_Store *s, int nbins, int *hist);
+
+//******************************************************************************
+//
+// Global variables:
+//
+//******************************************************************************
+
+int gRates[3] = {10000, 30000, 100000};     // particles/second to replay
+unsigned int gSeed = 12345;                 // synthetic data seed
+volatile unsigned int gSink;                // keeps results live
+unsigned int gIEP;                          // synthetic IEP timer count
+
+//******************************************************************************
+//
+// Main program:
+//
+//******************************************************************************
+
+int main(int argc, char *argv[])
+{
+    int seconds = 10;
+    const char *name = "all";
+
+    if (argc > 1) name = argv[1];
+    if (argc > 2) seconds = atoi(argv[2]);
+    if (seconds < 1) seconds = 1;
+
+    if (!strcmp(name, "all") || !strcmp(name, "ring")) Bench_Ring(seconds);
+    if (!strcmp(name, "all") || !strcmp(name, "store")) Bench_Store(seconds);
+    if (!strcmp(name, "all") || !strcmp(name, "baseline")) Bench_Baseline();
+    if (!strcmp(name, "all") || !strcmp(name, "bins")) Bench_Bins(seconds);
+    if (!strcmp(name, "pipe")) Bench_Pipe(seconds);
+
+    return 0;
+}
+
+//******************************************************************************
+//
+//  Now_ns
+//
+//  Monotonic time in ns.
+//
+//******************************************************************************
+
+double Now_ns(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double)ts.tv_sec*1e9 + (double)ts.tv_nsec;
+}
+
+//******************************************************************************
+//
+//  Bench_Rand
+//
+//  Small LCG so the synthetic data is the same every run.
+//
+//******************************************************************************
+
+unsigned int Bench_Rand(void)
+{
+    gSeed = gSeed*1103515245u + 12345u;
+    return gSeed >> 8;
+}
+
+//******************************************************************************
+//
+//  Ring_Feed
+//
+//  Write n synthetic peaks into the point buffer the way WRITE_PK does,
+//  stamped from gIEP.
+//
+//  Parameters: unsigned int *ring (point buffer)
+//              unsigned int tail (next word to write)
+//              unsigned int n (peaks to write)
+//              unsigned int rate (particles/second, sets the stamps)
+//
+//  Returns: unsigned int (new tail)
+//
+//******************************************************************************
+
+unsigned int Ring_Feed(unsigned int *ring, unsigned int tail, unsigned int n,
+    unsigned int rate)
+{
+    unsigned int i, max, w, mean = 200000000u/rate;
+
+    for (i = 0; i < n; i++)
+    {
+        max = 20 + Bench_Rand() % 65000;
+        w = 5 + Bench_Rand() % 60;
+        ring[tail] = (w << 16) | max;
+        gIEP += mean/2 + Bench_Rand() % mean;
+        ring[tail + 1] = gIEP;
+        tail += PRU_RING_REC_WORDS;
+        if (tail >= PRU_RING_WORDS) tail = 0;
+    }
+    return tail;
+}
+
+//******************************************************************************
+//
+//  Legacy_Read
+//
+//  The Read_PRU_Data of POPS_BBB.c 3.0: copy the unread span to a stack
+//  array, then convert each peak with a double divide.
+//
+//******************************************************************************
+
+unsigned int Legacy_Read(unsigned int *ring, unsigned int m_head,
+    unsigned int m_tail, struct Peaks *peak, unsigned int size)
+{
+    unsigned int i, j, i_tail, mmax = 3072;
+    unsigned int y_all[3072];
+
+    if (m_head == m_tail) return size;
+    if (m_tail > m_head)
+    {
+        i_tail = m_tail - m_head;
+        for(i = m_head; i < m_tail; i++) y_all[i-m_head] = ring[i];
+    }
+    else
+    {
+        i_tail = mmax - m_head + m_tail - 1;
+        for (i = m_head; i < mmax; i++) y_all[i-m_head] = ring[i];
+        for (i = 0; i < m_tail; i++) y_all[i+mmax-m_head] = ring[i];
+    }
+    for (j=0; j< i_tail; j+=2)
+    {
+        peak[size].w =(unsigned int) ((y_all[j] &  0xFFFF0000) >>16) ;
+        peak[size].max = (unsigned int) (y_all[j] &  0x0000FFFF) ;
+        peak[size].dt =(unsigned int) (((double)(y_all[j+1] + 16))/200.) ;
+        size+=1;
+    }
+    return size;
+}
+
+//******************************************************************************
+//
+//  Bench_Ring
+//
+//  Replay a synthetic point buffer at each rate. The host reads every 1 ms,
+//  as the main loop does, and each second the columns are emptied.
+//
+//  Parameters: int seconds (simulated seconds per rate)
+//
+//******************************************************************************
+
+void Bench_Ring(int seconds)
+{
+    static unsigned int ring[PRU_RING_WORDS];
+    static unsigned short max[BENCH_MAX_RATE], w[BENCH_MAX_RATE];
+    static unsigned int cycles[BENCH_MAX_RATE];
+    static struct Peaks peak[BENCH_MAX_RATE];
+    unsigned int r, s, k, head, tail, n, size, per_read, left;
+    double t0, t_new, t_old, total;
+
+    printf("ring: decode of the PRU1 point buffer, %d s per rate\n", seconds);
+    printf("%10s %12s %14s %14s\n", "part/s", "particles", "legacy ns/pt",
+        "decode ns/pt");
+
+    for (r = 0; r < 3; r++)
+    {
+        head = tail = 0;
+        t_new = t_old = total = 0.;
+        for (s = 0; s < (unsigned int)seconds; s++)
+        {
+            size = n = 0;
+            left = gRates[r];
+            for (k = 0; k < BENCH_READS; k++)
+            {
+                per_read = left/(BENCH_READS - k);  // spread over the second
+                left -= per_read;
+                tail = Ring_Feed(ring, tail, per_read, gRates[r]);
+
+                t0 = Now_ns();
+                size = Legacy_Read(ring, head, tail, peak, size);
+                t_old += Now_ns() - t0;
+
+                t0 = Now_ns();
+                n += PRU_Ring_Decode(ring, head, tail, max + n, w + n,
+                    cycles + n, BENCH_MAX_RATE - n);
+                t_new += Now_ns() - t0;
+
+                head = tail;
+            }
+            for (k = 0; k < n; k++)             // both must agree
+            {
+                if (n != size || max[k] != peak[k].max || w[k] != peak[k].w
+                    || (cycles[k] + 16)/200 != peak[k].dt)
+                {
+                    printf("ring: decode differs from legacy at %u\n", k);
+                    return;
+                }
+            }
+            total += n;
+            gSink += size + max[n/2] + w[n/3] + cycles[n-1] + peak[size/2].dt;
+        }
+        printf("%10d %12.0f %14.2f %14.2f\n", gRates[r], total, t_old/total,
+            t_new/total);
+    }
+}
+
+//******************************************************************************
+//
+//  Bench_Store
+//
+//  Run the host path of POPS_BBB.c for each rate: PRU1 writes the point
+//  buffer and its peak count, the ingest side reads it every 1 ms into the
+//  queue, and once a second the queue goes to the store, which is summed
+//  (as CalcBins would) and cleared. When nothing is lost or dropped the sums
+//  of max in and out must agree.
+//  Memory is the chunks held by the store and the process maximum RSS.
+//
+//  Parameters: int seconds (simulated seconds per rate)
+//
+//******************************************************************************
+
+void Bench_Store(int seconds)
+{
+    static unsigned int ring[PRU_RING_WORDS];
+    static struct Peak_Queue q;
+    static unsigned int rates[2] = {100000, 100000};
+    static unsigned int limits[2] = {250000, 50000};
+    struct Peak_Store store;
+    struct PRU_Ring rd;
+    struct Peak_Chunk *c;
+    struct rusage ru;
+    unsigned int r, k, i, tail, count, per_read, left, kept, dropped;
+    unsigned long long sum_in, sum_out;
+    unsigned long bytes_1, bytes_n;
+    long rss_1 = 0;
+    double t0, t_fill;
+    int s;
+
+    printf("store: per second particle store, %d s per rate\n", seconds);
+    printf("%8s %8s %8s %9s %8s %8s %9s %8s %7s %5s\n", "part/s", "MaxPart",
+        "kept/s", "ring lost", "dropped", "KB 1st s", "KB last s", "RSS grow",
+        "ns/pt", "check");
+
+    for (r = 0; r < 2; r++)
+    {
+        memset(&rd, 0, sizeof(rd));
+        q.head = q.tail = 0;
+        Peak_Store_Init(&store, limits[r], 32768);
+        tail = count = 0;
+        sum_in = sum_out = 0;
+        kept = dropped = 0;
+        bytes_1 = 0;
+        t_fill = 0.;
+        for (s = 0; s < seconds; s++)
+        {
+            left = rates[r];
+            for (k = 0; k < BENCH_READS; k++)
+            {
+                per_read = left/(BENCH_READS - k);
+                left -= per_read;
+                i = tail;
+                tail = Ring_Feed(ring, tail, per_read, rates[r]);
+                count += per_read;
+                for (; i != tail; i = (i + 2) % PRU_RING_WORDS)
+                    sum_in += ring[i] & 0x0000FFFF;
+                PRU_Ring_Read(ring, count, &gIEP, &rd, &q);
+            }
+
+            t0 = Now_ns();
+            Peak_Store_Fill(&store, &q, q.head);
+            if (store.n >= store.max_peaks)
+                dropped += Peak_Queue_Flush(&q, q.head);
+            for (c = store.first; c != NULL; c = c->next)
+            {
+                for (i = 0; i < c->n; i++) sum_out += c->max[i];
+            }
+            kept = store.n;
+            Peak_Store_Clear(&store);
+            t_fill += Now_ns() - t0;
+
+            getrusage(RUSAGE_SELF, &ru);
+            if (s == 0)
+            {
+                bytes_1 = Peak_Store_Bytes(&store);
+                rss_1 = ru.ru_maxrss;
+            }
+        }
+        bytes_n = Peak_Store_Bytes(&store);
+        printf("%8u %8u %8u %9u %8u %8lu %9lu %6ldKB %7.2f %5s\n", rates[r],
+            limits[r], kept, rd.lost, dropped, bytes_1/1024, bytes_n/1024,
+            ru.ru_maxrss - rss_1, t_fill/((double)seconds*kept),
+            (rd.lost + dropped > 0) ? "-" : (sum_in == sum_out) ? "ok" : "BAD");
+        gSink += (unsigned int)(sum_in + sum_out);
+    }
+}
+
+//******************************************************************************
+//
+//  Bench_Pipe
+//
+//  Run the POPS_BBB.c host path against the emulator written by popsfeed:
+//  the PRU1 parameters are set as at start up, the buffer is read every
+//  1 ms as the ingest thread polls, and each second the queue goes to the
+//  store. Prints the particles, lost particles and buffer high water each
+//  second, then the host CPU time per particle.
+//
+//  Parameters: int seconds (wall clock seconds to run)
+//
+//******************************************************************************
+
+void Bench_Pipe(int seconds)
+{
+    static struct Peak_Queue q;
+    struct PRU_Mem pru;
+    struct Peak_Store store;
+    struct PRU_Ring rd;
+    struct timespec next;
+    struct rusage ru;
+    unsigned int k, lost_last = 0;
+    unsigned long long total = 0;
+    int s;
+    double cpu;
+
+    if (PRU_Mem_Open(&pru, PRU_BACKEND_EMU, PRU_EMU_PATH) != 0)
+    {
+        printf("pipe: could not open %s\n", PRU_EMU_PATH);
+        return;
+    }
+    memset(&rd, 0, sizeof(rd));
+    Peak_Store_Init(&store, 250000, 32768);
+    pru.p1->point_ptr = PRU_RING_BASE;
+    pru.p1->stop = 0;
+    pru.p1->notify_peaks = 64;
+    pru.p1->notify_fill = 2*PRU_RING_WORDS;
+    pru.p1->host_count = 0;
+    pru.p1->peak_count = 0;
+    PRU_Mem_Start(&pru, NULL, NULL);
+
+    printf("pipe: host path against %s, %d s\n", PRU_EMU_PATH, seconds);
+    printf("%6s %10s %10s %8s\n", "s", "particles", "lost", "ring %");
+    clock_gettime(CLOCK_MONOTONIC, &next);
+    for (s = 0; s < seconds && !pru.p1->stop; s++)
+    {
+        for (k = 0; k < BENCH_READS; k++)
+        {
+            PRU_Ring_Read(pru.ring, pru.p1->peak_count, pru.iep, &rd, &q);
+            pru.p1->host_count = rd.seq;
+            next.tv_nsec += 1000000L;
+            while (next.tv_nsec >= 1000000000L)
+            {
+                next.tv_nsec -= 1000000000L;
+                next.tv_sec += 1;
+            }
+            clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &next, NULL);
+        }
+        Peak_Store_Fill(&store, &q, q.head);
+        printf("%6d %10u %10u %8u\n", s + 1, store.n, rd.lost - lost_last,
+            (100*rd.high)/PRU_RING_RECS);
+        total += store.n;
+        lost_last = rd.lost;
+        rd.high = 0;
+        Peak_Store_Clear(&store);
+    }
+    PRU_Mem_Close(&pru);
+
+    getrusage(RUSAGE_SELF, &ru);
+    cpu = ru.ru_utime.tv_sec + ru.ru_stime.tv_sec
+        + (ru.ru_utime.tv_usec + ru.ru_stime.tv_usec)/1e6;
+    printf("pipe: %llu particles, %u lost, host CPU %.2f s (%.0f ns/pt)\n",
+        total, rd.lost, cpu, total > 0 ? cpu*1e9/total : 0.);
+}
+
+//******************************************************************************
+//
+//  Legacy_Baseline
+//
+//  Calc_Baseline before 3.9: unpack the 512 points through doubles, then a
+//  second pass for the variance.
+//
+//  Parameters: const volatile unsigned int *bl (baseline buffer)
+//              double *mean, double *std (results)
+//
+//******************************************************************************
+
+void Legacy_Baseline(const volatile unsigned int *bl, double *mean,
+    double *std)
+{
+    static double raw[512];
+    double b = 0., var = 0.;
+    int i;
+
+    for (i=0; i<PRU_BL_WORDS; i++)
+    {
+        raw[2*i] = (double)((bl[i] & 0xFFFF0000) >> 16);
+        raw[2*i+1] = (double)(bl[i] & 0x0000FFFF);
+        b = b + (raw[2*i] + raw[2*i+1]);
+    }
+    b = b/512.0;
+    for (i=0;i<512; i++)
+    {
+        var += (raw[i]-b)*(raw[i]-b);
+    }
+    *mean = b;
+    *std = sqrt(var/511.);
+}
+
+//******************************************************************************
+//
+//  BL_Point
+//
+//  One baseline point: normal noise (the sum of 12 uniforms) about BENCH_BL,
+//  or, tails % of the time, the tail of a peak between 1 and 3 STD above
+//  it, which PRU1 still takes as baseline.
+//
+//  Parameters: unsigned int tails (% of points from peak tails)
+//
+//  Returns: unsigned int (point)
+//
+//******************************************************************************
+
+unsigned int BL_Point(unsigned int tails)
+{
+    double x = -6.;
+    int k;
+
+    if (Bench_Rand() % 100 < tails)
+        return BENCH_BL + (unsigned int)(BENCH_BL_STD*(1. + 2.*(Bench_Rand()
+            & 0xFFFF)/65536.));
+    for (k = 0; k < 12; k++) x += (Bench_Rand() & 0xFFFF)/65536.;
+    return (unsigned int)(BENCH_BL + BENCH_BL_STD*x + 0.5);
+}
+
+//******************************************************************************
+//
+//  Bench_Baseline
+//
+//  For each case PRU1 replaces n points of the buffer between calls, and
+//  the buffer is recorded as the last block, as job BLOCK records it. Each
+//  estimator is timed over the calls and its last estimate shown. The
+//  buffer here is host memory, on the BBB the legacy scan and the histogram
+//  update also read the 256 words of PRU1 DRAM over the interconnect, the
+//  block records only 7.
+//
+//******************************************************************************
+
+void Bench_Baseline(void)
+{
+    static struct BL_Hist h;
+    static unsigned int news[2] = {64, 512}, tails[2] = {0, 20};
+    struct PRU_Mem m;
+    struct PRU_BL_Block *b;
+    unsigned short *pts;
+    unsigned long long sumsq, cumsq = 0;
+    unsigned int c, k, i, pos = 0, x, old, sum, cum = 0;
+    double t0, t[4], bl[4], std[4], rstd;
+
+    if (PRU_Mem_Open(&m, PRU_BACKEND_MEM, NULL) != 0) return;
+    pts = (unsigned short *)m.bl;
+
+    printf("baseline: Calc_Baseline estimators, %d calls, noise STD %.0f\n",
+        BENCH_BL_CALLS, BENCH_BL_STD);
+    printf("%5s %6s %14s %14s %14s %14s\n", "new", "tails", "legacy ns",
+        "PRU sums ns", "median ns", "trimmed ns");
+    for (c = 0; c < 4; c++)
+    {
+        sum = 0;
+        sumsq = 0;
+        for (i = 0; i < PRU_BL_POINTS; i++)
+        {
+            pts[i] = BL_Point(tails[c/2]);
+            sum += pts[i];
+            sumsq += pts[i]*pts[i];
+        }
+        BL_Hist_Init(&h);
+        memset(t, 0, sizeof(t));
+        rstd = 0.;
+        for (k = 0; k < BENCH_BL_CALLS; k++)
+        {
+            for (i = 0; i < news[c % 2]; i++)       // STORE_BL
+            {
+                x = BL_Point(tails[c/2]);
+                old = pts[pos];
+                sum += x - old;
+                sumsq = sumsq - old*old + x*x;
+                pts[pos] = x;
+                pos = (pos + 1) % PRU_BL_POINTS;
+            }
+            cum += sum;                     // the buffer as the last block
+            cumsq += sumsq;
+            b = &m.bl_block[m.p1->bl_block_count % PRU_BL_RECS];
+            b->sum = cum;
+            b->sumsq_lo = (unsigned int)cumsq;
+            b->sumsq_hi = (unsigned int)(cumsq >> 32);
+            m.p1->bl_block_count = m.p1->bl_block_count + 1;
+
+            t0 = Now_ns();
+            Legacy_Baseline(m.bl, &bl[0], &std[0]);
+            t[0] += Now_ns() - t0;
+
+            t0 = Now_ns();
+            PRU_BL_Stats(&m, &bl[1], &std[1]);
+            t[1] += Now_ns() - t0;
+
+            t0 = Now_ns();
+            BL_Hist_Update(&h, m.bl);
+            BL_Hist_Robust(&h, BL_EST_MEDIAN, 0, &bl[2], &std[2]);
+            t[2] += Now_ns() - t0;
+
+            t0 = Now_ns();
+            BL_Hist_Robust(&h, BL_EST_TRIMMED, 10, &bl[3], &std[3]);
+            t[3] += Now_ns() - t0;
+            rstd += std[2];
+        }
+        printf("%5u %5u%% %14.0f %14.0f %14.0f %14.0f\n", news[c % 2],
+            tails[c/2], t[0]/BENCH_BL_CALLS, t[1]/BENCH_BL_CALLS,
+            t[2]/BENCH_BL_CALLS, t[3]/BENCH_BL_CALLS);
+        printf("%12s %14.1f %14.1f %14.1f %14.1f  baseline\n", "", bl[0],
+            bl[1], bl[2], bl[3]);
+        printf("%12s %14.2f %14.2f %14.2f %14.2f  STD\n", "", std[0], std[1],
+            std[2], std[3]);
+        if (fabs(bl[0] - bl[1]) > 1e-6 || fabs(std[0] - std[1]) > 1e-6)
+            printf("baseline: PRU block sums differ from the legacy scan\n");
+        rstd /= BENCH_BL_CALLS;             // MAD STD of clean noise
+        if (tails[c/2] == 0) printf("baseline: robust STD %.2f, noise STD "
+            "%.0f, %s\n", rstd, BENCH_BL_STD,
+            (fabs(rstd - BENCH_BL_STD) < 0.03*BENCH_BL_STD) ? "ok" : "BAD");
+        gSink += (unsigned int)(bl[0] + bl[1] + bl[2] + bl[3]);
+    }
+    PRU_Mem_Close(&m);
+}
+
+//******************************************************************************
+//
+//  Legacy_CalcBins
+//
+//  CalcBins before 3.13: log10 and a divide for every particle.
+//
+//  Parameters: const struct Peak_Store *s (particles of the second)
+//              int nbins (bins from BENCH_LOGMIN to BENCH_LOGMAX)
+//              int *hist (nbins bins)
+//
+//******************************************************************************
+
+void Legacy_CalcBins(const struct Peak_Store *s, int nbins, int *hist)
+{
+    double logdelta, dbin;
+    int i, bin;
+    struct Peak_Chunk *c;
+
+    for(i=0; i<nbins;i++) hist[i]=0;
+    if(s->n == 0) return;
+    logdelta=(BENCH_LOGMAX - BENCH_LOGMIN)/(double)nbins;
+    for (c = s->first; c != NULL; c = c->next)
+    {
+        for (i=0; i<(int)c->n; i++)
+        {
+            dbin = (log10(c->max[i])-BENCH_LOGMIN)/logdelta;
+            bin = (int)dbin;
+            if((dbin>=0) && (bin<nbins)) hist[bin]++;
+        }
+    }
+}
+
+//******************************************************************************
+//
+//  Bench_Bins
+//
+//  Each simulated second the store is filled with BENCH_BIN_RATE particles,
+//  the max spread in log space over the bins and past both ends as the
+//  feeder does, and binned both ways. The views of the master histogram
+//  are then checked against binning at each size.
+//
+//  Parameters: int seconds (simulated seconds)
+//
+//******************************************************************************
+
+void Bench_Bins(int seconds)
+{
+    static const int sizes[BENCH_VIEWS] = {8, 16, 25, 100, 200};
+    static struct Bin_LUT lut, master;
+    static unsigned short max[BENCH_BIN_RATE], w[BENCH_BIN_RATE];
+    static unsigned int cycles[BENCH_BIN_RATE];
+    static unsigned long long t[BENCH_BIN_RATE];
+    static unsigned int hist_m[BIN_LUT_MAX_BINS];
+    struct Peak_Store s;
+    struct Bin_View v;
+    int hist_old[BIN_VIEW_MAX], hist_new[BIN_VIEW_MAX];
+    unsigned int hist_lut[BENCH_NBINS];
+    struct Peak_Chunk *c;
+    double t0, t_build, t_old = 0., t_new = 0., t_view = 0.;
+    unsigned int i, k, j, diff = 0, diff_view = 0;
+
+    if (Peak_Store_Init(&s, BENCH_BIN_RATE, BENCH_BIN_RATE) != 0) return;
+    t0 = Now_ns();
+    Bin_LUT_Build(&lut, BENCH_NBINS, BENCH_LOGMIN, BENCH_LOGMAX);
+    t_build = Now_ns() - t0;
+    Bin_LUT_Build(&master, BIN_MASTER_DEFAULT, BENCH_LOGMIN, BENCH_LOGMAX);
+
+    for (k = 0; k < (unsigned int)seconds; k++)
+    {
+        for (i = 0; i < BENCH_BIN_RATE; i++)
+        {
+            max[i] = (unsigned short)pow(10., 1. + 3.9*(Bench_Rand()
+                & 0xFFFF)/65536.);
+            w[i] = 10;
+        }
+        Peak_Store_Add(&s, max, w, cycles, t, BENCH_BIN_RATE);
+
+        t0 = Now_ns();
+        Legacy_CalcBins(&s, BENCH_NBINS, hist_old);
+        t_old += Now_ns() - t0;
+
+        t0 = Now_ns();
+        for (i = 0; i < BENCH_NBINS; i++) hist_lut[i] = 0;
+        for (c = s.first; c != NULL; c = c->next)
+            Bin_LUT_Count(&lut, c->max, c->n, hist_lut);
+        t_new += Now_ns() - t0;
+
+        for (i = 0; i < BENCH_NBINS; i++)
+            if ((unsigned int)hist_old[i] != hist_lut[i]) diff++;
+
+        memset(hist_m, 0, sizeof(hist_m));
+        for (c = s.first; c != NULL; c = c->next)
+            Bin_LUT_Count(&master, c->max, c->n, hist_m);
+        for (j = 0; j < BENCH_VIEWS; j++)
+        {
+            Bin_View_Set(&v, BIN_MASTER_DEFAULT, sizes[j], NULL, 0);
+            t0 = Now_ns();
+            Bin_View_Fill(&v, hist_m, hist_new);
+            t_view += Now_ns() - t0;
+            Legacy_CalcBins(&s, sizes[j], hist_old);
+            for (i = 0; i < (unsigned int)sizes[j]; i++)
+                if (hist_old[i] != hist_new[i]) diff_view++;
+        }
+        gSink += hist_lut[0];
+        Peak_Store_Clear(&s);
+    }
+
+    printf("bins: CalcBins of %d particles/s, %d bins, %d seconds\n",
+        BENCH_BIN_RATE, BENCH_NBINS, seconds);
+    printf("%16s %12s %12s\n", "", "ns/particle", "us/second");
+    printf("%16s %12.2f %12.1f\n", "log10", t_old/seconds/BENCH_BIN_RATE,
+        t_old/seconds/1e3);
+    printf("%16s %12.2f %12.1f\n", "lookup table", t_new/seconds
+        /BENCH_BIN_RATE, t_new/seconds/1e3);
+    printf("bins: table built in %.0f us, %u bins differ\n", t_build/1e3,
+        diff);
+    printf("bins: %d views of %d master bins in %.1f us/second, %u bins "
+        "differ\n", BENCH_VIEWS, BIN_MASTER_DEFAULT, t_view/seconds/1e3,
+        diff_view);
+}
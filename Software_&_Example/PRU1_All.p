@@ -3,7 +3,9 @@
 // Does the analysis for peak points. Peak >= 5 points and
 // peak < 255 points (This is now adjustable).
 // Also reads the Power Off bit for shutdown.
-// Enables and reads the cycle count to used to calculate a particle dt.
+// Starts the IEP timer and stamps each particle with it. The timer runs
+// free at 200 MHz and is never stopped or cleared, the host takes the time
+// between particles from the stamps.
 // 
 // Name:        Read Register:  Pin used:   Mode:   0 Value 1 Value
 // Bit0         R31.t0          P8.45       6
@@ -19,15 +21,92 @@
 // SPARE        R30.t10         P8.28       6       (PULLED HIGH)     
 // Stop         R31.t11         p8.30       6       STOP     RUN
 //
+// The host model of this program is pops_model.c, keep the two the same.
+//
 // Data: 16 bit number 0xnnnn 
-// Point data: Maximum, width and cycle count since last particle.
+// Point data: Maximum, width and the IEP timer count at the end of the peak.
+//
+//
+// Capture mode: while the raw ring size (0x28) is not 0 every sample read
+// is also written to the raw ring in DDR (the prussdrv extmem), at the
+// sample count times 2 modulo the ring size, and the count is written out.
+// The ring size is a power of 2 and only switched between 0 and one value.
+// Snippets are held off while capture is on.
+//
+// Snippets: every sample read is also written to the current snippet slot,
+// a 128 sample ring. Every Nth peak (0x30, 0 = off) its max, width and stamp
+// go to the slot descriptor, and after Post more samples (0x34, 1 to 127)
+// the slot is kept and the next slot is used. Job KEEP writes the oldest
+// sample of the kept slot to its descriptor and the snippet count (0x38)
+// out. A new snippet waits until the new slot is filled (hold off, r4.t15).
+//
+// Baseline sums: PRU1 adds every baseline point and its square (64 bit,
+// from the MAC in multiply only mode, r28 * r29) to sums kept since START.
+// Nothing is taken back out, so a point costs no loads and no stores of
+// the sums.
+//
+// Baseline blocks: each time the baseline pointer wraps, the buffer holds
+// the 512 points since the last wrap, a block. Job BLOCK writes the sums as
+// they are then to record (block count mod 256) of a ring in PRU0 DRAM and
+// the block count (0x3C) out. The sums of a block are its record less the
+// one before, the host keeps the window from them.
+//
+// Every N peaks, or when the unread part of the point buffer passes a fill
+// level, PRU_EVTOUT_1 is sent so the host can wait for data instead of
+// polling. N = 0 and level = 0 turn the events off.
+//
+// Sample budget: the A/D has a sample every 50 cycles (200 MHz / 4 MHz). A
+// pass from WAIT_NDR1 back to WAIT_NDR1 has to fit in them, or the next
+// sample is missed. An instruction is 1 cycle, LBBO and LBCO 3 and SBBO 2
+// for the first 4 bytes and 1 more for every 4 after. Work that need not be
+// done on the sample it comes from is left to a job (r5.b1), and one job is
+// done in place of storing a baseline point:
+//  KEEP   r5.t8   oldest sample of the kept slot and the snippet count
+//  BLOCK  r5.t9   block record and block count
+//  PUB    r5.t10  point pointer and peak count out, the N peaks event
+//  FILL   r5.t11  the fill level event
+//  PARAM  r5.t12  min/max points, notify N and the fill level
+//  PARAM2 r5.t13  snippet every N and post, raw ring address and size
+// A peak sets PUB, PUB sets FILL and each baseline wrap sets BLOCK, PARAM
+// and PARAM2, so the parameters are read again every 512 baseline points.
+// BL and BLTH are read on every sample. The longest passes, in cycles
+// (pops_model.c counts them the same way):
+//  baseline point, buffer wrap, capture on              40
+//  job KEEP, on the sample the snippet is kept          48
+//  job PARAM2, capture on                               47
+//  peak written, snippet kept                           48
+//  peak written, snippet triggered, hold off ends       50
 //
-// 
 // Memory usage
 //
-// Baseline+Threshold Address @ 0x0000 0400
-// Point Pointer Address @ 0x0000 0404
-// STOP Address @ 0x0000408
+// Parameter block @ 0x0000 0400 (r8), struct PRU1_Params in pops_pru.h
+//  0x00 Baseline, BL+Threshold (host) w0 = BL, w2 = BLTH, one word so
+//                                     they change together
+//  0x04 (unused)
+//  0x08 Point Pointer          (PRU1)
+//  0x0C STOP                   (PRU1)
+//  0x10 Min/Max points         (host)
+//  0x14 Notify every N peaks   (host) 16 bit
+//  0x18 Notify fill level      (host) 16 bit, bytes of unread points
+//  0x1C Host read count        (host) peaks read (or lost) by the host
+//  0x20 Peak count             (PRU1) peaks written since start, the host
+//                                     uses it to find overwritten peaks
+//  0x24 Raw ring address       (host) DDR physical address
+//  0x28 Raw ring size          (host) bytes, 0 = capture off
+//  0x2C Raw sample count       (PRU1) samples captured, never cleared
+//  0x30 Snippet every N peaks  (host) 16 bit, 0 = off
+//  0x34 Snippet post samples   (host) 1 to 127
+//  0x38 Snippet count          (PRU1) snippets kept since start
+//  0x3C Block count            (PRU1) blocks recorded since start
+//
+// Snippet descriptors (16 byte), one for each slot
+//  PRU1 DRAM @ 0x0000 0500 to 0x0000 05FF
+//  0x00 Max/Width, 0x04 IEP stamp, 0x08 address of the oldest sample
+//
+// Snippet slots (2 byte data), 16 slots of 256 bytes (r12)
+//  PRU1 DRAM 4K = 0x1000
+//  Start address: 0x0000 1000
+//  End address: 0x0000 1FFF
 //
 // Rolling Baseline 1K buffer (2 byte data)
 //  PRU1 DRAM 1K = 0x0400
@@ -39,10 +118,20 @@
 //  Start address: 0x0001 0000
 //  End Address: 0x0001 2FF8
 //
-// Rolling Raw Data Buffer (2 byte data)
+// Rolling Raw Data Buffer (2 byte data), r13
 //  RRU0 DRAM 1K = 0x0300
 //  Local Start address: 0x2000
 //  Local End address: 0x23FE
+//
+// Baseline block records (16 byte: sum, sum of squares low, high, unused),
+// the sums since START at the end of each block
+//  PRU0 DRAM 4K = 0x1000, 256 records
+//  Local Start address: 0x3000
+//  Local End address: 0x3FFF
+//
+// Capture Raw Data Ring (2 byte data), DDR extmem
+//  Start address: Raw ring address (r14), offset r22
+//  Size: Raw ring size (r15)
 
 .origin 0                           // Start of program in PRU0 memory.
 .entrypoint START                   // Entrypoint for the debugger.
@@ -52,12 +141,14 @@
 
 #define PRU1_R31_VEC_VALID 32       // Allows notification of program completion
 #define PRU_EVTOUT_1    4           // The event number that is sent - complete
+                                    // and data ready
 #define CONST_PRUCFG C4
 #define SPP     0x34
 #define CFG     0x00026000          // CFG base address for enable/disable count
-#define CTRL    0x24000             // PRU1 Control register local address
+#define IEP_CFG 0x00                // IEP_TMR_GLB_CFG offset, C26 = IEP
+#define IEP_CNT 0x0C                // IEP_TMR_CNT offset
 
-START: 
+START:
     MOV r1, 0x00026034              // Enable the scratch pad with PRU1 priority
     MOV r2, 0x00000003
     SBBO r2, r1, 0, 4
@@ -65,122 +156,246 @@ START:
     MOV r0, 0x00000000              // This is the register shift and must stay 0
     MOV r1, 0x00000000              // Current Baseline value - r1.w0 = BL, r1.w2 = BLTH
     MOV r2, 0x00000000              // Current Peak Value -     r2.w0 = MAX, r2.w2 = WIDTH
-    MOV r3, 0x00000000              // Current Peak Value -     r3 = Cycle Count
-    MOV r4, 0x00000000              // Current Point -          r4.w0 = PT
-    MOV r5, 0x00000000              // Control value -          r5.w0 = type, r5.w2 = STOP
-                                    // r5.t0 = 0 baseline =1 point
+    MOV r3, 0x00000000              // IEP stamp of the peak, written after r2
+    MOV r4, 0x00008080              // Snippet -                r4.w0 = samples to wait,
+                                    // r4.w2 = peaks since the last snippet
+    MOV r5, 0x00000000              // Control value -          r5.t0 = 0 baseline =1 point
+                                    // r5.b1 = jobs, r5.w2 = oldest sample of the kept slot
     MOV r6, 0x00010000              // Point pointer - init
     MOV r7, 0x00000000              // Baseline pointer - init
-    MOV r8, 0x00000400              // Baseline + threshold addr - const
-    MOV r9, 0x00000404              // Baseline addr - const
-    MOV r10, 0x00000408             // Point pointer addr - const
-    MOV r11, 0x0000040C             // STOP address - const
-    MOV r12, 0x00000000             // Start of BL buffer - const
-    MOV r13, 0x000003FE             // End of Baseline buffer - const
-    MOV r14, 0x00010000             // Start of Point buffer - const
-    MOV r15, 0x00012FF8             // End of Point buffer - const
-    MOV r16, 0x00002000             // Start of raw data buffer on PRU0 mem
-    MOV r17, 0x000023FE             // End of raw data buffer on PRU 0 mem
-    MOV r18, 0x00002000             // Raw data pointer
+    MOV r8, 0x00000400              // Parameter block addr - const
+    MOV r9, 0x00FF0005              // default value of max (FF) and min (5)
+    MOV r10, 0x00000000             // r10.w0 = notify every N peaks, r10.w2 = snippet post
+    MOV r11, 0x00000000             // r11.w0 = notify fill level, r11.w2 = snippet every N
+    MOV r12, 0x00001000             // Snippet slot pointer - init
+    MOV r13, 0x00002000             // Raw data pointer, PRU0 mem 0x2000 - 0x23FE
+    MOV r14, 0x00000000             // Raw ring address
+    MOV r15, 0x00000000             // Raw ring size, 0 = capture off
+    MOV r16, 0x00000000             // Baseline sum since START
+    MOV r17, 0x00000000             // Baseline sum of squares, low word
+    MOV r18, 0x00000000             // and high word
     MOV r19, 0x00000000             // Stop value 0x0000 run, 0xFFFF Stop
     MOV r20, 0x00000000             // Take data CMD register .t0 take data, .t1 STOP
     MOV r21, 0x00000000             // Data register for high byte from PRU0
-    MOV r24, 0x00000410             // Address for min and max number of points
-    MOV r25, 0x00FF0005             // default value of max (FF) and min (5)
-    
-ENABLE_CYCT:  
-    MOV r22, CTRL                   // Set to CTRL address
-    LBBO r23, r22, 0, 4             // r23 keeps track of count enable
-    SET r23, 3                      // Enable cycle count
-    SBBO r23, r22, 0, 4             // Send Enable
-    
+    MOV r22, 0x00000000             // Raw ring offset
+    MOV r24, 0x00000000             // Peak count at the last host event
+    MOV r25, 0x00000000             // Peak count, never cleared
+    XOUT 0, r25, 1                  // MAC multiply only mode (r25.b0 = 0)
+    MOV r28, 0x00000000             // Current Point and MAC operand, r28.w2 stays 0
+    MOV r29, 0x00000000             // MAC operand
+
+ENABLE_IEP:                         // Free-running particle clock
+    MOV r23, 0x00000011             // DEFAULT_INC = 1, CNT_ENABLE
+    SBCO r23, C26, IEP_CFG, 4       // Start the IEP timer
+    MOV r23, 0x00000000             // Raw sample count, never cleared
+
+LOAD_PARAMS:                        // The jobs PARAM and PARAM2 read them again
+    LBBO r9, r8, 0x10, 4            // min and max # of points per peak
+    LBBO r10.w0, r8, 0x14, 2        // Notify every N peaks
+    LBBO r11.w0, r8, 0x18, 2        // Notify fill level
+    LBBO r10.w2, r8, 0x34, 2        // Snippet post samples
+    LBBO r11.w2, r8, 0x30, 2        // Snippet every N peaks
+    LBBO r14, r8, 0x24, 8           // Raw ring address and size
+
 LOAD_NOSTOP:
-    SBBO r19, r11, 0, 2             // Load a zero into the STOP location
-    
+    SBBO r19, r8, 0x0C, 2           // Load a zero into the STOP location
+
 SETPEAKPTR:
-    SBBO r6, r10, 0, 4              // Write the pointer address out  
-    
-                                    // START of data loop 
+    SBBO r6, r8, 0x08, 4            // Write the pointer address out
+    SBBO r25, r8, 0x20, 4           // Write the peak count out
+    SBBO r23, r8, 0x2C, 4           // Write the raw sample count out
+    SBBO r19, r8, 0x38, 4           // Load a zero into the snippet count
+    SBBO r19, r8, 0x3C, 4           // Load a zero into the block count
+    JMP READ_BLTH                   // Start the data loop
+
+WRITE_PK:
+    CLR r5.t0                       // end of peak
+    QBGT READ_BLTH, r2.w2, r9.w0    // not enough points
+    QBLT READ_BLTH, r2.w2, r9.w2    // too many points
+    LBCO r3, C26, IEP_CNT, 4        // Read the IEP timer, the peak time
+    SBBO r2, r6, 0, 8               // write out max, width and the IEP stamp
+    ADD r6, r6, 8                   // Increment the pointer
+    ADD r25, r25, 1                 // Count the peak
+    SET r5.t10                      // Job PUB writes the pointer and count out
+    QBNE SNIP_TRIG, r6.b1, 0x30     // Is the PT buffer full? (0x13000)
+    MOV r6.w0, 0                    // Restart buffer at 0x10000
+
+SNIP_TRIG:                          // Snippet of every Nth peak
+    QBNE READ_BLTH, r4.w0, 0        // Snippet waiting or hold off
+    QBEQ READ_BLTH, r11.w2, 0       // No snippets
+    ADD r4.w2, r4.w2, 1             // Peaks since the last snippet
+    QBGT READ_BLTH, r4.w2, r11.w2   // Not yet N peaks
+    MOV r4.w2, 0
+    LSL r21, r12.b1, 4              // Descriptor of the slot, 0x400 + 16*(r12 >> 8)
+    SBBO r2, r8, r21, 8             // Write max, width and the IEP stamp out
+    MOV r4.w0, r10.w2               // Post samples to wait, on into the loop
+
+                                    // START of data loop
 READ_BLTH:                          // Get the latest Baseline + threshold value
-    LBBO r1.w2, r8, 0, 2            // BLTH
-    LBBO r1.w0, r9, 0, 2            // BL
-    LBBO r25, r24, 0, 4              // Get the min and max # of points per peak
+    LBBO r1, r8, 0x00, 4            // BL and BLTH
 
 WAIT_NDR1:                          // Wait for data not ready (LOW)
     QBBS WAIT_NDR1, R31.t8
-    
-WAIT_DR: 
+
+WAIT_DR:
     QBBC WAIT_DR, r31.t8            // Wait for data ready (low -> high)
     QBBC END, R31.t11               // Check STOP
     QBBS OU_FLOW, R31.t9            // Handle OU flow
-    MOV r4.b0, r31.b0               // Read the low byte
+    MOV r28.b0, r31.b0              // Read the low byte
     XOUT 10, r20, 4                 // Tell PRU0 to take data
     XIN 10, r21, 4                  // Read high byte
-    MOV r4.b1, r21.b0               // put in data point 
-    SBBO r4.w0, r18, 0, 2           // Write raw to buffer
-    ADD r18, r18, 2                 // Increment pointer
-    QBLE CHECK_PT, r17, r18         // Is the raw buffer full?
-    MOV r18, r16                    // Restart buffer
-    JMP CHECK_PT                    // Check for point or baseline
-    
-OU_FLOW:    
-    QBBC READ_BLTH, r5.t0           // Last point BL, do nothing and start over
-    MOV r4.w0, MAXV                 // Current value is saturated
-    JMP CHECK_MAX                   // Check the max, don't subtract the baseline
+    MOV r28.b1, r21.b0              // put in data point
+    SBBO r28.w0, r13, 0, 2          // Write raw to buffer
+    ADD r13, r13, 2                 // Increment pointer
+    CLR r13.t10                     // Wrap the pointer at 0x2400 back to 0x2000
+    QBNE CAPTURE, r15, 0            // Capture on, no snippets
 
-CHECK_PT:                           // Determine if >= BL+TH
-    QBGE PEAK_PT, r1.w2, r4.w0
+SNIPPET:                            // Every sample to the snippet slot
+    SBBO r28.w0, r12, 0, 2          // Write raw to the slot
+    ADD r12.b0, r12.b0, 2           // Increment pointer, the slot is a ring
+    QBEQ CHECK_PT, r4.w0, 0         // No snippet waiting
+    SUB r4.w0, r4.w0, 1             // One less sample to wait
+    QBBC SNIP_POST, r4.t15          // Waiting for the post samples
+    QBNE CHECK_PT, r4.b0, 0         // Hold off, the slot is not yet filled
+    MOV r4.w0, 0                    // Slot filled, a snippet can start
 
+CHECK_PT:                           // Determine if >= BL+TH
+    QBGE PEAK_PT, r1.w2, r28.w0
     QBBS WRITE_PK, r5.t0            // Write the last peak out, miss this baseline point
-    
+
 STORE_BL:                           // Store as baseline
-    SBBO r4.w0, r7, 0, 2            // Write BL to buffer
+    QBNE JOBS, r5.b1, 0             // A job to do, miss this baseline point
+    SBBO r28.w0, r7, 0, 2           // Write BL to buffer
+    MOV r29, r28                    // Square it in the MAC
+    ADD r16, r16, r28               // Add it to the sum
+    XIN 0, r26, 4                   // Its square
+    ADD r17, r17, r26               // Add it to the sum of squares
+    ADC r18, r18, 0
     ADD r7, r7, 2                   // Increment pointer
-    QBLE READ_BLTH, r13, r7         // Is the BL buffer full?
-    MOV r7, r12                     // Restart buffer
+    QBBC READ_BLTH, r7.t10          // Go to start of loop
+    CLR r7.t10                      // Restart buffer at 0x000
+    OR r5.b1, r5.b1, 0x32           // Jobs BLOCK, PARAM and PARAM2
     JMP READ_BLTH                   // Go to start of loop
-    
-PEAK_PT: 
-    SUB r4.w0, r4.w0, r1.w0         // Subtract the Baseline
+
+PEAK_PT:
+    SUB r28.w0, r28.w0, r1.w0       // Subtract the Baseline
     QBBS CHECK_MAX, r5.t0           // If the last point was a peak, Check Max
     SET r5.t0                       // It is a peak point
-    MOV r2.w0, r4.w0                // put peak in max
+    MOV r2.w0, r28.w0               // put peak in max
     MOV r2.w2, 1                    // Start width count
     JMP READ_BLTH                   // LOOP Again.
-    
+
 CHECK_MAX:
     ADD r2.w2, r2.w2, 1             // Increment the width count
-    QBGT SET_MAX, r2.w0, r4.w0      // Other values stay the same if the new 
+    QBGT SET_MAX, r2.w0, r28.w0     // Other values stay the same if the new
                                     // is not greater
     JMP READ_BLTH                   // LOOP Again.
-    
+
 SET_MAX:
-    MOV r2.w0, r4.w0                // Move the new peak into max
+    MOV r2.w0, r28.w0               // Move the new peak into max
     JMP READ_BLTH
-    
-WRITE_PK: 
-    CLR r5.t0                       // end of peak
-    QBGT READ_BLTH, r2.w2, r25.w0   // not enough points
-    QBLT READ_BLTH, r2.w2, r25.w2   // too many points
-    LBBO r23, r22, 0, 4             // Get the control register value
-    CLR r23, 3                      // Disable the cycle count
-    SBBO r23, r22, 0, 4             // Send Disable out
-    LBBO r3, r22, 0xc, 4            // Read the cycle count from count register
-    SBBO r2, r6, 0, 8               // write out r2 and r3
-    ADD r6, r6, 8                   // Increment the pointer
-    SBBO r6, r10, 0, 4              // Write the pointer address out 
-    QBLE CLEAR_CYCT, r15, r6        // Is the PT buffer full?
-    MOV r6, r14                     // Restart buffer
-    
-CLEAR_CYCT:
-    SBBO r12, r22, 0xc, 4           // Clear the cycle count
-    SET r23.t3                      // Enable the cycle count
-    SBBO r23, r22, 0, 4             // Send Enable out
+
+SNIP_POST:
+    QBNE CHECK_PT, r4.w0, 0         // Post samples to wait
+    QBBS SNIP_HOLD, r5.t8           // Last slot kept not yet written out, drop this one
+    MOV r5.w2, r12.w0               // Oldest sample of the slot, for job KEEP
+    SET r5.t8
+    ADD r12.b1, r12.b1, 1           // Next slot, the new samples go on from r12.b0
+    QBNE SNIP_HOLD, r12.b1, 0x20    // Past the last slot?
+    MOV r12.b1, 0x10                // Restart at the first
+
+SNIP_HOLD:
+    MOV r4.w0, 0x8080               // Hold off for the 128 samples of the slot
+    JMP CHECK_PT
+
+CAPTURE:                            // Capture mode, every sample to DDR
+    SBBO r28.w0, r14, r22, 2        // Write raw to the DDR ring
+    ADD r22, r22, 2                 // Increment offset
+    ADD r23, r23, 1                 // Count the sample
+    SBBO r23, r8, 0x2C, 4           // Write the raw sample count out
+    QBLT CHECK_PT, r15, r22         // Is the DDR ring full?
+    MOV r22, 0                      // Restart ring
+    JMP CHECK_PT                    // Check for point or baseline
+
+OU_FLOW:
+    QBBC READ_BLTH, r5.t0           // Last point BL, do nothing and start over
+    MOV r28.w0, MAXV                // Current value is saturated
+    JMP CHECK_MAX                   // Check the max, don't subtract the baseline
+
+JOBS:                               // One job in place of the baseline point
+    QBBS KEEP, r5.t8
+    QBBS BLOCK, r5.t9
+    QBBS PUB, r5.t10
+    QBBS FILL, r5.t11
+    QBBS PARAM, r5.t12
+
+PARAM2:                             // Snippet and capture parameters
+    CLR r5.t13
+    LBBO r10.w2, r8, 0x34, 2        // Snippet post samples
+    LBBO r11.w2, r8, 0x30, 2        // Snippet every N peaks
+    LBBO r14, r8, 0x24, 8           // Raw ring address and size
+    QBEQ READ_BLTH, r15, 0          // Capture off
+    MOV r4.w0, 0x8080               // Hold off snippets, and fill the slot after
+    JMP READ_BLTH
+
+KEEP:                               // The kept slot to its descriptor
+    CLR r5.t8
+    LSL r21, r5.b3, 4               // Descriptor of the slot, 0x400 + 16*(r5.w2 >> 8)
+    ADD r21, r21, 8                 // Its oldest sample word
+    MOV r19, r5.w2
+    SBBO r19, r8, r21, 4            // Write the oldest sample address out
+    LBBO r19, r8, 0x38, 4           // Snippet count
+    ADD r19, r19, 1                 // Count the snippet
+    SBBO r19, r8, 0x38, 4           // Write the snippet count out
+    JMP READ_BLTH
+
+BLOCK:                              // The buffer is a new block
+    CLR r5.t9
+    LBBO r19, r8, 0x3C, 4           // Block count
+    LSL r21, r19.b0, 4              // Its record, 0x3000 + 16*(count mod 256)
+    ADD r21.b1, r21.b1, 0x30
+    SBBO r16, r21, 0, 12            // Record the sums
+    ADD r19, r19, 1                 // Count the block
+    SBBO r19, r8, 0x3C, 4           // Write the block count out
+    JMP READ_BLTH
+
+PUB:                                // Peaks written since the last PUB
+    CLR r5.t10
+    SBBO r6, r8, 0x08, 4            // Write the pointer address out
+    SBBO r25, r8, 0x20, 4           // Write the peak count out
+    SUB r19, r25, r24               // Peaks since the last event
+    QBEQ PUB_FILL, r10.w0, 0        // No notify on count
+    QBLE SEND_EVT, r19, r10.w0      // N peaks written
+
+PUB_FILL:
+    SET r5.t11                      // Job FILL checks the fill level
+    JMP READ_BLTH
+
+FILL:                               // Tell the host when there is data
+    CLR r5.t11
+    QBEQ READ_BLTH, r11.w0, 0       // No notify on fill level
+    LBBO r19, r8, 0x1C, 4           // Host read count
+    SUB r19, r25, r19               // Peaks not yet read by the host
+    LSL r19, r19, 3                 // Bytes of them
+    QBLT READ_BLTH, r11.w0, r19     // Below the fill level
+
+SEND_EVT:
+    MOV r24, r25                    // Peak count at the event
+    MOV R31.b0, PRU1_R31_VEC_VALID | PRU_EVTOUT_1   // Notify data ready
     JMP READ_BLTH                   // LOOP Again.
-    
+
+PARAM:                              // Peak and notify parameters
+    CLR r5.t12
+    LBBO r9, r8, 0x10, 4            // min and max # of points per peak
+    LBBO r10.w0, r8, 0x14, 2        // Notify every N peaks
+    LBBO r11.w0, r8, 0x18, 2        // Notify fill level
+    JMP READ_BLTH
+
 END:
+    SBBO r6, r8, 0x08, 4            // Write the pointer address out
+    SBBO r25, r8, 0x20, 4           // and the peak count, PUB may be waiting
     MOV r19, MAXV                   // 0xFFFF
-    SBBO r19, r11, 0, 2             // Stop program
+    SBBO r19, r8, 0x0C, 2           // Stop program
     SET r20.t1                      //
     XOUT 14, r20, 4                 // Tell PRU0 to stop
 	MOV	R31.b0, PRU1_R31_VEC_VALID | PRU_EVTOUT_1   // Notify Halt
@@ -0,0 +1,302 @@
+/*
+// Filename: PRU1_Model.c
+// Version: 1.0
+//
+// Project: NOAA - POPS
+//
+// Description - Runs a sample stream through the host model of PRU1_All.p
+// (pops_model.c) as fast as it can, and reads the point buffer back the way
+// POPS_BBB.c does. Used to check firmware changes against recorded data and
+// to size the throughput before flying.
+//
+// Usage: pru1model <file|synth:rate> [seconds] [out.csv] [snip.b]
+//   file        16 bit little endian A/D samples at 4 MHz (a raw capture)
+//   synth:rate  synthetic particles at rate/s, Poisson, with noise
+//   seconds     stream seconds for synth (default 10), file is read to the end
+//   out.csv     optional, every point record as max,width,cycles ("-" none)
+//   snip.b      optional, snippet file of every MODEL_SNIP_EVERY'th peak
+//
+// The baseline is set as Calc_Baseline does: from the baseline buffer, once
+// at the start and then every stream second, with TH_Mult = 3.
+// At the end the longest pass of the loop, in PRU cycles, is printed with
+// the samples missed to passes over the budget (PRU1_CYCLES_SAMPLE).
+//
+// See SOFTWARE DISCLAIMER.md.
+*/
+
+//******************************************************************************
+//
+// Include files:
+//
+//******************************************************************************
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <time.h>
+#include "pops_pru.h"
+#include "pops_model.h"
+#include "pops_snip.h"
+
+//******************************************************************************
+//
+// Definitions
+//
+//******************************************************************************
+
+#define MODEL_BLOCK 4000                    // samples per host read (1 ms)
+#define MODEL_RATE 4000000                  // A/D samples per second
+#define MODEL_TH_MULT 3.                    // threshold, times the BL STD
+#define MODEL_SNIP_EVERY 16                 // snippet every N peaks
+
+//******************************************************************************
+//
+// Function prototypes:
+//
+//******************************************************************************
+
+double Now_ns(void);
+double Synth_Uniform(void);
+unsigned int Synth_Block(unsigned int *in, unsigned int n, double rate);
+void Model_Baseline(struct PRU_Mem *m);
+void Model_Drain(FILE *fpo);
+
+//******************************************************************************
+//
+// Global variables:
+//
+//******************************************************************************
+
+struct PRU_Mem gPRU;                        // model memory
+struct PRU1_Model gModel;                   // PRU1 registers
+struct PRU_Ring gRing;                      // host read state
+struct PRU_BL_Win gBL_Win;                  // baseline window, off
+struct Peak_Queue gQueue;                   // peaks read back
+struct Snip_Queue gSnip;                    // snippets read back
+unsigned int gIn[MODEL_BLOCK];              // sample block
+unsigned int gSeed = 13579;                 // synthetic data seed
+double gNext = 0.;                          // samples to the next particle
+unsigned long long gPeaks = 0;              // peaks read back
+
+//******************************************************************************
+//
+// Main program:
+//
+//******************************************************************************
+
+int main(int argc, char *argv[])
+{
+    FILE *fpi = NULL, *fpo = NULL, *fps = NULL;
+    unsigned short raw[MODEL_BLOCK];
+    unsigned long long samples = 0, total;
+    unsigned int i, n, snips;
+    double rate = 0., t0, t_model = 0.;
+    int seconds = 10;
+
+    if (argc < 2)
+    {
+        printf("Usage: pru1model <file|synth:rate> [seconds] [out.csv] "
+            "[snip.b]\n");
+        return 1;
+    }
+    if (!strncmp(argv[1], "synth:", 6)) rate = atof(argv[1] + 6);
+    else if ((fpi = fopen(argv[1], "rb")) == NULL)
+    {
+        printf("pru1model: could not open %s\n", argv[1]);
+        return 1;
+    }
+    if (argc > 2) seconds = atoi(argv[2]);
+    if (argc > 3 && strcmp(argv[3], "-")
+        && (fpo = fopen(argv[3], "w")) == NULL)
+    {
+        printf("pru1model: could not open %s\n", argv[3]);
+        return 1;
+    }
+    if (argc > 4 && (fps = fopen(argv[4], "wb")) == NULL)
+    {
+        printf("pru1model: could not open %s\n", argv[4]);
+        return 1;
+    }
+
+    if (PRU_Mem_Open(&gPRU, PRU_BACKEND_MEM, NULL) != 0) return 1;
+    gPRU.p1->peak_pts = (255 << 16) | 5;    // default Min/MaxPeakPts
+    gPRU.p1->notify_peaks = 64;
+    gPRU.p1->notify_fill = 2*PRU_RING_WORDS;
+    gPRU.p1->host_count = 0;
+    gPRU.p1->bl_blth = 0xFFFF << 16;        // all baseline until it is set
+    if (fps != NULL) gPRU.p1->snip_every = MODEL_SNIP_EVERY;
+    gPRU.p1->snip_post = SNIP_POST;
+    PRU1_Model_Init(&gModel, &gPRU);
+    total = (unsigned long long)seconds*MODEL_RATE;
+
+    for (;;)
+    {
+        if (fpi != NULL)
+        {
+            n = fread(raw, sizeof(unsigned short), MODEL_BLOCK, fpi);
+            for (i = 0; i < n; i++) gIn[i] = raw[i];
+        }
+        else
+        {
+            if (samples >= total) break;
+            n = Synth_Block(gIn, MODEL_BLOCK, rate);
+        }
+        if (n == 0) break;
+
+        t0 = Now_ns();
+        n = PRU1_Model_Run(&gModel, &gPRU, gIn, n);
+        t_model += Now_ns() - t0;
+
+        samples += n;
+        snips = gPRU.p1->snip_count;        // before the IEP count
+        PRU_Ring_Read(gPRU.ring, gPRU.p1->peak_count, gPRU.iep, &gRing,
+            &gQueue);
+        gPRU.p1->host_count = gRing.seq;
+        Model_Drain(fpo);
+        if (fps != NULL)
+        {
+            Snip_Read(&gSnip, &gPRU, snips, &gRing);
+            Snip_File_Write(fps, &gSnip, "model");
+        }
+        if (samples == MODEL_BLOCK || samples % MODEL_RATE == 0)
+            Model_Baseline(&gPRU);
+        if (gModel.halted) break;
+    }
+
+    printf("pru1model: %llu samples (%.2f s), %llu peaks, %u lost, %u events\n",
+        samples, (double)samples/MODEL_RATE, gPeaks, gRing.lost,
+        gModel.events);
+    if (fps != NULL) printf("pru1model: %u snippets, %u lost\n",
+        gSnip.seq - gSnip.lost, gSnip.lost);
+    printf("pru1model: longest pass %u cycles of %u, %u samples missed\n",
+        gModel.cycles_max, gModel.cycles_sample, gModel.missed);
+    printf("pru1model: BL %u, BLTH %u, %.1f Msamples/s, %.0fx real time\n",
+        gPRU.p1->bl_blth & 0xFFFF, gPRU.p1->bl_blth >> 16,
+        samples*1e3/t_model, samples*1e9/MODEL_RATE/t_model);
+
+    if (fpi != NULL) fclose(fpi);
+    if (fpo != NULL) fclose(fpo);
+    if (fps != NULL) fclose(fps);
+    PRU_Mem_Close(&gPRU);
+    return 0;
+}
+
+//******************************************************************************
+//
+//  Now_ns
+//
+//  Monotonic time in ns.
+//
+//******************************************************************************
+
+double Now_ns(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double)ts.tv_sec*1e9 + (double)ts.tv_nsec;
+}
+
+//******************************************************************************
+//
+//  Synth_Uniform
+//
+//  Small LCG, [0, 1), so a run can be repeated.
+//
+//******************************************************************************
+
+double Synth_Uniform(void)
+{
+    gSeed = gSeed*1103515245u + 12345u;
+    return ((gSeed >> 8) & 0x00FFFFFF)/16777216.;
+}
+
+//******************************************************************************
+//
+//  Synth_Block
+//
+//  Baseline of 1500 with noise, and Gaussian particles arriving at random.
+//  A sum over 65535 sets the OU flag, as the A/D does.
+//
+//  Parameters: unsigned int *in (samples out)
+//              unsigned int n (samples)
+//              double rate (particles/s)
+//
+//  Returns: unsigned int (n)
+//
+//******************************************************************************
+
+unsigned int Synth_Block(unsigned int *in, unsigned int n, double rate)
+{
+    static double amp = 0., sigma = 1., centre = -100.;
+    unsigned int i;
+    double x, v;
+
+    for (i = 0; i < n; i++)
+    {
+        if (gNext <= 0.)                    // start the next particle
+        {
+            amp = pow(10., 1.7 + 3.1*Synth_Uniform());
+            sigma = 1.5 + 6.*Synth_Uniform();
+            centre = 4.*sigma;
+            gNext = 8.*sigma - log(1. - Synth_Uniform())*MODEL_RATE/rate;
+        }
+        gNext -= 1.;
+        centre -= 1.;
+        x = centre/sigma;
+        v = 1500. + 20.*Synth_Uniform();
+        if (x > -5. && x < 5.) v += amp*exp(-0.5*x*x);
+        in[i] = (v > 65535.) ? PRU1_IN_OU : (unsigned int)v;
+    }
+    return n;
+}
+
+//******************************************************************************
+//
+//  Model_Baseline
+//
+//  Calc_Baseline: mean and STD of the baseline window (the last block of
+//  512 baseline samples unless gBL_Win.blocks is set) from the PRU1 block
+//  records, BL and BL + TH_Mult*STD written to the parameter block.
+//
+//  Parameters: struct PRU_Mem *m
+//
+//******************************************************************************
+
+void Model_Baseline(struct PRU_Mem *m)
+{
+    double bl, std, blth;
+    unsigned int n;
+
+    PRU_BL_Window(m, &gBL_Win, &bl, &std, &n);
+    blth = bl + MODEL_TH_MULT*std;
+    if (blth > 65535.) blth = 65535.;
+    m->p1->bl_blth = ((unsigned int)blth << 16) | (unsigned int)bl;
+}
+
+//******************************************************************************
+//
+//  Model_Drain
+//
+//  Empty the queue, writing each record if there is an output file.
+//
+//  Parameters: FILE *fpo (CSV output or NULL)
+//
+//******************************************************************************
+
+void Model_Drain(FILE *fpo)
+{
+    static unsigned short max[1024], w[1024];
+    static unsigned int cycles[1024];
+    static unsigned long long t[1024];
+    unsigned int i, n;
+
+    while ((n = Peak_Queue_Get(&gQueue, max, w, cycles, t, 1024)) > 0)
+    {
+        gPeaks += n;
+        if (fpo == NULL) continue;
+        for (i = 0; i < n; i++) fprintf(fpo, "%u,%u,%u\n", max[i], w[i],
+            cycles[i]);
+    }
+}
@@ -0,0 +1,369 @@
+/*
+// Filename: PRU_Feed.c
+// Version: 1.0
+//
+// Project: NOAA - POPS
+//
+// Description - Feeder for the PRU emulator. Writes the PRU memory file the
+// way PRU1_All.p and PRU0_ParData.p write the PRU memory: peaks into the
+// point buffer with the peak count and pointer, baseline samples into the
+// baseline buffer, raw samples into the PRU0 buffer, and PRU_EVTOUT_1 by the
+// notify_peaks / notify_fill rules. The IEP timer count is kept in the
+// control block, and the peaks are stamped from it. Particles arrive at random (Poisson) at
+// a set rate. In capture mode every sample of the tick, baseline noise with
+// the tick's particles, goes to the DDR raw ring. Every snip_every'th peak
+// is written to a snippet slot. So the host side (POPS_BBB.c with Setting.PRU backend =
+// "emulator", or popsbench pipe) can be load tested on any Linux box.
+//
+// Usage: popsfeed [file] [particles/s] [seconds]
+//        (default /dev/shm/pops_pru, 10000/s, 0 = until the host stops)
+// At the end the PRU1 stop flag is set, as the STOP input does.
+//
+// See SOFTWARE DISCLAIMER.md.
+*/
+
+//******************************************************************************
+//
+// Include files:
+//
+//******************************************************************************
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <time.h>
+#include <unistd.h>
+#include "pops_pru.h"
+#include "pops_model.h"
+
+//******************************************************************************
+//
+// Definitions
+//
+//******************************************************************************
+
+#define FEED_TICK_NS 1000000L               // one write pass every 1 ms
+#define FEED_CYCLES_TICK 200000.            // PRU cycles in a tick (200 MHz)
+#define FEED_BL 1500                        // baseline, raw counts
+#define FEED_BL_NOISE 24                    // baseline noise, peak to peak
+#define FEED_SAMPLES_TICK 4000              // A/D samples in a tick (4 MHz)
+#define FEED_TICK_PEAKS 4000                // most particles kept for a tick
+
+//******************************************************************************
+//
+// Function prototypes:
+//
+//******************************************************************************
+
+unsigned int Feed_Rand(void);
+double Feed_Uniform(void);
+void Feed_Peak(unsigned int max, unsigned int w, unsigned int stamp);
+void Feed_Baseline(void);
+void Feed_Raw(void);
+void Feed_Capture(void);
+void Feed_Snippet(unsigned int max, unsigned int w, unsigned int stamp);
+
+//******************************************************************************
+//
+// Global variables:
+//
+//******************************************************************************
+
+struct PRU_Mem gPRU;                        // emulator memory
+unsigned int gSeed = 2468;                  // random seed
+unsigned int gSince = 0;                    // peaks since the last event
+unsigned int gSnip_Since = 0;               // peaks since the last snippet
+unsigned int gBL_Pos = 0;                   // next baseline word
+unsigned int gBL_Sum = 0;                   // baseline sums since start,
+unsigned long long gBL_Sumsq = 0;           // as PRU1 keeps them
+unsigned long long gPeaks = 0;              // peaks written
+
+struct tick_peak {                          // particles of this tick, for the
+    unsigned int end;                       // capture: last sample, max and
+    unsigned int max;                       // width
+    unsigned int w;
+} gTick[FEED_TICK_PEAKS];
+unsigned int gTick_N;                       // particles in gTick
+
+//******************************************************************************
+//
+// Main program:
+//
+//******************************************************************************
+
+int main(int argc, char *argv[])
+{
+    const char *path = PRU_EMU_PATH;
+    double rate = 10000., gap, t;
+    int seconds = 0;
+    long ticks = 0;
+    unsigned int max, w, iep;
+    struct timespec next;
+
+    if (argc > 1) path = argv[1];
+    if (argc > 2) rate = atof(argv[2]);
+    if (argc > 3) seconds = atoi(argv[3]);
+    if (rate < 1.) rate = 1.;
+
+    if (PRU_Mem_Open(&gPRU, PRU_BACKEND_EMU, path) != 0)
+    {
+        printf("popsfeed: could not open %s\n", path);
+        return 1;
+    }
+    printf("popsfeed: %s, %.0f particles/s, waiting for the host\n", path,
+        rate);
+    while (!gPRU.emu->run) usleep(1000);
+    gPRU.p1->bl_block_count = 0;            // SETPEAKPTR, no blocks yet
+
+    gap = -log(1. - Feed_Uniform())*200e6/rate;  // cycles to the first peak
+    clock_gettime(CLOCK_MONOTONIC, &next);
+    while (gPRU.emu->run)
+    {
+        // the IEP count at the end of the tick, never older than a stamp
+        iep = (unsigned int)(ticks*(long long)FEED_CYCLES_TICK);
+        gPRU.emu->iep = iep + (unsigned int)FEED_CYCLES_TICK;
+
+        // the peaks that fall in this tick, t in cycles from its start
+        gTick_N = 0;
+        for (t = gap; t < FEED_CYCLES_TICK; )
+        {
+            max = (unsigned int)pow(10., 1.7 + 3.1*Feed_Uniform());
+            if (max > 65535 - FEED_BL) max = 65535 - FEED_BL;
+            w = 5 + Feed_Rand() % 40;
+            Feed_Peak(max, w, iep + (unsigned int)t);
+            if (gTick_N < FEED_TICK_PEAKS)
+            {
+                gTick[gTick_N].end = (unsigned int)(t*FEED_SAMPLES_TICK
+                    /FEED_CYCLES_TICK);
+                gTick[gTick_N].max = max;
+                gTick[gTick_N].w = w;
+                gTick_N++;
+            }
+            gap = -log(1. - Feed_Uniform())*200e6/rate;
+            if (gap < 16.*w) gap = 16.*w;   // peaks can not overlap
+            t += gap;
+        }
+        gap = t - FEED_CYCLES_TICK;
+        Feed_Baseline();
+        if ((ticks & 255) == 0) Feed_Raw();
+        Feed_Capture();
+
+        ticks++;
+        if (seconds > 0 && ticks >= seconds*1000L)
+        {
+            gPRU.p1->stop = 1;              // as the PRU1 STOP input
+            break;
+        }
+        next.tv_nsec += FEED_TICK_NS;
+        while (next.tv_nsec >= 1000000000L)
+        {
+            next.tv_nsec -= 1000000000L;
+            next.tv_sec += 1;
+        }
+        clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &next, NULL);
+    }
+
+    printf("popsfeed: %llu peaks in %.1f s\n", gPeaks, ticks/1000.);
+    return 0;
+}
+
+//******************************************************************************
+//
+//  Feed_Rand, Feed_Uniform
+//
+//  Small LCG, so a run can be repeated. Feed_Uniform is in [0, 1).
+//
+//******************************************************************************
+
+unsigned int Feed_Rand(void)
+{
+    gSeed = gSeed*1103515245u + 12345u;
+    return gSeed >> 8;
+}
+
+double Feed_Uniform(void)
+{
+    return (Feed_Rand() & 0x00FFFFFF)/16777216.;
+}
+
+//******************************************************************************
+//
+//  Feed_Peak
+//
+//  Write one peak as WRITE_PK does: the record, the pointer (wrapped at the
+//  end of the buffer), the peak count, then the event if notify_peaks peaks
+//  have been written or the unread part passes notify_fill bytes.
+//
+//  Parameters: unsigned int max, w (peak maximum and width)
+//              unsigned int stamp (IEP count at the end of the peak)
+//
+//******************************************************************************
+
+void Feed_Peak(unsigned int max, unsigned int w, unsigned int stamp)
+{
+    struct PRU1_Params *p1 = gPRU.p1;
+    unsigned int ptr, i, fill;
+
+    ptr = p1->point_ptr;
+    i = PRU_Ring_Index(ptr);
+    gPRU.ring[i] = (w << 16) | max;
+    gPRU.ring[i + 1] = stamp;
+    ptr = PRU_RING_BASE + 4*((i + PRU_RING_REC_WORDS) % PRU_RING_WORDS);
+    __sync_synchronize();                   // record before the count
+    p1->point_ptr = ptr;
+    p1->peak_count = p1->peak_count + 1;
+    gPeaks++;
+
+    if (p1->snip_every > 0 && ++gSnip_Since >= p1->snip_every)
+    {
+        gSnip_Since = 0;
+        Feed_Snippet(max, w, stamp);
+    }
+
+    gSince++;
+    fill = 8*(p1->peak_count - p1->host_count);
+    if ((p1->notify_peaks > 0 && gSince >= p1->notify_peaks)
+        || (p1->notify_fill > 0 && fill >= p1->notify_fill))
+    {
+        gSince = 0;
+        PRU_Mem_Event(&gPRU);
+    }
+}
+
+//******************************************************************************
+//
+//  Feed_Baseline
+//
+//  PRU1 writes every sample below BLTH to the baseline buffer. A quarter of
+//  the buffer is written each tick, two 16 bit samples a word. Each time
+//  the buffer is refilled it is a block, its sums are added to those since
+//  start and recorded, as STORE_BL and job BLOCK do.
+//
+//******************************************************************************
+
+void Feed_Baseline(void)
+{
+    unsigned int i, lo, hi;
+
+    for (i = 0; i < PRU_BL_WORDS/4; i++)
+    {
+        lo = FEED_BL + Feed_Rand() % FEED_BL_NOISE - FEED_BL_NOISE/2;
+        hi = FEED_BL + Feed_Rand() % FEED_BL_NOISE - FEED_BL_NOISE/2;
+        gPRU.bl[gBL_Pos] = (hi << 16) | lo;
+        gBL_Pos = (gBL_Pos + 1) % PRU_BL_WORDS;
+    }
+    if (gBL_Pos != 0) return;
+    for (i = 0; i < PRU_BL_WORDS; i++)
+    {
+        lo = gPRU.bl[i] & 0xFFFF;
+        hi = gPRU.bl[i] >> 16;
+        gBL_Sum += lo + hi;
+        gBL_Sumsq += lo*lo + (unsigned long long)hi*hi;
+    }
+    PRU1_Model_Block(&gPRU, gBL_Sum, gBL_Sumsq);
+}
+
+//******************************************************************************
+//
+//  Feed_Raw
+//
+//  Fill the PRU0 raw buffer with baseline and one particle.
+//
+//******************************************************************************
+
+void Feed_Raw(void)
+{
+    unsigned int i, s[2], k;
+    double x;
+
+    for (i = 0; i < PRU_RAW_WORDS; i++)
+    {
+        for (k = 0; k < 2; k++)
+        {
+            x = (2.*i + k - 256.)/6.;       // particle in the middle
+            s[k] = FEED_BL + Feed_Rand() % FEED_BL_NOISE
+                + (unsigned int)(4000.*exp(-x*x));
+        }
+        gPRU.raw[i] = (s[1] << 16) | s[0];
+    }
+}
+
+//******************************************************************************
+//
+//  Feed_Capture
+//
+//  In capture mode write the tick's samples to the DDR raw ring as the
+//  PRU1 CAPTURE code does, at the sample count modulo the ring size, then
+//  the count. Each particle is a triangle of its width ending at its stamp.
+//
+//******************************************************************************
+
+void Feed_Capture(void)
+{
+    static unsigned short s[FEED_SAMPLES_TICK];
+    struct PRU1_Params *p1 = gPRU.p1;
+    unsigned int i, k, j, base, mask, count, half;
+
+    if (p1->raw_bytes == 0 || gPRU.ddr == NULL) return;
+
+    for (i = 0; i < FEED_SAMPLES_TICK; i++)
+        s[i] = FEED_BL + Feed_Rand() % FEED_BL_NOISE - FEED_BL_NOISE/2;
+    for (k = 0; k < gTick_N; k++)
+    {
+        half = (gTick[k].w + 1)/2;
+        for (j = 0; j < gTick[k].w && j <= gTick[k].end; j++)
+        {
+            i = gTick[k].end - j;
+            s[i] += gTick[k].max*(half - abs((int)j - (int)half))/half;
+        }
+    }
+
+    base = (p1->raw_ddr - gPRU.ddr_phys)/2;
+    mask = p1->raw_bytes/2 - 1;
+    count = p1->raw_count;
+    for (i = 0; i < FEED_SAMPLES_TICK; i++)
+        gPRU.ddr[base + ((count + i) & mask)] = s[i];
+    __sync_synchronize();                   // samples before the count
+    p1->raw_count = count + FEED_SAMPLES_TICK;
+}
+
+//******************************************************************************
+//
+//  Feed_Snippet
+//
+//  Keep a snippet of the peak as SNIP_TRIG and SNIP_POST do: the descriptor,
+//  the slot of baseline noise with a triangle of the peak's width ending
+//  snip_post samples before the end, then the snippet count. The slot is
+//  written from its start, so the oldest sample is the first.
+//
+//  Parameters: unsigned int max, w (peak maximum and width)
+//              unsigned int stamp (IEP count at the end of the peak)
+//
+//******************************************************************************
+
+void Feed_Snippet(unsigned int max, unsigned int w, unsigned int stamp)
+{
+    struct PRU1_Params *p1 = gPRU.p1;
+    struct PRU_Snip_Desc *d;
+    volatile unsigned short *slot;
+    unsigned int k, i, j, end, half;
+
+    k = p1->snip_count % PRU_SNIP_SLOTS;
+    d = &gPRU.snip_desc[k];
+    slot = gPRU.snip + k*PRU_SNIP_SAMPLES;
+    end = PRU_SNIP_SAMPLES - 1 - (p1->snip_post % PRU_SNIP_SAMPLES);
+    half = (w + 1)/2;
+    for (i = 0; i < PRU_SNIP_SAMPLES; i++)
+    {
+        slot[i] = FEED_BL + Feed_Rand() % FEED_BL_NOISE - FEED_BL_NOISE/2;
+        j = end - i;                        // samples before the end
+        if (i < end && j <= w)
+            slot[i] += max*(half - abs((int)j - (int)half))/half;
+    }
+    d->peak = (w << 16) | max;
+    d->stamp = stamp;
+    d->oldest = PRU_SNIP_BASE + k*PRU_SNIP_SLOT_BYTES;
+    __sync_synchronize();                   // snippet before the count
+    p1->snip_count = p1->snip_count + 1;
+}
@@ -9,12 +9,20 @@
 //
 // Read either "old" data with timestamp, peak, position, width, and saturated
 // flag, for read the "new" version with timestamp, peak, width, dt.
+// Version 2 files (POPS_BBB 3.4, see pops_file.h) are found from the file
+// header and read with the raw cycle count as well.
+// Version 3 files (POPS_BBB 3.22) are read whole and scanned for seconds
+// whose length and CRC check, so the seconds after a torn or damaged one are
+// still read. A v3 file whose header is damaged can be read as type "v3".
 //
 // Filename and "old" or "new" is specified at run time.
 // The output filename is the input name with the .b replaced with .txt. It is
 // a comma separated variable file.  There is no provision for concatenating 
 // data.
 //
+// Each second is read in blocks of READ_BLOCK particles, so there is no limit
+// on the particles in one second.
+//
 /*DISCLAIMER
 ----------------------------------------------
 The United States Government makes no warranty, expressed or implied, as to the 
@@ -75,6 +83,14 @@ not subject to copyright protection.*/
 #include <unistd.h>
 #include <float.h>
 #include <errno.h>
+#include "pops_file.h"
+
+//******************************************************************************
+//
+// Definitions
+//
+//******************************************************************************
+#define READ_BLOCK 4096                     // particles read at a time
 
 //******************************************************************************
 //
@@ -83,6 +99,9 @@ not subject to copyright protection.*/
 //******************************************************************************
 void Read_New( void );
 void Read_Old( void );
+void Read_V2( void );
+void Read_V3( void );
+int Is_V2( void );
 //******************************************************************************
 //
 // Global variables:
@@ -94,14 +113,10 @@ char gType[4];                              // input type, old or new
 
 double gFullSec;                            // Timestamp with partial sec
 
-struct Peaks {                              // structure for peak data
-    unsigned int max;
-    unsigned int w;
-    unsigned int dt;
-};
 struct gData {
-    struct Peaks peak[30000];
+    struct Peaks peak[READ_BLOCK];          // struct Peaks in pops_file.h
 } gData;                                    // global data structure
+struct Peak_Rec gRec[READ_BLOCK];           // version 2 records
 
 struct PeakO {                              // structure for peak data (old)
     unsigned int max;
@@ -110,7 +125,7 @@ struct PeakO {                              // structure for peak data (old)
     unsigned int is;
 };
 struct gDataO {
-    struct PeakO peako[30000];
+    struct PeakO peako[READ_BLOCK];
 } gDataO;                                   // global data structure (old)
 unsigned int gArray_Size = 0;               // Size of the data array
 
@@ -123,11 +138,18 @@ unsigned int gArray_Size = 0;               // Size of the data array
 void main()
 {
     size_t len;
+    int ver;
 
     printf("Enter the file to read with full path:\n");
     scanf("%s", gFN);
-    printf("Enter the file type, new or old:\n");
-    scanf("%s", gType);
+    ver = Is_V2();                          // the file says what it is
+    if (ver >= 3) strcpy(gType, "v3");
+    else if (ver == 2) strcpy(gType, "v2");
+    else
+    {
+        printf("Enter the file type, new, old or v3 (damaged header):\n");
+        scanf("%s", gType);
+    }
 
 // Make the output file name    
     len = strlen(gFN);
@@ -143,6 +165,16 @@ void main()
     {
         Read_Old();
     }
+
+    if(strcmp(gType, "v2") == 0)
+    {
+        Read_V2();
+    }
+
+    if(strcmp(gType, "v3") == 0)
+    {
+        Read_V3();
+    }
 // end of main program    
     
 }
@@ -157,7 +189,7 @@ void main()
 void Read_New( void)
 {
     FILE *fp, *fpo;
-    unsigned int i;
+    unsigned int i, n, left;
     int timeoi;
     char dataline[512] = {""};
     char str[512] = {""};
@@ -181,31 +213,35 @@ void Read_New( void)
     fprintf(fpo,"%s",&str1);                // write to file
 
 //Read 1 sec of data, and write it out one line at a time
-    while(!feof(fp))
+    while(fread(&gArray_Size, size_array, 1, fp) == 1)
     {
-        fread(&gArray_Size, size_array, 1, fp);
-        fread(&gFullSec, size_time,1,fp);
-        gdatasize = (gArray_Size)*(3*sizeof(unsigned int));
-        fread(&gData, gdatasize, 1, fp);
+        if (fread(&gFullSec, size_time,1,fp) != 1) break;
         //Format and write 1 sec of data
  //       timeo = gFullSec + 2082844800;      // convert to windows time
         timeo = fmod(gFullSec, day);        // seconds since midnight at start
-        for(i=0; i < gArray_Size; i++)
+        for (left = gArray_Size; left > 0; left -= n)
         {
-            // convert to exact windows time
-            timeo += ((double)gData.peak[i].dt)/1000000.;  // add dT
-            sprintf(str,"%.6f",timeo);
-            strcpy(dataline, str);
-            sprintf(str, ",%u", gData.peak[i].max);
-            strcat(dataline, str);
-            sprintf(str, ",%u", gData.peak[i].w);
-            strcat(dataline, str);
-            sprintf(str, ",%u", gData.peak[i].dt);
-            strcat(dataline, str);
-            sprintf(str,"\r\n");            // add cr lf
-            strcat(dataline, str);
+            n = (left > READ_BLOCK) ? READ_BLOCK : left;
+            gdatasize = sizeof(struct Peaks);
+            n = fread(&gData, gdatasize, n, fp);
+            if (n == 0) break;                  // file ends in this second
+            for(i=0; i < n; i++)
+            {
+                // convert to exact windows time
+                timeo += ((double)gData.peak[i].dt)/1000000.;  // add dT
+                sprintf(str,"%.6f",timeo);
+                strcpy(dataline, str);
+                sprintf(str, ",%u", gData.peak[i].max);
+                strcat(dataline, str);
+                sprintf(str, ",%u", gData.peak[i].w);
+                strcat(dataline, str);
+                sprintf(str, ",%u", gData.peak[i].dt);
+                strcat(dataline, str);
+                sprintf(str,"\r\n");            // add cr lf
+                strcat(dataline, str);
             
-            fprintf(fpo,"%s",&dataline);    // write to file
+                fprintf(fpo,"%s",&dataline);    // write to file
+            }
         }
     }
     
@@ -225,7 +261,7 @@ void Read_New( void)
 void Read_Old( void)
 {
     FILE *fp, *fpo;
-    unsigned int i;
+    unsigned int i, n, left;
     char dataline[512] = {""};
     char str[512] = {""};
     char str1[512] ={""};
@@ -248,30 +284,34 @@ void Read_Old( void)
     fprintf(fpo,"%s",&str1);                // write to file
 
 //Read 1 sec of data, and write it out one line at a time
-    while(!feof(fp))
+    while(fread(&gArray_Size, size_array, 1, fp) == 1)
     {
-        fread(&gArray_Size, size_array, 1, fp);
-        fread(&gFullSec, size_time,1,fp);
-        gdatasize = (gArray_Size)*(4*sizeof(unsigned int));
-        fread(&gDataO, gdatasize, 1, fp);
+        if (fread(&gFullSec, size_time,1,fp) != 1) break;
 //Format and write 1 sec of data
 //        timeo = gFullSec + 2082844800;      // convert to windows time
         timeo = fmod(gFullSec, day);        // seconds since midnight
-        for(i=0; i < gArray_Size; i++)
+        for (left = gArray_Size; left > 0; left -= n)
         {
-            sprintf(str,"%.3f",timeo);
-            strcpy(dataline, str);
-            sprintf(str, ",%u", gDataO.peako[i].max);
-            strcat(dataline, str);
-            sprintf(str, ",%u", gDataO.peako[i].pos);
-            strcat(dataline, str);
-            sprintf(str, ",%u", gDataO.peako[i].w);
-            strcat(dataline, str);
-            sprintf(str, ",%u", gDataO.peako[i].is);
-            strcat(dataline, str);
-            sprintf(str,"\r\n");            //add cr lf
-            strcat(dataline, str);
-            fprintf(fpo,"%s",&dataline);
+            n = (left > READ_BLOCK) ? READ_BLOCK : left;
+            gdatasize = sizeof(struct PeakO);
+            n = fread(&gDataO, gdatasize, n, fp);
+            if (n == 0) break;                  // file ends in this second
+            for(i=0; i < n; i++)
+            {
+                sprintf(str,"%.3f",timeo);
+                strcpy(dataline, str);
+                sprintf(str, ",%u", gDataO.peako[i].max);
+                strcat(dataline, str);
+                sprintf(str, ",%u", gDataO.peako[i].pos);
+                strcat(dataline, str);
+                sprintf(str, ",%u", gDataO.peako[i].w);
+                strcat(dataline, str);
+                sprintf(str, ",%u", gDataO.peako[i].is);
+                strcat(dataline, str);
+                sprintf(str,"\r\n");            //add cr lf
+                strcat(dataline, str);
+                fprintf(fpo,"%s",&dataline);
+            }
         }
     }
     
@@ -279,5 +319,267 @@ void Read_Old( void)
     fclose(fp);
     fclose(fpo);    
 }
+//******************************************************************************
+//
+// Is_V2()
+//
+// Returns the version if gFN starts with a version 2 or later file header,
+// else 0.
+//
+//******************************************************************************
+int Is_V2( void)
+{
+    FILE *fp;
+    struct Peak_File_Header h;
+    int ver = 0;
+
+    if((fp = fopen(gFN, "rb")) == NULL) return 0;
+    if(fread(&h, sizeof(h), 1, fp) == 1 && Peak_File_Header_Check(&h) == 0)
+        ver = h.version;
+    fclose(fp);
+    return ver;
+}
+
+//******************************************************************************
+//
+// Read_V2()
+//
+// Uses global variables as I/O, handles reading and converting the version 2
+// file format. dT is in us from the raw cycle count, to 5 ns. Headers and
+// records longer than this program knows (a later version) are skipped over
+// using the sizes in the file header.
+//
+//******************************************************************************
+void Read_V2( void)
+{
+    FILE *fp, *fpo;
+    struct Peak_File_Header h;
+    struct Peak_Sec sec;
+    unsigned int i, n, left;
+    char dataline[512] = {""};
+    char str[512] = {""};
+    double timeo, dt, day = 86400.0;
 
+// Open the files for read and write.
+    if((fp = fopen(gFN, "rb")) == NULL)
+    {
+        printf("ERROR: File could not be opened for read.");
+        return;
+    }
+    if((fpo = fopen(gFNO, "a+")) == NULL)
+    {
+        printf("ERROR: File could not be opened for write.");
+        fclose(fp);
+        return;
+    }
 
+    if(fread(&h, sizeof(h), 1, fp) != 1 || Peak_File_Header_Check(&h) != 0)
+    {
+        printf("ERROR: Not a version 2 peak file.");
+        fclose(fp);
+        fclose(fpo);
+        return;
+    }
+    fseek(fp, h.header_bytes, SEEK_SET);
+
+// write the header on the new file
+    fprintf(fpo,"DateTime,Peak,Width,dT,Cycles\r\n");
+
+//Read 1 sec of data, and write it out one line at a time
+    while(fread(&sec, sizeof(sec), 1, fp) == 1)
+    {
+        if (sec.sync != PEAK_SEC_SYNC)
+        {
+            printf("ERROR: Bad second header at byte %ld.\n",
+                ftell(fp) - (long)sizeof(sec));
+            break;
+        }
+        fseek(fp, h.sec_bytes - sizeof(sec), SEEK_CUR);
+        timeo = fmod(sec.time, day);        // seconds since midnight at start
+        for (left = sec.n; left > 0; left -= n)
+        {
+            n = (left > READ_BLOCK) ? READ_BLOCK : left;
+            if (h.rec_bytes == sizeof(struct Peak_Rec))
+                n = fread(gRec, sizeof(struct Peak_Rec), n, fp);
+            else
+            {
+                for (i = 0; i < n; i++)     // one at a time, skip the rest
+                {
+                    if (fread(&gRec[i], sizeof(struct Peak_Rec), 1, fp) != 1)
+                        break;
+                    fseek(fp, h.rec_bytes - sizeof(struct Peak_Rec), SEEK_CUR);
+                }
+                n = i;
+            }
+            if (n == 0) break;              // file ends in this second
+            for (i = 0; i < n; i++)
+            {
+                dt = ((double)gRec[i].cycles + h.cycle_offset)/h.clock_hz;
+                timeo += dt;
+                sprintf(str,"%.6f",timeo);
+                strcpy(dataline, str);
+                sprintf(str, ",%u,%u", gRec[i].max, gRec[i].w);
+                strcat(dataline, str);
+                sprintf(str, ",%.3f,%u", dt*1000000., gRec[i].cycles);
+                strcat(dataline, str);
+                strcat(dataline, "\r\n");     // add cr lf
+                fprintf(fpo,"%s",dataline);     // write to file
+            }
+        }
+    }
+
+ // Close the files
+    fclose(fp);
+    fclose(fpo);
+}
+
+//******************************************************************************
+//
+// Write_Sec()
+//
+// Write the records of one checked v3 second, as Read_V2. The records are
+// copied out one at a time, as they need not be aligned and may be longer
+// than struct Peak_Rec.
+//
+//******************************************************************************
+static void Write_Sec(FILE *fpo, const struct Peak_File_Header *h,
+    const unsigned char *p)
+{
+    struct Peak_Frame f;
+    struct Peak_Rec rec;
+    unsigned int i;
+    double timeo, dt, day = 86400.0;
+
+    memcpy(&f, p, sizeof(f));
+    p += h->sec_bytes;
+    timeo = fmod(f.sec.time, day);          // seconds since midnight at start
+    for (i = 0; i < f.sec.n; i++, p += h->rec_bytes)
+    {
+        memcpy(&rec, p, sizeof(rec));
+        dt = ((double)rec.cycles + h->cycle_offset)/h->clock_hz;
+        timeo += dt;
+        fprintf(fpo, "%.6f,%u,%u,%.3f,%u\r\n", timeo, rec.max, rec.w,
+            dt*1000000., rec.cycles);
+    }
+}
+
+//******************************************************************************
+//
+// Find_Sec()
+//
+// Returns the offset of the first good second at or after pos, found from
+// its "PSEC" sync word, or size if there is none.
+//
+//******************************************************************************
+static unsigned long Find_Sec(const unsigned char *buf, unsigned long size,
+    unsigned long pos, const struct Peak_File_Header *h)
+{
+    const unsigned char *q;
+    const unsigned int sync = PEAK_SEC_SYNC;
+
+    while (pos + 4 <= size)
+    {
+        q = memchr(buf + pos, sync & 0xFF, size - pos);
+        if (q == NULL) break;
+        pos = q - buf;
+        if (pos + 4 > size) break;
+        if (memcmp(q, &sync, 4) == 0 && Peak_Frame_Check(q, size - pos, h) > 0)
+            return pos;
+        pos++;
+    }
+    return size;
+}
+
+//******************************************************************************
+//
+// Read_V3()
+//
+// Uses global variables as I/O, handles reading and converting the version 3
+// file format. The file is read into memory and each second is checked with
+// Peak_Frame_Check. Where one fails (a power loss part way through a second,
+// or damage on the card), the bytes are skipped up to the next "PSEC" sync
+// word that starts a good second, so every intact second is kept. If the
+// file header is damaged, or no second checks with its sizes, the sizes of
+// this version are used and the scan starts at the beginning of the file.
+//
+//******************************************************************************
+void Read_V3( void)
+{
+    FILE *fp, *fpo;
+    struct Peak_File_Header h;
+    unsigned char *buf;
+    unsigned long pos, size, len, start;
+    unsigned long secs = 0, peaks = 0, skipped = 0, bad = 0;
+    unsigned int n;
+
+// Read the whole file
+    if((fp = fopen(gFN, "rb")) == NULL)
+    {
+        printf("ERROR: File could not be opened for read.");
+        return;
+    }
+    fseek(fp, 0, SEEK_END);
+    size = ftell(fp);
+    fseek(fp, 0, SEEK_SET);
+    buf = malloc(size + 1);
+    if (buf == NULL || fread(buf, 1, size, fp) != size)
+    {
+        printf("ERROR: File could not be read.");
+        free(buf);
+        fclose(fp);
+        return;
+    }
+    fclose(fp);
+
+    if((fpo = fopen(gFNO, "a+")) == NULL)
+    {
+        printf("ERROR: File could not be opened for write.");
+        free(buf);
+        return;
+    }
+
+    pos = 0;
+    if (size >= sizeof(h))
+        memcpy(&h, buf, sizeof(h));
+    if (size < sizeof(h) || Peak_File_Header_Check(&h) != 0
+        || h.sec_bytes < sizeof(struct Peak_Frame)
+        || Find_Sec(buf, size, h.header_bytes, &h) == size)
+    {
+        printf("File header damaged, using the version %d sizes.\n",
+            PEAK_FILE_VERSION);
+        Peak_File_Header_Set(&h, "");
+    }
+    else pos = h.header_bytes;
+
+// write the header on the new file
+    fprintf(fpo,"DateTime,Peak,Width,dT,Cycles\r\n");
+
+// Write each good second, and resync past the bad ones
+    while (pos < size)
+    {
+        len = Peak_Frame_Check(buf + pos, size - pos, &h);
+        if (len > 0)
+        {
+            Write_Sec(fpo, &h, buf + pos);
+            memcpy(&n, buf + pos + offsetof(struct Peak_Sec, n), sizeof(n));
+            secs++;
+            peaks += n;
+            pos += len;
+            continue;
+        }
+
+        start = pos;                        // find the next good second
+        pos = Find_Sec(buf, size, pos + 1, &h);
+        bad++;
+        skipped += pos - start;
+        printf("Skipped %lu bytes at byte %lu%s.\n", pos - start, start,
+            (pos == size) ? ", the end of the file" : "");
+    }
+
+    printf("%lu seconds, %lu particles read. %lu bytes skipped in %lu "
+        "places.\n", secs, peaks, skipped, bad);
+
+ // Close the files
+    free(buf);
+    fclose(fpo);
+}
@@ -0,0 +1,227 @@
+/*
+// Filename: pops_baseline.c
+// Version: 1.0
+//
+// Project: NOAA - POPS
+//
+// Description - Robust baseline estimates for Calc_Baseline. A histogram of
+// the 16 bit values in the PRU1 baseline buffer is kept up to date point by
+// point, and the median, the trimmed mean and the median absolute deviation
+// are read from it by walking the bins, skipping the empty 256 value ranges.
+// See pops_baseline.h.
+//
+// See SOFTWARE DISCLAIMER.md.
+*/
+
+//******************************************************************************
+//
+// Include files:
+//
+//******************************************************************************
+
+#include <string.h>
+#include "pops_baseline.h"
+
+//******************************************************************************
+//
+//  BL_Hist_Init
+//
+//  Clear the histogram. The copy of the buffer is all 0, so the histogram
+//  starts as 512 points of 0, which the first update replaces.
+//
+//  Parameters: struct BL_Hist *h
+//
+//******************************************************************************
+
+void BL_Hist_Init(struct BL_Hist *h)
+{
+    memset(h, 0, sizeof(*h));
+    h->fine[0] = PRU_BL_POINTS;
+    h->coarse[0] = PRU_BL_POINTS;
+    h->n = PRU_BL_POINTS;
+}
+
+//******************************************************************************
+//
+//  BL_Hist_Update
+//
+//  Compare the buffer with the copy, and move each point that PRU1 has
+//  replaced from its old bin to its new one. All 512 points are read.
+//
+//  Parameters: struct BL_Hist *h
+//              const volatile unsigned int *bl (PRU1 baseline buffer)
+//
+//  Returns: unsigned int (points changed)
+//
+//******************************************************************************
+
+unsigned int BL_Hist_Update(struct BL_Hist *h, const volatile unsigned int *bl)
+{
+    unsigned int i, k, j, w, x, old, changed = 0;
+
+    for (i = 0; i < PRU_BL_WORDS; i++)
+    {
+        w = bl[i];
+        for (k = 0; k < 2; k++, w >>= 16)
+        {
+            j = 2*i + k;
+            x = w & 0xFFFF;
+            old = h->pts[j];
+            if (x == old) continue;
+            h->fine[old]--;
+            h->coarse[old >> 8]--;
+            h->fine[x]++;
+            h->coarse[x >> 8]++;
+            h->pts[j] = x;
+            changed++;
+        }
+    }
+    return changed;
+}
+
+//******************************************************************************
+//
+//  BL_Hist_Rank
+//
+//  Find the 256 value range holding rank k from the coarse bins, then the
+//  value within it.
+//
+//  Parameters: const struct BL_Hist *h
+//              unsigned int k (rank, 0 the smallest)
+//
+//  Returns: unsigned int (value)
+//
+//******************************************************************************
+
+unsigned int BL_Hist_Rank(const struct BL_Hist *h, unsigned int k)
+{
+    unsigned int b, v, c = 0;
+
+    for (b = 0; b < 256; b++)
+    {
+        if (c + h->coarse[b] > k) break;
+        c += h->coarse[b];
+    }
+    if (b == 256) return 0xFFFF;
+    for (v = b << 8; v < 0xFFFF; v++)
+    {
+        c += h->fine[v];
+        if (c > k) break;
+    }
+    return v;
+}
+
+//******************************************************************************
+//
+//  BL_Hist_MAD
+//
+//  Median absolute deviation from m. The points at each distance d from m,
+//  those of m - d and m + d together, are counted outward from d = 0 until
+//  half the points are counted. The deviation is interpolated within the
+//  last distance, taking its points as spread over d +-0.5 (0 to 0.5 at
+//  d = 0), so a small MAD is not rounded to a whole count. Both bins of a
+//  distance are pooled before interpolating, or the side taken first would
+//  pull the MAD down. Distances where both bins are in empty 256 value
+//  ranges are skipped.
+//
+//  Parameters: const struct BL_Hist *h
+//              unsigned int m (median)
+//
+//  Returns: double (MAD)
+//
+//******************************************************************************
+
+static double BL_Hist_MAD(const struct BL_Hist *h, unsigned int m)
+{
+    int a, b, d, ea, eb, sa, sb;
+    unsigned int f, c = 0, target = h->n/2 + 1;
+
+    for (d = 0; ; d++)
+    {
+        a = (int)m - d;                     // bins at distance d
+        b = (int)m + d;
+        ea = (a < 0) || h->coarse[a >> 8] == 0;
+        eb = (b > 0xFFFF) || h->coarse[b >> 8] == 0;
+        if (ea && eb)                       // both ranges empty, skip to
+        {                                   // the nearer end of them
+            if (a < 0 && b > 0xFFFF) return d;
+            sa = (a < 0) ? 0x10000 : (a & 0xFF) + 1;
+            sb = (b > 0xFFFF) ? 0x10000 : 0x100 - (b & 0xFF);
+            d += ((sa < sb) ? sa : sb) - 1;
+            continue;
+        }
+        f = ea ? 0 : h->fine[a];
+        if (!eb && d > 0) f += h->fine[b];
+        if (f == 0) continue;
+        if (c + f >= target)
+        {
+            if (d == 0) return 0.5*(target - c)/f;
+            return d - 0.5 + (double)(target - c)/f;
+        }
+        c += f;
+    }
+}
+
+//******************************************************************************
+//
+//  BL_Hist_Trimmed
+//
+//  Mean of ranks lo to hi - 1.
+//
+//  Parameters: const struct BL_Hist *h
+//              unsigned int lo, hi (ranks kept)
+//
+//  Returns: double (mean)
+//
+//******************************************************************************
+
+static double BL_Hist_Trimmed(const struct BL_Hist *h, unsigned int lo,
+    unsigned int hi)
+{
+    unsigned int b, v, f, s, e, c = 0;
+    unsigned long long sum = 0;
+
+    for (b = 0; b < 256 && c < hi; b++)
+    {
+        if (h->coarse[b] == 0) continue;
+        for (v = b << 8; v < ((b + 1) << 8) && c < hi; v++)
+        {
+            f = h->fine[v];
+            if (f == 0) continue;
+            s = (c > lo) ? c : lo;          // ranks of this bin kept
+            e = (c + f < hi) ? c + f : hi;
+            if (e > s) sum += (unsigned long long)(e - s)*v;
+            c += f;
+        }
+    }
+    return (double)sum/(hi - lo);
+}
+
+//******************************************************************************
+//
+//  BL_Hist_Robust
+//
+//  Baseline by the median or the trimmed mean, and the STD from the MAD
+//  about the median, scaled to the STD of normal noise.
+//
+//  Parameters: const struct BL_Hist *h
+//              int est (BL_EST_MEDIAN or BL_EST_TRIMMED)
+//              unsigned int trim (% cut from each end, trimmed mean)
+//              double *bl, double *std (results)
+//
+//******************************************************************************
+
+void BL_Hist_Robust(const struct BL_Hist *h, int est, unsigned int trim,
+    double *bl, double *std)
+{
+    unsigned int m, k;
+
+    m = BL_Hist_Rank(h, h->n/2);
+    if (trim > 45) trim = 45;
+    k = (h->n*trim)/100;
+    if (est == BL_EST_TRIMMED && k > 0)
+        *bl = BL_Hist_Trimmed(h, k, h->n - k);
+    else if (h->n & 1) *bl = m;
+    else *bl = 0.5*((double)BL_Hist_Rank(h, h->n/2 - 1) + m);
+    *std = BL_MAD_SIGMA*BL_Hist_MAD(h, m);
+}
@@ -0,0 +1,50 @@
+// pops_baseline.h
+// Robust baseline estimates for the POPS program.
+// Project: NOAA - POPS
+
+#ifndef _POPS_BASELINE_H_
+#define _POPS_BASELINE_H_
+
+#include "pops_pru.h"
+
+// Calc_Baseline estimators (Setting.Baseline Estimator).
+// BL_EST_MEAN     mean and STD, from the PRU1 block sums (PRU_BL_Stats)
+// BL_EST_MEDIAN   median, and 1.4826 * the median absolute deviation
+// BL_EST_TRIMMED  mean of the points left after trim % is cut from each end,
+//                 and 1.4826 * the median absolute deviation
+// Peak tails under BLTH pull the mean and STD up, the median and MAD hardly
+// move until half the points are contaminated.
+#define BL_EST_MEAN 0
+#define BL_EST_MEDIAN 1
+#define BL_EST_TRIMMED 2
+#define BL_MAD_SIGMA 1.4826                 // MAD to STD of normal noise
+
+// Histogram of the 16 bit points in the baseline buffer. An update compares
+// the buffer with the copy, 512 points, and moves each point PRU1 has
+// replaced between two bins, so it costs a pass over the buffer however few
+// points changed; POPS_BBB.c updates it when PRU1 has finished a block of
+// them, or once a second for the HK median. The coarse bins (the high
+// byte) let the rank and deviation walks skip empty ranges.
+struct BL_Hist {
+    unsigned short pts[PRU_BL_POINTS];      // the buffer at the last update
+    unsigned short fine[65536];             // points of each value
+    unsigned short coarse[256];             // points of each 256 values
+    unsigned int n;                         // points in the histogram
+};
+
+// Clear the histogram.
+void BL_Hist_Init(struct BL_Hist *h);
+
+// Bring the histogram up to the baseline buffer bl (PRU_Mem.bl).
+// Returns the number of points that changed.
+unsigned int BL_Hist_Update(struct BL_Hist *h, const volatile unsigned int *bl);
+
+// Value of rank k, 0 the smallest.
+unsigned int BL_Hist_Rank(const struct BL_Hist *h, unsigned int k);
+
+// Robust baseline and STD of the histogram by the estimator est
+// (BL_EST_MEDIAN or BL_EST_TRIMMED, trim % cut from each end).
+void BL_Hist_Robust(const struct BL_Hist *h, int est, unsigned int trim,
+    double *bl, double *std);
+
+#endif // _POPS_BASELINE_H_
@@ -0,0 +1,485 @@
+/*
+// Filename: pops_bins.c
+// Version: 1.0
+//
+// Project: NOAA - POPS
+//
+// Description - Peak to size bin lookup table. The log10 and divide CalcBins
+// did for every particle are done once for each of the 65536 possible peak
+// maxima when the bin settings change (Read_POPS_cfg, and the nbins, logmin
+// and logmax commands). The ingest thread bins each peak as it is queued,
+// with its width moments, so the 1 Hz loop only reads the totals. The
+// histograms that are output are summed from that master histogram. See
+// pops_bins.h.
+//
+// See SOFTWARE DISCLAIMER.md.
+*/
+
+//******************************************************************************
+//
+// Include files:
+//
+//******************************************************************************
+
+#include <math.h>
+#include <string.h>
+#include "pops_bins.h"
+
+//******************************************************************************
+//
+// Global variables:
+//
+//******************************************************************************
+
+static unsigned int gBin_LUT_Gen = 0;       // builds of any table
+
+//******************************************************************************
+//
+//  Bin_LUT_Build
+//
+//  Work out the bin of every max exactly as CalcBins did, so the histogram
+//  is the same to the count. A max of 0 (log10 = -inf) is in no bin.
+//
+//  Parameters: struct Bin_LUT *b
+//              unsigned int nbins (number of bins)
+//              double logmin, double logmax (log10 of the bin range)
+//
+//******************************************************************************
+
+void Bin_LUT_Build(struct Bin_LUT *b, unsigned int nbins, double logmin,
+    double logmax)
+{
+    double logdelta, dbin;
+    unsigned int v;
+
+    b->nbins = nbins;
+    b->logmin = logmin;
+    b->logmax = logmax;
+    if (++gBin_LUT_Gen == 0) gBin_LUT_Gen = 1;
+    b->gen = gBin_LUT_Gen;
+    for (v = 0; v < BIN_LUT_SIZE; v++) b->bin[v] = BIN_LUT_NONE;
+    if (nbins == 0) return;
+
+    logdelta = (logmax - logmin)/(double)nbins;
+    for (v = 1; v < BIN_LUT_SIZE; v++)
+    {
+        dbin = (log10(v) - logmin)/logdelta;
+        if (dbin >= 0 && dbin < nbins && dbin < BIN_LUT_MAX_BINS)
+            b->bin[v] = (unsigned short)(int)dbin;
+    }
+}
+
+//******************************************************************************
+//
+//  Bin_LUT_Build_Cal
+//
+//  Work out the diameter bin of every max. The max rise, so the calibration
+//  segment and the bin only move up, and the table is one pass.
+//
+//  Parameters: struct Bin_LUT *b
+//              const double *amp, *diam (calibration curve)
+//              unsigned int ncal (points on the curve)
+//              const double *edges (bin edges)
+//              unsigned int nedges (edges, one more than the bins)
+//
+//  Returns: int (0 ok, -1 bad curve or edges)
+//
+//******************************************************************************
+
+int Bin_LUT_Build_Cal(struct Bin_LUT *b, const double *amp,
+    const double *diam, unsigned int ncal, const double *edges,
+    unsigned int nedges)
+{
+    double la, d;
+    unsigned int v, i, k = 0, j = 0;
+
+    if (ncal < 2 || ncal > BIN_CAL_MAX || nedges < 2
+        || nedges > BIN_LUT_MAX_BINS + 1 || amp[0] <= 0 || diam[0] <= 0)
+        return -1;
+    for (i = 1; i < ncal; i++)
+        if (amp[i] <= amp[i - 1] || diam[i] <= diam[i - 1]) return -1;
+    for (i = 1; i < nedges; i++)
+        if (edges[i] <= edges[i - 1]) return -1;
+
+    b->nbins = nedges - 1;
+    b->logmin = 0;                          // not log bins
+    b->logmax = 0;
+    if (++gBin_LUT_Gen == 0) gBin_LUT_Gen = 1;
+    b->gen = gBin_LUT_Gen;
+    for (v = 0; v < BIN_LUT_SIZE; v++) b->bin[v] = BIN_LUT_NONE;
+
+    for (v = 1; v < BIN_LUT_SIZE; v++)
+    {
+        if (v < amp[0]) continue;
+        while (k + 2 < ncal && v > amp[k + 1]) k++;
+        if (v > amp[k + 1]) break;          // past the curve
+        la = (log10(v) - log10(amp[k]))/(log10(amp[k + 1]) - log10(amp[k]));
+        d = pow(10, log10(diam[k]) + la*(log10(diam[k + 1]) - log10(diam[k])));
+        while (j < nedges - 1 && d >= edges[j + 1]) j++;
+        if (j == nedges - 1) break;         // past the last edge
+        if (d >= edges[j]) b->bin[v] = j;
+    }
+    return 0;
+}
+
+//******************************************************************************
+//
+//  Bin_LUT_Count
+//
+//  Count the peaks into a full size histogram, one load and one add each
+//  with no test, BIN_LUT_NONE collecting the peaks in no bin, then add its
+//  first nbins bins to hist.
+//
+//  Parameters: const struct Bin_LUT *b
+//              const unsigned short *max (peak maxima)
+//              unsigned int n (number of peaks)
+//              unsigned int *hist (b->nbins bins, added to)
+//
+//******************************************************************************
+
+void Bin_LUT_Count(const struct Bin_LUT *b, const unsigned short *max,
+    unsigned int n, unsigned int *hist)
+{
+    unsigned int h[BIN_LUT_MAX_BINS + 1] = {0};
+    unsigned int i;
+
+    for (i = 0; i < n; i++) h[b->bin[max[i]]]++;
+    for (i = 0; i < b->nbins && i < BIN_LUT_MAX_BINS; i++) hist[i] += h[i];
+}
+
+//******************************************************************************
+//
+//  Bin_View_Set
+//
+//  Work out the master bin edges of the view.
+//
+//  Parameters: struct Bin_View *v
+//              unsigned int master (bins of the master histogram)
+//              unsigned int n (equal bins the master is split into)
+//              const unsigned char *group (of the n bins in each view bin,
+//                  NULL for one each)
+//              unsigned int ngroups (bins of the view, with group)
+//
+//  Returns: int (0 ok, -1 not a view of the master)
+//
+//******************************************************************************
+
+int Bin_View_Set(struct Bin_View *v, unsigned int master, unsigned int n,
+    const unsigned char *group, unsigned int ngroups)
+{
+    unsigned int i, k = 0;
+
+    if (n == 0 || master % n != 0) return -1;
+    if (group == NULL) ngroups = n;
+    if (ngroups == 0 || ngroups > BIN_VIEW_MAX) return -1;
+
+    for (i = 0; i < ngroups; i++)
+    {
+        v->edge[i] = k*(master/n);
+        k += (group == NULL) ? 1 : group[i];
+    }
+    if (k != n) return -1;
+    v->edge[ngroups] = master;
+    v->nbins = ngroups;
+    return 0;
+}
+
+//******************************************************************************
+//
+//  Bin_View_Fill
+//
+//  Sum the runs of master bins.
+//
+//  Parameters: const struct Bin_View *v
+//              const unsigned int *master (master histogram)
+//              int *hist (v->nbins bins, set)
+//
+//******************************************************************************
+
+void Bin_View_Fill(const struct Bin_View *v, const unsigned int *master,
+    int *hist)
+{
+    unsigned int i, k, sum;
+
+    for (i = 0; i < v->nbins; i++)
+    {
+        for (sum = 0, k = v->edge[i]; k < v->edge[i + 1]; k++)
+            sum += master[k];
+        hist[i] = (int)sum;
+    }
+}
+
+//******************************************************************************
+//
+//  Bin_LCM
+//
+//  Least common multiple, 0 if either is 0.
+//
+//  Parameters: unsigned int a, b
+//
+//  Returns: unsigned int
+//
+//******************************************************************************
+
+unsigned int Bin_LCM(unsigned int a, unsigned int b)
+{
+    unsigned int x = a, y = b, r;
+
+    if (a == 0 || b == 0) return 0;
+    while (y != 0)
+    {
+        r = x % y;
+        x = y;
+        y = r;
+    }
+    return (a/x)*b;
+}
+
+//******************************************************************************
+//
+//  H2D_Map_Build
+//
+//  Work out the row of each master bin and the column of each width.
+//
+//  Parameters: struct H2D_Map *m
+//              unsigned int master (bins of the master histogram)
+//              unsigned int amp_bins (amplitude bins, divides master)
+//              unsigned int width_bins (width bins, 2 or more)
+//              unsigned int width_max (points, 1 to H2D_POINTS - 1)
+//
+//  Returns: int (0 ok, -1 bad sizes)
+//
+//******************************************************************************
+
+int H2D_Map_Build(struct H2D_Map *m, unsigned int master,
+    unsigned int amp_bins, unsigned int width_bins, unsigned int width_max)
+{
+    unsigned int i;
+
+    if (amp_bins == 0 || amp_bins > H2D_AMP_MAX || master % amp_bins != 0
+        || master > BIN_LUT_MAX_BINS || width_bins < 2
+        || width_bins > H2D_WIDTH_MAX || width_max == 0
+        || width_max >= H2D_POINTS) return -1;
+
+    m->amp_bins = amp_bins;
+    m->width_bins = width_bins;
+    m->width_max = width_max;
+    for (i = 0; i <= BIN_LUT_MAX_BINS; i++)
+    {
+        m->row[i] = (i < master) ? (i/(master/amp_bins))*width_bins
+            : H2D_CELLS_MAX;
+    }
+    for (i = 0; i < H2D_POINTS; i++)
+    {
+        m->col[i] = (i < width_max) ? (i*(width_bins - 1))/width_max
+            : width_bins - 1;
+    }
+    return 0;
+}
+
+//******************************************************************************
+//
+//  Bin_Acc_Clear
+//
+//  Empty the accumulator for the next second.
+//
+//  Parameters: struct Bin_Acc *a
+//              const struct Bin_LUT *lut (table to bin by)
+//              const struct H2D_Map *map (2D bins, NULL for none)
+//
+//******************************************************************************
+
+void Bin_Acc_Clear(struct Bin_Acc *a, const struct Bin_LUT *lut,
+    const struct H2D_Map *map)
+{
+    memset(a, 0, sizeof(*a));
+    Stat_Clear(&a->width);
+    Stat_Clear(&a->amp);
+    Stat_Clear(&a->cycles);
+    a->lut = lut;
+    a->gen = (lut != NULL) ? lut->gen : 0;
+    a->map = map;
+}
+
+//******************************************************************************
+//
+//  DT_Bin
+//
+//  Bin of a time between peaks.
+//
+//  Parameters: unsigned int c (PRU cycles)
+//
+//  Returns: unsigned int (bin)
+//
+//******************************************************************************
+
+static unsigned int DT_Bin(unsigned int c)
+{
+    unsigned int e;
+
+    if (c < (1u << DT_OCT_MIN)) return 0;
+    e = 31 - __builtin_clz(c);              // highest set bit
+    if (e >= DT_OCT_MAX) return DT_BINS - 1;
+    return 1 + 2*(e - DT_OCT_MIN) + ((c >> (e - 1)) & 1);
+}
+
+//******************************************************************************
+//
+//  DT_Bin_Edge
+//
+//  Lower edge of a dt bin.
+//
+//  Parameters: unsigned int b (bin)
+//
+//  Returns: unsigned int (PRU cycles)
+//
+//******************************************************************************
+
+unsigned int DT_Bin_Edge(unsigned int b)
+{
+    unsigned int e;
+
+    if (b == 0) return 0;
+    if (b >= DT_BINS - 1) return 1u << DT_OCT_MAX;
+    e = DT_OCT_MIN + (b - 1)/2;
+    return (2 + ((b - 1) & 1)) << (e - 1);
+}
+
+//******************************************************************************
+//
+//  Bin_Acc_Add
+//
+//  Bin the peaks, one pass with no test, and add their width, max and dt
+//  to the statistics. Add them to the 2D histogram if there is one. Peaks
+//  wider than the width table go in its last entry. The times between the
+//  peaks are binned and added up, with the dead times, in another pass.
+//
+//  Parameters: struct Bin_Acc *a
+//              const unsigned short *max, *w (peak max and width)
+//              const unsigned int *cycles (PRU cycles since the last peak)
+//              unsigned int n (number of peaks)
+//
+//******************************************************************************
+
+void Bin_Acc_Add(struct Bin_Acc *a, const unsigned short *max,
+    const unsigned short *w, const unsigned int *cycles, unsigned int n)
+{
+    const unsigned short *bin = a->lut->bin;
+    unsigned long long span = 0, dead = 0;
+    unsigned int i, d;
+
+    for (i = 0; i < n; i++) a->hist[bin[max[i]]]++;
+    a->n += n;
+    Stat_Add_U16(&a->width, w, n);
+    Stat_Add_U16(&a->amp, max, n);
+    Stat_Add_U32(&a->cycles, cycles, n);
+
+    for (i = 0; i < n; i++)
+    {
+        a->dt[DT_Bin(cycles[i])]++;
+        d = (unsigned int)w[i]*DT_POINT_CYCLES;
+        dead += (d < cycles[i]) ? d : cycles[i];
+        span += cycles[i];
+    }
+    a->span += span;
+    a->dead += dead;
+
+    if (a->map == NULL) return;
+    for (i = 0; i < n; i++)
+    {
+        a->h2d[a->map->row[bin[max[i]]]
+            + a->map->col[(w[i] < H2D_POINTS) ? w[i] : H2D_POINTS - 1]]++;
+    }
+}
+
+//******************************************************************************
+//
+//  Bin_Acc_Queue
+//
+//  Add the peaks just queued, one or two contiguous pieces of the queue.
+//  Called by the producer, so the peaks are still in its cache.
+//
+//  Parameters: struct Bin_Acc *a
+//              const struct Peak_Queue *q
+//              unsigned int from (q->head before the peaks were queued)
+//
+//******************************************************************************
+
+void Bin_Acc_Queue(struct Bin_Acc *a, const struct Peak_Queue *q,
+    unsigned int from)
+{
+    unsigned int pos, n, head = q->head;
+
+    for (; from != head; from += n)
+    {
+        pos = from & (PEAK_QUEUE_SIZE - 1);
+        n = PEAK_QUEUE_SIZE - pos;          // contiguous to the end
+        if (n > head - from) n = head - from;
+        Bin_Acc_Add(a, q->max + pos, q->w + pos, q->cycles + pos, n);
+    }
+}
+
+//******************************************************************************
+//
+//  Bin_Acc_Sum
+//
+//  Add a closed second to the one before it, which was not read in time.
+//
+//  Parameters: struct Bin_Acc *a (the earlier second)
+//              const struct Bin_Acc *b (the later second, added to a)
+//
+//******************************************************************************
+
+void Bin_Acc_Sum(struct Bin_Acc *a, const struct Bin_Acc *b)
+{
+    unsigned int i;
+
+    for (i = 0; i <= BIN_LUT_MAX_BINS; i++) a->hist[i] += b->hist[i];
+    a->n += b->n;
+    Stat_Sum(&a->width, &b->width);
+    Stat_Sum(&a->amp, &b->amp);
+    Stat_Sum(&a->cycles, &b->cycles);
+    if (a->gen != b->gen) a->gen = 0;       // bin again from the peaks
+    a->head = b->head;
+    a->secs += b->secs;
+    if (a->map != NULL && b->map != NULL)
+    {
+        for (i = 0; i < H2D_CELLS_MAX + H2D_WIDTH_MAX; i++)
+            a->h2d[i] += b->h2d[i];
+    }
+    for (i = 0; i < DT_BINS; i++) a->dt[i] += b->dt[i];
+    a->span += b->span;
+    a->dead += b->dead;
+}
+
+//******************************************************************************
+//
+//  Bin_Acc_Dead_Factor
+//
+//  Solve m = R*exp(-R*tau) for x = R*tau on the branch below 1, by Newton
+//  from x = m*tau: x*exp(-x) = m*tau. The factor R/m is exp(x).
+//
+//  Parameters: const struct Bin_Acc *a
+//
+//  Returns: double (true over measured count rate)
+//
+//******************************************************************************
+
+double Bin_Acc_Dead_Factor(const struct Bin_Acc *a)
+{
+    double mt, x, f;
+    int i;
+
+    if (a->n == 0 || a->span == 0) return 1.0;
+    mt = (double)a->dead/a->span;           // m*tau, n cancels
+    if (mt >= exp(-1.0)) return exp(1.0);
+
+    x = mt;
+    for (i = 0; i < 50; i++)
+    {
+        f = (x*exp(-x) - mt)/((1.0 - x)*exp(-x));
+        x -= f;
+        if (fabs(f) < 1e-12) break;
+    }
+    return exp(x);
+}
@@ -0,0 +1,170 @@
+// pops_bins.h
+// Peak to size bin lookup table and histograms for the POPS program.
+// Project: NOAA - POPS
+
+#ifndef _POPS_BINS_H_
+#define _POPS_BINS_H_
+
+#include "pops_pru.h"
+#include "pops_stats.h"
+
+// CalcBins puts each peak max in bin (log10(max) - logmin)/logdelta, with
+// logdelta = (logmax - logmin)/nbins, if that is in 0 to nbins - 1. The max
+// is 16 bits, so the bin of every possible max is worked out once, by the
+// same expression, when the bin settings change. Binning is then one load
+// per peak, with no log10 or divide.
+//
+// The table is for the master histogram, which has the most bins. The
+// histograms that are output (views) are sums of runs of its bins, so each
+// one is exact and costs nothing per peak. A view of n bins needs the master
+// bins to be a multiple of n.
+#define BIN_LUT_SIZE 65536                  // 16 bit peak max
+#define BIN_LUT_MAX_BINS 1024               // bins the table can hold
+#define BIN_LUT_NONE BIN_LUT_MAX_BINS       // max in no bin
+#define BIN_MASTER_DEFAULT 400              // 16, 25, 100, 200 (BinsSet) divide it
+#define BIN_VIEW_MAX 200                    // bins of a view
+
+// A table is built again in place when the bins change, so what was binned
+// by it is checked against gen, which every build changes, not its address.
+struct Bin_LUT {
+    unsigned short bin[BIN_LUT_SIZE];       // bin of each max, or BIN_LUT_NONE
+    unsigned int nbins;                     // settings the table is for
+    double logmin;
+    double logmax;
+    unsigned int gen;                       // build, never 0
+};
+
+// Build the table for nbins bins from logmin to logmax (log10 of the max).
+// Bins past BIN_LUT_MAX_BINS - 1 are left out.
+void Bin_LUT_Build(struct Bin_LUT *b, unsigned int nbins, double logmin,
+    double logmax);
+
+// Diameter bins instead (Setting.Diameter). The diameter of a max is
+// interpolated in log10(max) against log10(diameter) between the points of
+// a calibration curve (PSL or Mie), both rising, and binned by the edges.
+// A max outside the curve, or a diameter outside the edges, is in no bin.
+// The table is the same, so a peak still costs one load.
+#define BIN_CAL_MAX 64                      // calibration points
+
+// Build the table for the nedges - 1 diameter bins between edges (rising,
+// in the units of diam) from the ncal calibration points amp (peak max) and
+// diam. Returns 0, or -1 if a list is too short or long, or not rising.
+int Bin_LUT_Build_Cal(struct Bin_LUT *b, const double *amp,
+    const double *diam, unsigned int ncal, const double *edges,
+    unsigned int nedges);
+
+// Add n peaks to hist, which has b->nbins bins.
+void Bin_LUT_Count(const struct Bin_LUT *b, const unsigned short *max,
+    unsigned int n, unsigned int *hist);
+
+// A histogram summed from the master one. Bin i is master bins edge[i] to
+// edge[i + 1] - 1.
+struct Bin_View {
+    unsigned int nbins;
+    unsigned short edge[BIN_VIEW_MAX + 1];  // first master bin of each bin
+};
+
+// Set v to n equal bins of the master bins, or, with group, to ngroups bins
+// of group[i] of the n bins each (16 bins folded to 8 for iMet is 1, 1, 1,
+// 1, 1, 1, 4, 6). Returns 0, or -1 if n does not divide master or the
+// groups do not add up to n.
+int Bin_View_Set(struct Bin_View *v, unsigned int master, unsigned int n,
+    const unsigned char *group, unsigned int ngroups);
+
+// Sum the master histogram into the v->nbins bins of hist.
+void Bin_View_Fill(const struct Bin_View *v, const unsigned int *master,
+    int *hist);
+
+// Least common multiple, for the master bins of a set of views.
+unsigned int Bin_LCM(unsigned int a, unsigned int b);
+
+// Bins of the 2D histogram of amplitude against width. The amplitude bins
+// are runs of master bins, as a view, and the width bins width_bins - 1
+// equal bins from 0 to width_max points, then one for width_max and wider.
+// Both are table lookups, so a peak is two loads and an add.
+#define H2D_AMP_MAX 64                      // amplitude bins
+#define H2D_WIDTH_MAX 64                    // width bins
+#define H2D_CELLS_MAX (H2D_AMP_MAX*H2D_WIDTH_MAX)
+#define H2D_POINTS 256                      // widths in the table
+
+struct H2D_Map {
+    unsigned short row[BIN_LUT_MAX_BINS + 1];   // first cell of each master
+                                            // bin's row, H2D_CELLS_MAX none
+    unsigned char col[H2D_POINTS];          // width bin of each width
+    unsigned int amp_bins;
+    unsigned int width_bins;
+    unsigned int width_max;                 // points, the last bin is wider
+};
+
+// Build the map for amp_bins amplitude bins of the master bins, and
+// width_bins width bins. Returns 0, or -1 if amp_bins does not divide master
+// or a size is out of range.
+int H2D_Map_Build(struct H2D_Map *m, unsigned int master,
+    unsigned int amp_bins, unsigned int width_bins, unsigned int width_max);
+
+// Log spaced histogram of the time between peaks (Peak_Queue.cycles), two
+// bins an octave: bin 0 under 2^DT_OCT_MIN cycles (0.32 us, about one
+// point), then 2^e and 1.5*2^e cycles for e = DT_OCT_MIN to DT_OCT_MAX - 1,
+// and the last DT_OCT_MAX (5.4 s) and longer. The bin is from the highest
+// set bit, with no log.
+//
+// The dead time of a peak is its width, DT_POINT_CYCLES a point, but no
+// more than the time since the peak before it, so overlaps count once.
+#define DT_OCT_MIN 6
+#define DT_OCT_MAX 30
+#define DT_BINS (2*(DT_OCT_MAX - DT_OCT_MIN) + 2)
+#define DT_POINT_CYCLES (PRU_CLOCK_HZ/4000000)  // PRU cycles an A/D point
+
+// Lower edge of dt bin b, PRU cycles.
+unsigned int DT_Bin_Edge(unsigned int b);
+
+// Histogram and statistics of one second, added to by the ingest thread as
+// it queues the peaks, so closing the second needs no pass over them.
+// The bins are those of the table lut, BIN_LUT_NONE holding the peaks in no
+// bin, as built at gen. The thread keeps two, filling one while the 1 Hz
+// loop reads the other. A second closed before the last one was read is
+// added to it (Bin_Acc_Sum), so secs may be more than 1.
+struct Bin_Acc {
+    unsigned int hist[BIN_LUT_MAX_BINS + 1];    // peaks in each table bin
+    unsigned int n;                         // peaks
+    struct Stat width;                      // peak width, points
+    struct Stat amp;                        // peak max
+    struct Stat cycles;                     // PRU cycles since the last peak
+    const struct Bin_LUT *lut;              // table the peaks are binned by
+    unsigned int gen;                       // lut->gen, 0 mixed tables
+    unsigned int head;                      // queue head at the close
+    unsigned int secs;                      // seconds closed into it
+    const struct H2D_Map *map;              // 2D bins, NULL for none
+    unsigned int h2d[H2D_CELLS_MAX + H2D_WIDTH_MAX];    // amplitude rows of
+                                            // width bins, then no amplitude
+    unsigned int dt[DT_BINS];               // peaks by time since the last
+    unsigned long long span;                // sum of the times, PRU cycles
+    unsigned long long dead;                // sum of the dead times
+};
+
+// Empty the accumulator, for peaks binned by lut, and by map in 2D (NULL for
+// no 2D histogram).
+void Bin_Acc_Clear(struct Bin_Acc *a, const struct Bin_LUT *lut,
+    const struct H2D_Map *map);
+
+// Add n peaks.
+void Bin_Acc_Add(struct Bin_Acc *a, const unsigned short *max,
+    const unsigned short *w, const unsigned int *cycles, unsigned int n);
+
+// Producer: add the peaks queued from peak from up to q->head.
+void Bin_Acc_Queue(struct Bin_Acc *a, const struct Peak_Queue *q,
+    unsigned int from);
+
+// Add the closed second b, which follows it, to a. a takes b's head. If
+// they were binned by different builds a->gen is 0, and the histogram has
+// to be binned again from the peaks.
+void Bin_Acc_Sum(struct Bin_Acc *a, const struct Bin_Acc *b);
+
+// Dead time correction of the count rate, true/measured, for Poisson
+// arrivals each extending the dead time (a peak arriving during another
+// merges with it): m = R*exp(-R*tau), with m the peaks over span and tau the
+// mean dead time. Returns 1 for no peaks, and e (R*tau = 1, the most that
+// can be measured) if m*tau is over 1/e.
+double Bin_Acc_Dead_Factor(const struct Bin_Acc *a);
+
+#endif // _POPS_BINS_H_
@@ -0,0 +1,152 @@
+/*
+// Filename: pops_bltel.c
+// Version: 1.0
+//
+// Project: NOAA - POPS
+//
+// Description - Baseline and threshold telemetry. Calc_Baseline records every
+// update, with its time, in a preallocated ring, and the 1 Hz loop writes
+// the ring to the telemetry file (BLTel_*.b) and sends it over UDP, so the
+// threshold can be followed between the once a second HK lines. See
+// pops_bltel.h for the format.
+//
+// See SOFTWARE DISCLAIMER.md.
+*/
+
+//******************************************************************************
+//
+// Include files:
+//
+//******************************************************************************
+
+#include <string.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include "pops_bltel.h"
+
+//******************************************************************************
+//
+//  BL_Tel_Add
+//
+//  Record one baseline update.
+//
+//  Parameters: struct BL_Tel_Ring *r
+//              double t (s since 1970)
+//              unsigned int bl, unsigned int blth (values sent to PRU1)
+//              double std (STD of the baseline)
+//
+//******************************************************************************
+
+void BL_Tel_Add(struct BL_Tel_Ring *r, double t, unsigned int bl,
+    unsigned int blth, double std)
+{
+    struct BL_Tel_Rec *rec;
+
+    if (r->head - r->tail >= BL_TEL_RING_SIZE)
+    {
+        r->lost++;
+        return;
+    }
+    rec = &r->rec[r->head % BL_TEL_RING_SIZE];
+    rec->t = t;
+    rec->bl = (unsigned short)bl;
+    rec->blth = (unsigned short)blth;
+    rec->std = (float)std;
+    r->head++;
+}
+
+//******************************************************************************
+//
+//  BL_Tel_File_Header_Set
+//
+//  Fill in the telemetry file header.
+//
+//  Parameters: struct BL_Tel_File_Header *h
+//              const char *sn (POPS serial number, cut to 11 characters)
+//              int est (BL_EST_ estimator)
+//              unsigned int window (baseline window, points)
+//              double th_mult (threshold multiplier)
+//
+//******************************************************************************
+
+void BL_Tel_File_Header_Set(struct BL_Tel_File_Header *h, const char *sn,
+    int est, unsigned int window, double th_mult)
+{
+    memset(h, 0, sizeof(*h));
+    memcpy(h->magic, BL_TEL_FILE_MAGIC, 4);
+    h->version = BL_TEL_FILE_VERSION;
+    h->header_bytes = sizeof(struct BL_Tel_File_Header);
+    h->rec_bytes = sizeof(struct BL_Tel_Rec);
+    h->est = (unsigned short)est;
+    h->window = window;
+    h->th_mult = (float)th_mult;
+    strncpy(h->pops_sn, sn, sizeof(h->pops_sn) - 1);
+}
+
+//******************************************************************************
+//
+//  BL_Tel_Write
+//
+//  Write the ring to the file, at most two contiguous pieces, and send it
+//  over UDP, each datagram a packet header and up to BL_TEL_PACKET_RECS
+//  records, then free it. A failed sendto only loses those datagrams.
+//
+//  Parameters: struct BL_Tel_Ring *r
+//              FILE *fp (telemetry file, opened for append, or NULL)
+//              const struct BL_Tel_File_Header *h (header for a new file)
+//              int fd (UDP socket, or -1)
+//              const void *addr, unsigned int addr_len (UDP destination)
+//
+//  Returns: int (updates taken out, -1 on a file write error)
+//
+//******************************************************************************
+
+int BL_Tel_Write(struct BL_Tel_Ring *r, FILE *fp,
+    const struct BL_Tel_File_Header *h, int fd, const void *addr,
+    unsigned int addr_len)
+{
+    struct {
+        struct BL_Tel_Packet p;
+        struct BL_Tel_Rec rec[BL_TEL_PACKET_RECS];
+    } pkt;
+    unsigned int head = r->head, out, pos, n, total = head - r->tail;
+    int ret = (int)total;
+
+    if (total == 0) return 0;
+
+    if (fp != NULL)
+    {
+        fseek(fp, 0, SEEK_END);
+        if (ftell(fp) == 0                  // new file
+            && fwrite(h, sizeof(*h), 1, fp) != 1) ret = -1;
+        for (out = r->tail; out != head && ret >= 0; out += n)
+        {
+            pos = out % BL_TEL_RING_SIZE;
+            n = BL_TEL_RING_SIZE - pos;     // contiguous to the end
+            if (n > head - out) n = head - out;
+            if (fwrite(&r->rec[pos], sizeof(struct BL_Tel_Rec), n, fp) != n)
+                ret = -1;
+        }
+    }
+
+    if (fd >= 0)
+    {
+        memcpy(pkt.p.magic, BL_TEL_FILE_MAGIC, 4);
+        pkt.p.rec_bytes = sizeof(struct BL_Tel_Rec);
+        pkt.p.lost = r->lost;
+        for (out = r->tail; out != head; out += n)
+        {
+            n = (head - out < BL_TEL_PACKET_RECS) ? head - out
+                : BL_TEL_PACKET_RECS;
+            for (pos = 0; pos < n; pos++)
+                pkt.rec[pos] = r->rec[(out + pos) % BL_TEL_RING_SIZE];
+            pkt.p.seq = out;
+            pkt.p.n = (unsigned short)n;
+            sendto(fd, &pkt, sizeof(pkt.p) + n*sizeof(struct BL_Tel_Rec), 0,
+                (const struct sockaddr *)addr, addr_len);
+        }
+    }
+
+    r->tail = head;
+    return ret;
+}
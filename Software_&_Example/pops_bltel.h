@@ -0,0 +1,73 @@
+// pops_bltel.h
+// Baseline and threshold telemetry for the POPS program.
+// Project: NOAA - POPS
+
+#ifndef _POPS_BLTEL_H_
+#define _POPS_BLTEL_H_
+
+#include <stdio.h>
+
+// Every Calc_Baseline update (about 1000 a second) is kept in a ring, and
+// once a second the ring is written to the telemetry file (BLTel_*.b) and,
+// optionally, sent over UDP. The ring is a fixed array, so recording an
+// update is a few stores and never allocates.
+//
+// Telemetry file: a struct BL_Tel_File_Header, then one struct BL_Tel_Rec for
+// each update. UDP: each datagram is a struct BL_Tel_Packet followed by n
+// records. All values are little endian, as written by the BBB.
+#define BL_TEL_FILE_MAGIC "POBT"
+#define BL_TEL_FILE_VERSION 1
+#define BL_TEL_RING_SIZE 4096               // updates, must be a power of 2
+#define BL_TEL_PACKET_RECS 64               // records in a UDP datagram
+
+struct BL_Tel_File_Header {                 // 32 bytes
+    char magic[4];                          // BL_TEL_FILE_MAGIC, no '\0'
+    unsigned short version;                 // BL_TEL_FILE_VERSION
+    unsigned short header_bytes;            // size of this header
+    unsigned short rec_bytes;               // size of struct BL_Tel_Rec
+    unsigned short est;                     // BL_EST_ estimator
+    unsigned int window;                    // baseline window, points
+    float th_mult;                          // BLTH = BL + th_mult * STD
+    char pops_sn[12];                       // instrument serial number
+};
+
+struct BL_Tel_Rec {                         // 16 bytes
+    double t;                               // s since 1970, PRU clock
+    unsigned short bl;                      // baseline sent to PRU1
+    unsigned short blth;                    // baseline + threshold sent
+    float std;                              // STD the threshold is from
+};
+
+struct BL_Tel_Packet {                      // 16 bytes
+    char magic[4];                          // BL_TEL_FILE_MAGIC
+    unsigned int seq;                       // updates recorded before these
+    unsigned short n;                       // records that follow
+    unsigned short rec_bytes;               // size of struct BL_Tel_Rec
+    unsigned int lost;                      // updates dropped so far
+};
+
+// The updates are added and taken out in the main loop, so no lock is needed.
+struct BL_Tel_Ring {
+    struct BL_Tel_Rec rec[BL_TEL_RING_SIZE];
+    unsigned int head;                      // updates added
+    unsigned int tail;                      // updates taken out
+    unsigned int lost;                      // dropped, the ring was full
+};
+
+// Record one update. Drops it, and counts it, if the ring is full.
+void BL_Tel_Add(struct BL_Tel_Ring *r, double t, unsigned int bl,
+    unsigned int blth, double std);
+
+// Fill in a file header.
+void BL_Tel_File_Header_Set(struct BL_Tel_File_Header *h, const char *sn,
+    int est, unsigned int window, double th_mult);
+
+// Append the updates in the ring to the file (NULL for none), with the file
+// header h when the file is empty, and send them in datagrams of up to
+// BL_TEL_PACKET_RECS to fd with sendto to addr (fd < 0 for none). Frees them.
+// Returns the number taken out, or -1 on a file write error.
+int BL_Tel_Write(struct BL_Tel_Ring *r, FILE *fp,
+    const struct BL_Tel_File_Header *h, int fd, const void *addr,
+    unsigned int addr_len);
+
+#endif // _POPS_BLTEL_H_
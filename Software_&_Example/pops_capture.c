@@ -0,0 +1,184 @@
+/*
+// Filename: pops_capture.c
+// Version: 1.0
+//
+// Project: NOAA - POPS
+//
+// Description - Continuous raw A/D capture for noise and pulse shape studies.
+// PRU1 writes every 4 MHz sample to a ring in DDR (the prussdrv extmem, or
+// the emulator file), and a thread here writes the ring to a file for a set
+// number of seconds. The file is written straight from the mapped ring, with
+// no copy in between. Samples PRU1 overwrites before they are written are
+// skipped and counted, as for the point buffer.
+//
+// See SOFTWARE DISCLAIMER.md.
+*/
+
+//******************************************************************************
+//
+// Include files:
+//
+//******************************************************************************
+
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <time.h>
+#include "pops_capture.h"
+
+//******************************************************************************
+//
+//  Capture_Write
+//
+//  Write the new samples, one or two contiguous pieces of the ring. If more
+//  than the ring less CAPTURE_SAFE samples are unread, the oldest are lost.
+//  PRU1 keeps writing during the write, so the count is read again after it
+//  and any samples it may have overwritten are counted as torn.
+//
+//  Parameters: struct Raw_Capture *c
+//
+//  Returns: unsigned int (samples written)
+//
+//******************************************************************************
+
+unsigned int Capture_Write(struct Raw_Capture *c)
+{
+    unsigned int count, avail, start, pos, n, total = 0;
+    ssize_t ret;
+
+    count = c->m->p1->raw_count;
+    __sync_synchronize();                   // count before the samples
+    avail = count - c->seq;
+    if (avail > c->ring - CAPTURE_SAFE)     // PRU1 has lapped the host
+    {
+        c->lost += avail - (c->ring - CAPTURE_SAFE);
+        c->seq = count - (c->ring - CAPTURE_SAFE);
+        avail = c->ring - CAPTURE_SAFE;
+    }
+    if (avail > c->want - c->samples) avail = c->want - c->samples;
+
+    start = c->seq;
+    while (avail > 0)
+    {
+        pos = c->seq & (c->ring - 1);
+        n = c->ring - pos;                  // contiguous to the end
+        if (n > avail) n = avail;
+        ret = write(c->fd, (const void *)(c->m->ddr + pos), 2*n);
+        if (ret <= 0)
+        {
+            c->err = errno;
+            break;
+        }
+        n = ret/2;
+        c->seq += n;
+        avail -= n;
+        total += n;
+    }
+    c->samples += total;
+
+    __sync_synchronize();
+    n = c->m->p1->raw_count - start;        // how far PRU1 got meanwhile
+    if (n > c->ring) c->torn += (n - c->ring < total) ? n - c->ring : total;
+    return total;
+}
+
+//******************************************************************************
+//
+//  Capture_Thread
+//
+//  Write the ring CAPTURE_READS times per ring time until the seconds are
+//  captured or the capture is stopped, then turn capture mode off.
+//
+//  Parameters: void *arg (struct Raw_Capture *)
+//
+//******************************************************************************
+
+static void *Capture_Thread(void *arg)
+{
+    struct Raw_Capture *c = (struct Raw_Capture *)arg;
+    struct timespec next;
+    long period;
+
+    period = (long)((1000000000ULL*c->ring)/CAPTURE_RATE/CAPTURE_READS);
+    clock_gettime(CLOCK_MONOTONIC, &next);
+    while (c->run && c->samples < c->want && c->err == 0)
+    {
+        Capture_Write(c);
+        next.tv_nsec += period;
+        while (next.tv_nsec >= 1000000000L)
+        {
+            next.tv_nsec -= 1000000000L;
+            next.tv_sec += 1;
+        }
+        clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &next, NULL);
+    }
+
+    c->m->p1->raw_bytes = 0;                // capture off
+    close(c->fd);
+    c->done = 1;
+    return NULL;
+}
+
+//******************************************************************************
+//
+//  Capture_Start
+//
+//  Open the file, turn PRU1 capture mode on and start the thread. PRU1 is
+//  not capturing, so its count is where the capture starts.
+//
+//  Parameters: struct Raw_Capture *c
+//              struct PRU_Mem *m (PRU memory with the DDR ring)
+//              const char *path (capture file)
+//              unsigned int seconds (seconds to capture)
+//
+//  Returns: int (0 ok, -1 running, -2 no DDR ring, -3 file, -4 thread)
+//
+//******************************************************************************
+
+int Capture_Start(struct Raw_Capture *c, struct PRU_Mem *m, const char *path,
+    unsigned int seconds)
+{
+    if (c->running) return -1;
+    memset(c, 0, sizeof(*c));
+    if (m->ddr == NULL || m->ddr_bytes/2 < 4*CAPTURE_SAFE) return -2;
+
+    c->m = m;
+    c->ring = m->ddr_bytes/2;
+    c->want = (unsigned long long)seconds*CAPTURE_RATE;
+    c->fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0666);
+    if (c->fd < 0) return -3;
+
+    c->seq = m->p1->raw_count;
+    m->p1->raw_ddr = m->ddr_phys;
+    __sync_synchronize();                   // address before the size
+    m->p1->raw_bytes = m->ddr_bytes;        // capture on
+
+    c->run = 1;
+    if (pthread_create(&c->thread, NULL, Capture_Thread, c) != 0)
+    {
+        m->p1->raw_bytes = 0;
+        close(c->fd);
+        return -4;
+    }
+    c->running = 1;
+    return 0;
+}
+
+//******************************************************************************
+//
+//  Capture_Stop
+//
+//  Stop the thread, which turns capture mode off, and wait for it.
+//
+//  Parameters: struct Raw_Capture *c
+//
+//******************************************************************************
+
+void Capture_Stop(struct Raw_Capture *c)
+{
+    if (!c->running) return;
+    c->run = 0;
+    pthread_join(c->thread, NULL);
+    c->running = 0;
+}
@@ -0,0 +1,48 @@
+// pops_capture.h
+// Continuous raw A/D capture from the PRU1 DDR ring for the POPS program.
+// Project: NOAA - POPS
+
+#ifndef _POPS_CAPTURE_H_
+#define _POPS_CAPTURE_H_
+
+#include <pthread.h>
+#include "pops_pru.h"
+
+// In capture mode PRU1 writes every A/D sample to the DDR raw ring
+// (PRU_Mem.ddr) and counts them (PRU1_Params.raw_count). A thread writes the
+// ring to a file of 16 bit little endian samples, the same format pru1model
+// reads. The samples are written from the mapped ring, with no copy.
+#define CAPTURE_RATE 4000000                // samples/s, the 4 MHz A/D
+#define CAPTURE_SAFE 8192                   // samples kept clear of PRU1
+#define CAPTURE_READS 4                     // ring reads per ring time
+
+struct Raw_Capture {
+    struct PRU_Mem *m;                      // PRU memory with the ring
+    int fd;                                 // capture file
+    unsigned int ring;                      // ring size, samples
+    unsigned int seq;                       // PRU1 samples read or lost
+    unsigned long long want;                // samples to capture
+    unsigned long long samples;             // samples written
+    unsigned long long lost;                // overwritten before written
+    unsigned long long torn;                // overwritten while written
+    int err;                                // errno of a failed write
+    volatile int run;                       // cleared to stop early
+    volatile int done;                      // thread finished
+    int running;                            // thread started
+    pthread_t thread;
+};
+
+// Start capturing seconds of samples to path.
+// Returns 0, -1 a capture is running, -2 no DDR ring, -3 the file could not
+// be opened, -4 the thread could not be started.
+int Capture_Start(struct Raw_Capture *c, struct PRU_Mem *m, const char *path,
+    unsigned int seconds);
+
+// Write the samples PRU1 has captured since the last call.
+// Returns the number written.
+unsigned int Capture_Write(struct Raw_Capture *c);
+
+// Stop the capture if it is running and wait for the thread.
+void Capture_Stop(struct Raw_Capture *c);
+
+#endif // _POPS_CAPTURE_H_
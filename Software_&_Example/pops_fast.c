@@ -0,0 +1,190 @@
+/*
+// Filename: pops_fast.c
+// Version: 1.0
+//
+// Project: NOAA - POPS
+//
+// Description - Sub-second histograms. The ingest thread bins the particles
+// into slices of 1/rate s by their peak times as it reads them, and the
+// main loop takes the closed slices for the fast HK file and UDP stream.
+// See pops_fast.h.
+//
+// See SOFTWARE DISCLAIMER.md.
+*/
+
+//******************************************************************************
+//
+// Include files:
+//
+//******************************************************************************
+
+#include <string.h>
+#include "pops_fast.h"
+
+//******************************************************************************
+//
+//  Fast_Init
+//
+//  Set the slice length, and the slice bin of each master bin.
+//
+//  Parameters: struct Fast *f
+//              unsigned int rate (slices per second)
+//              unsigned int master (bins of the master histogram)
+//              unsigned int nbins (bins of a slice)
+//
+//  Returns: int (0 ok, -1 bad rate or bins)
+//
+//******************************************************************************
+
+int Fast_Init(struct Fast *f, unsigned int rate, unsigned int master,
+    unsigned int nbins)
+{
+    unsigned int i;
+
+    if (rate == 0 || rate > FAST_RATE_MAX || PRU_CLOCK_HZ % rate != 0
+        || nbins == 0 || nbins > FAST_BINS_MAX || master % nbins != 0
+        || master > BIN_LUT_MAX_BINS) return -1;
+
+    memset(f, 0, sizeof(*f));
+    f->rate = rate;
+    f->nbins = nbins;
+    f->period = PRU_CLOCK_HZ/rate;
+    for (i = 0; i <= BIN_LUT_MAX_BINS; i++)
+        f->map[i] = (i < master) ? i/(master/nbins) : FAST_BINS_MAX;
+    return 0;
+}
+
+//******************************************************************************
+//
+//  Fast_Close
+//
+//  Put the open slice in the ring, or count it lost if the ring is full,
+//  and open the next one.
+//
+//  Parameters: struct Fast *f
+//
+//******************************************************************************
+
+static void Fast_Close(struct Fast *f)
+{
+    struct Fast_Rec *r;
+    unsigned int in = f->head;
+
+    if (in - f->tail < FAST_RING_SIZE)
+    {
+        r = &f->rec[in & (FAST_RING_SIZE - 1)];
+        r->t = PRU_Ring_Sec(f->end - f->period);
+        r->n = f->n;
+        memcpy(r->hist, f->hist, sizeof(r->hist));
+        __sync_synchronize();               // slice before the head
+        f->head = in + 1;
+    }
+    else f->lost++;
+
+    f->end += f->period;
+    f->n = 0;
+    memset(f->hist, 0, sizeof(f->hist));
+}
+
+//******************************************************************************
+//
+//  Fast_Time
+//
+//  Bring the open slice up to time t. The first time, or after a jump of
+//  more than the ring (the epoch was stepped), the slices start again from
+//  the one holding t, rather than filling the ring with empty ones.
+//
+//  Parameters: struct Fast *f
+//              unsigned long long t (absolute time, PRU cycles)
+//
+//******************************************************************************
+
+static void Fast_Time(struct Fast *f, unsigned long long t)
+{
+    if (f->end != 0 && t >= f->end
+        && t - f->end >= FAST_RING_SIZE*f->period)
+    {
+        Fast_Close(f);
+        f->steps++;
+        f->end = 0;
+    }
+    if (f->end == 0)
+    {
+        f->end = (t/f->period + 1)*f->period;
+        return;
+    }
+    while (t >= f->end) Fast_Close(f);
+}
+
+//******************************************************************************
+//
+//  Fast_Queue
+//
+//  Bin the new peaks into their slices. The peaks are in time order, so a
+//  peak past the end of the open slice closes it. A peak from before the
+//  open slice (the epoch was slewed back) is kept in it, and counted late.
+//
+//  Parameters: struct Fast *f
+//              const struct Bin_LUT *lut (master bin table)
+//              const struct Peak_Queue *q
+//              unsigned int from (q->head before the peaks were queued)
+//
+//******************************************************************************
+
+void Fast_Queue(struct Fast *f, const struct Bin_LUT *lut,
+    const struct Peak_Queue *q, unsigned int from)
+{
+    unsigned int pos, head = q->head;
+    unsigned long long t;
+
+    for (; from != head; from++)
+    {
+        pos = from & (PEAK_QUEUE_SIZE - 1);
+        t = q->t[pos];
+        if (t >= f->end) Fast_Time(f, t);
+        else if (t + f->period < f->end) f->late++;
+        f->hist[f->map[lut->bin[q->max[pos]]]]++;
+        f->n++;
+    }
+}
+
+//******************************************************************************
+//
+//  Fast_Advance
+//
+//  Close the slices every peak of which has been read.
+//
+//  Parameters: struct Fast *f
+//              unsigned long long now (absolute time, PRU cycles)
+//
+//******************************************************************************
+
+void Fast_Advance(struct Fast *f, unsigned long long now)
+{
+    if (now > FAST_MARGIN) Fast_Time(f, now - FAST_MARGIN);
+}
+
+//******************************************************************************
+//
+//  Fast_Get
+//
+//  Take the oldest closed slice.
+//
+//  Parameters: struct Fast *f
+//              struct Fast_Rec *r (copy of the slice)
+//
+//  Returns: int (1 a slice, 0 none)
+//
+//******************************************************************************
+
+int Fast_Get(struct Fast *f, struct Fast_Rec *r)
+{
+    unsigned int out = f->tail;
+
+    if (out == f->head) return 0;
+    __sync_synchronize();                   // head before the slice
+    *r = f->rec[out & (FAST_RING_SIZE - 1)];
+    __sync_synchronize();                   // done with the slice
+    f->tail = out + 1;
+    return 1;
+}
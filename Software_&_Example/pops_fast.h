@@ -0,0 +1,66 @@
+// pops_fast.h
+// Sub-second histograms and concentration for the POPS program.
+// Project: NOAA - POPS
+
+#ifndef _POPS_FAST_H_
+#define _POPS_FAST_H_
+
+#include "pops_bins.h"
+
+// The ingest thread cuts the particles into slices of 1/rate s by their
+// peak times, which are tied to gFullSec, so the slices start on whole
+// tenths (10 Hz), fifths (5 Hz) or halves (2 Hz) of a second. Each peak is
+// binned as for the 1 Hz histogram, through the master bin table and a
+// second small table to the fast bins, so nothing is binned again. A slice
+// is closed when a later peak is read, or when the IEP count passes its end
+// by FAST_MARGIN, so the slices with no particles are kept too. The closed
+// slices go through a ring to the main loop, which writes them to the fast
+// HK file and sends them over UDP.
+#define FAST_RING_SIZE 128                  // slices, must be a power of 2
+#define FAST_BINS_MAX 32                    // bins of a slice
+#define FAST_RATE_MAX 100                   // slices per second
+#define FAST_MARGIN (PRU_CLOCK_HZ/1000)     // 1 ms for a slice's last peaks
+
+struct Fast_Rec {                           // one slice
+    double t;                               // start, s since 1970
+    unsigned int n;                         // peaks in the slice
+    unsigned int hist[FAST_BINS_MAX];       // peaks in each bin
+};
+
+// Single producer/single consumer, as struct Peak_Queue. The open slice is
+// only touched by the ingest thread.
+struct Fast {
+    struct Fast_Rec rec[FAST_RING_SIZE];
+    volatile unsigned int head;             // slices closed (producer)
+    volatile unsigned int tail;             // slices taken (consumer)
+    volatile unsigned int lost;             // closed with the ring full
+    unsigned int late;                      // peaks older than their slice
+    unsigned int steps;                     // restarts after a time jump
+    unsigned int rate;                      // slices per second
+    unsigned int nbins;                     // bins of a slice
+    unsigned long long period;              // PRU cycles of a slice
+    unsigned long long end;                 // end of the open slice, 0 none
+    unsigned int n;                         // peaks in the open slice
+    unsigned int hist[FAST_BINS_MAX + 1];   // its bins, then no bin
+    unsigned char map[BIN_LUT_MAX_BINS + 1];    // slice bin of a master bin
+};
+
+// Set up rate slices a second of nbins bins, each a run of the master bins.
+// Returns 0, or -1 if the rate does not divide the PRU clock, is over
+// FAST_RATE_MAX, or nbins does not divide master.
+int Fast_Init(struct Fast *f, unsigned int rate, unsigned int master,
+    unsigned int nbins);
+
+// Producer: add the peaks queued from peak from up to q->head, binned by
+// lut, closing the slices they pass.
+void Fast_Queue(struct Fast *f, const struct Bin_LUT *lut,
+    const struct Peak_Queue *q, unsigned int from);
+
+// Producer: close the slices that ended FAST_MARGIN before now (absolute
+// time, PRU cycles, as Peak_Queue.t).
+void Fast_Advance(struct Fast *f, unsigned long long now);
+
+// Consumer: take the oldest closed slice. Returns 1, or 0 if there is none.
+int Fast_Get(struct Fast *f, struct Fast_Rec *r);
+
+#endif // _POPS_FAST_H_
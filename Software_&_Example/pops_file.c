@@ -0,0 +1,260 @@
+/*
+// Filename: pops_file.c
+// Version: 1.0
+//
+// Project: NOAA - POPS
+//
+// Description - Writes the peak file (Peak_*.b) for POPS_BBB.c, in the
+// version 1 format (12 byte records, dt in us) or the version 3 format
+// (8 byte records with the raw 5 ns cycle count, each second framed with its
+// length and a CRC32), and checks the frames for the readers. See
+// pops_file.h.
+//
+// See SOFTWARE DISCLAIMER.md.
+*/
+
+//******************************************************************************
+//
+// Include files:
+//
+//******************************************************************************
+
+#include <string.h>
+#include <stddef.h>
+#include "pops_file.h"
+#include "pops_store.h"
+
+//******************************************************************************
+//
+// Global variables:
+//
+//******************************************************************************
+
+struct Peaks gPeak_V1[PEAK_CHUNK];          // v1 records of one chunk
+struct Peak_Rec gPeak_V2[PEAK_CHUNK];       // v2 records of one chunk
+static unsigned int gCRC_Table[256];        // CRC32 of each byte value
+static int gCRC_Ready = 0;
+
+//******************************************************************************
+//
+//  Peak_File_Header_Set
+//
+//  Fill in the v3 file header.
+//
+//  Parameters: struct Peak_File_Header *h
+//              const char *sn (POPS serial number, cut to 11 characters)
+//
+//******************************************************************************
+
+void Peak_File_Header_Set(struct Peak_File_Header *h, const char *sn)
+{
+    memset(h, 0, sizeof(*h));
+    memcpy(h->magic, PEAK_FILE_MAGIC, 4);
+    h->version = PEAK_FILE_VERSION;
+    h->header_bytes = sizeof(struct Peak_File_Header);
+    h->sec_bytes = sizeof(struct Peak_Frame);
+    h->rec_bytes = sizeof(struct Peak_Rec);
+    h->clock_hz = PEAK_CLOCK_HZ;
+    h->cycle_offset = PEAK_CYCLE_OFFSET;
+    strncpy(h->pops_sn, sn, sizeof(h->pops_sn) - 1);
+}
+
+//******************************************************************************
+//
+//  Peak_File_Header_Check
+//
+//  Check the magic and version. A later version may make the headers and
+//  records longer, which a reader can skip using the sizes given.
+//
+//  Parameters: const struct Peak_File_Header *h
+//
+//  Returns: int (0 ok, -1 not a v2 file or sizes too small)
+//
+//******************************************************************************
+
+int Peak_File_Header_Check(const struct Peak_File_Header *h)
+{
+    if (memcmp(h->magic, PEAK_FILE_MAGIC, 4) != 0) return -1;
+    if (h->version < 2) return -1;
+    if (h->header_bytes < sizeof(struct Peak_File_Header)) return -1;
+    if (h->sec_bytes < sizeof(struct Peak_Sec)) return -1;
+    if (h->rec_bytes < sizeof(struct Peak_Rec)) return -1;
+    return 0;
+}
+
+//******************************************************************************
+//
+//  Peak_CRC32
+//
+//  CRC32 a byte at a time from a 256 entry table, made on the first call.
+//  The reflected 0xEDB88320 polynomial, with the CRC inverted before and
+//  after, so a CRC of 0 starts a new one and the result matches zlib.
+//
+//  Parameters: unsigned int crc (CRC so far, 0 to start)
+//              const void *buf, size_t len (bytes to add)
+//
+//  Returns: unsigned int (CRC)
+//
+//******************************************************************************
+
+unsigned int Peak_CRC32(unsigned int crc, const void *buf, size_t len)
+{
+    const unsigned char *p = (const unsigned char *)buf;
+    unsigned int c, i, k;
+
+    if (!gCRC_Ready)
+    {
+        for (i = 0; i < 256; i++)
+        {
+            c = i;
+            for (k = 0; k < 8; k++)
+                c = (c & 1) ? 0xEDB88320 ^ (c >> 1) : c >> 1;
+            gCRC_Table[i] = c;
+        }
+        gCRC_Ready = 1;
+    }
+    crc = ~crc;
+    while (len-- > 0)
+        crc = gCRC_Table[(crc ^ *p++) & 0xFF] ^ (crc >> 8);
+    return ~crc;
+}
+
+//******************************************************************************
+//
+//  Peak_Frame_Check
+//
+//  Check one v3 second: the sync word, that the length is the count times
+//  the record size and fits in the data left, and the CRC of the frame up
+//  to its crc and of the records. The frame is copied out, p need not be
+//  aligned.
+//
+//  Parameters: const unsigned char *p (start of the second)
+//              size_t avail (bytes from p to the end of the data)
+//              const struct Peak_File_Header *h (checked file header)
+//
+//  Returns: size_t (bytes of the second, 0 if it is bad or cut short)
+//
+//******************************************************************************
+
+size_t Peak_Frame_Check(const unsigned char *p, size_t avail,
+    const struct Peak_File_Header *h)
+{
+    struct Peak_Frame f;
+    unsigned int crc;
+
+    if (avail < h->sec_bytes || h->sec_bytes < sizeof(f)) return 0;
+    memcpy(&f, p, sizeof(f));
+    if (f.sec.sync != PEAK_SEC_SYNC) return 0;
+    if ((unsigned long long)f.sec.n*h->rec_bytes != f.bytes) return 0;
+    if (f.bytes > avail - h->sec_bytes) return 0;
+    crc = Peak_CRC32(0, p, offsetof(struct Peak_Frame, crc));
+    crc = Peak_CRC32(crc, p + h->sec_bytes, f.bytes);
+    if (crc != f.crc) return 0;
+    return h->sec_bytes + f.bytes;
+}
+
+//******************************************************************************
+//
+//  Peak_File_Write_V1
+//
+//  Write one second in the version 1 format. The cycles are converted to dt
+//  in us, divided by 200 MHz.
+//
+//  Parameters: FILE *fp (peak file, open for append)
+//              const struct Peak_Store *s (peaks of the second)
+//              double time (gFullSec)
+//
+//  Returns: int (0 ok, -1 write error)
+//
+//******************************************************************************
+
+int Peak_File_Write_V1(FILE *fp, const struct Peak_Store *s, double time)
+{
+    struct Peak_Chunk *c;
+    unsigned int i;
+    int err = 0;
+
+    if (fwrite(&s->n, sizeof(unsigned int), 1, fp) != 1) err = -1;
+    if (fwrite(&time, sizeof(double), 1, fp) != 1) err = -1;
+    for (c = s->first; c != NULL; c = c->next)  // a chunk at a time
+    {
+        for (i = 0; i < c->n; i++)
+        {
+            gPeak_V1[i].max = c->max[i];
+            gPeak_V1[i].w = c->w[i];
+            gPeak_V1[i].dt = (c->cycles[i] + PEAK_CYCLE_OFFSET)/200;
+        }
+        if (fwrite(gPeak_V1, sizeof(struct Peaks), c->n, fp) != c->n) err = -1;
+    }
+    return err;
+}
+
+//******************************************************************************
+//
+//  Peak_File_Write
+//
+//  Write one second in the version 3 format. The file header is written
+//  first if the file is empty. The second is timed from its first peak, the
+//  absolute time less the cycles since the peak before it. The frame comes
+//  before the records but its CRC covers them, so the records are made and
+//  added to the CRC a chunk at a time first, then made again to be written.
+//
+//  Parameters: FILE *fp (peak file, open for append)
+//              const struct Peak_Store *s (peaks of the second)
+//              double time (gFullSec)
+//              const char *sn (POPS serial number for the file header)
+//
+//  Returns: int (0 ok, -1 write error)
+//
+//******************************************************************************
+
+int Peak_File_Write(FILE *fp, const struct Peak_Store *s, double time,
+    const char *sn)
+{
+    struct Peak_File_Header h;
+    struct Peak_Frame f;
+    struct Peak_Chunk *c;
+    unsigned long long t;
+    unsigned int i, pass;
+    int err = 0;
+
+    fseek(fp, 0, SEEK_END);
+    if (ftell(fp) == 0)                         // new file
+    {
+        Peak_File_Header_Set(&h, sn);
+        if (fwrite(&h, sizeof(h), 1, fp) != 1) err = -1;
+    }
+
+    memset(&f, 0, sizeof(f));
+    f.sec.sync = PEAK_SEC_SYNC;
+    f.sec.n = s->n;
+    f.sec.time = time;
+    if (s->n > 0)
+    {
+        t = s->first->t[0] - s->first->cycles[0];
+        f.sec.time = (double)(t/PEAK_CLOCK_HZ)
+            + (double)(t % PEAK_CLOCK_HZ)/PEAK_CLOCK_HZ;
+    }
+    f.bytes = s->n*sizeof(struct Peak_Rec);
+    f.crc = Peak_CRC32(0, &f, offsetof(struct Peak_Frame, crc));
+
+    for (pass = 0; pass < 2; pass++)        // 0 the CRC, 1 the write
+    {
+        if (pass == 1 && fwrite(&f, sizeof(f), 1, fp) != 1) err = -1;
+        for (c = s->first; c != NULL; c = c->next)
+        {
+            for (i = 0; i < c->n; i++)
+            {
+                gPeak_V2[i].max = c->max[i];
+                gPeak_V2[i].w = c->w[i];
+                gPeak_V2[i].cycles = c->cycles[i];
+            }
+            if (pass == 0)
+                f.crc = Peak_CRC32(f.crc, gPeak_V2,
+                    c->n*sizeof(struct Peak_Rec));
+            else if (fwrite(gPeak_V2, sizeof(struct Peak_Rec), c->n, fp)
+                != c->n) err = -1;
+        }
+    }
+    return err;
+}
@@ -0,0 +1,92 @@
+// pops_file.h
+// Peak file (Peak_*.b) formats for the POPS program and ReadPeakFile.
+// Project: NOAA - POPS
+
+#ifndef _POPS_FILE_H_
+#define _POPS_FILE_H_
+
+#include <stdio.h>
+
+// Version 1 (POPS_BBB 2.0 to 3.3), no file header. Each second is
+//   unsigned int n, double time, then n records of struct Peaks.
+// Version 2, self-describing. A struct Peak_File_Header, then each second is
+//   a struct Peak_Sec followed by n records of struct Peak_Rec.
+// Version 3 (POPS_BBB 3.22), framed. As version 2, but each second starts
+//   with a struct Peak_Frame, a Peak_Sec with the length of the records and
+//   a CRC32 of the frame and records after it. A v2 reader skips the extra
+//   8 bytes using sec_bytes. A second cut short by a power loss, or damaged
+//   on the card, fails its CRC, and a reader can find the next one from its
+//   sync word (Peak_Frame_Check).
+// All values are little endian, as written by the BBB.
+#define PEAK_FILE_MAGIC "POPK"              // can not be a v1 particle count
+#define PEAK_FILE_VERSION 3
+#define PEAK_SEC_SYNC 0x43455350            // "PSEC" at the start of a second
+#define PEAK_CLOCK_HZ 200000000             // PRU IEP timer
+#define PEAK_CYCLE_OFFSET 0                 // cycles PRU1 misses per peak, 16
+                                            // before the IEP stamps (3.6)
+
+struct Peaks {                              // v1 record, dt in us
+    unsigned int max;
+    unsigned int w;
+    unsigned int dt;
+};
+
+struct Peak_File_Header {                   // v2 file header, 32 bytes
+    char magic[4];                          // PEAK_FILE_MAGIC, no '\0'
+    unsigned short version;                 // PEAK_FILE_VERSION
+    unsigned short header_bytes;            // size of this header
+    unsigned short sec_bytes;               // size of struct Peak_Sec, or
+                                            // of struct Peak_Frame (v3)
+    unsigned short rec_bytes;               // size of struct Peak_Rec
+    unsigned int clock_hz;                  // cycle counter frequency
+    unsigned int cycle_offset;              // add to cycles for the true dt
+    char pops_sn[12];                       // instrument serial number
+};
+
+struct Peak_Sec {                           // v2 second header, 16 bytes
+    unsigned int sync;                      // PEAK_SEC_SYNC
+    unsigned int n;                         // records in this second
+    double time;                            // time of the peak before the
+                                            // first, s since 1970, so time
+                                            // plus the sum of the dt is the
+                                            // time of each peak. gFullSec
+                                            // if there are no peaks.
+};
+
+struct Peak_Frame {                         // v3 second header, 24 bytes
+    struct Peak_Sec sec;                    // as v2
+    unsigned int bytes;                     // n times rec_bytes
+    unsigned int crc;                       // CRC32 of the frame to here
+                                            // and the records
+};
+
+struct Peak_Rec {                           // v2 record, 8 bytes
+    unsigned short max;                     // peak maximum above baseline
+    unsigned short w;                       // width, number of points
+    unsigned int cycles;                    // PRU cycles since last peak
+};
+
+// Fill in a v2 file header.
+void Peak_File_Header_Set(struct Peak_File_Header *h, const char *sn);
+
+// Check a v2 file header read from a file. Returns 0 if it is usable.
+int Peak_File_Header_Check(const struct Peak_File_Header *h);
+
+// Update a CRC32 (IEEE 802.3, as zlib) with len bytes. Start from 0.
+unsigned int Peak_CRC32(unsigned int crc, const void *buf, size_t len);
+
+// Check the v3 second that starts at p, with avail bytes to the end of the
+// data, for files with the header h. Returns the bytes of the second, frame
+// and records, or 0 if the sync, length or CRC are wrong or it is cut short.
+size_t Peak_Frame_Check(const unsigned char *p, size_t avail,
+    const struct Peak_File_Header *h);
+
+struct Peak_Store;                          // pops_store.h
+
+// Append one second to the peak file in the v1 or v3 format. The v3 file
+// header is written when the file is empty. Returns 0, or -1 on an error.
+int Peak_File_Write_V1(FILE *fp, const struct Peak_Store *s, double time);
+int Peak_File_Write(FILE *fp, const struct Peak_Store *s, double time,
+    const char *sn);
+
+#endif // _POPS_FILE_H_
@@ -0,0 +1,148 @@
+/*
+// Filename: pops_h2d.c
+// Version: 1.0
+//
+// Project: NOAA - POPS
+//
+// Description - 2D histogram of amplitude against width. The ingest thread
+// bins every peak in 2D as it bins it by size (pops_bins.c), and the 1 Hz
+// loop writes the cells with counts to the 2D file (H2D_*.b) and sends them
+// over UDP. See pops_h2d.h for the format.
+//
+// See SOFTWARE DISCLAIMER.md.
+*/
+
+//******************************************************************************
+//
+// Include files:
+//
+//******************************************************************************
+
+#include <string.h>
+#include <stddef.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include "pops_h2d.h"
+
+//******************************************************************************
+//
+//  H2D_File_Header_Set
+//
+//  Fill in the 2D file header.
+//
+//  Parameters: struct H2D_File_Header *h
+//              const struct H2D_Map *m (2D bins)
+//              double logmin, double logmax (amplitude range, log10(max))
+//              const double *edges (master bin edges, um, NULL log bins)
+//              unsigned int master (master bins)
+//              const char *sn (POPS serial number, cut to 11 characters)
+//
+//******************************************************************************
+
+void H2D_File_Header_Set(struct H2D_File_Header *h, const struct H2D_Map *m,
+    double logmin, double logmax, const double *edges, unsigned int master,
+    const char *sn)
+{
+    unsigned int i;
+
+    memset(h, 0, sizeof(*h));
+    memcpy(h->magic, H2D_FILE_MAGIC, 4);
+    h->version = H2D_FILE_VERSION;
+    h->header_bytes = offsetof(struct H2D_File_Header, edge);
+    h->amp_bins = (unsigned short)m->amp_bins;
+    h->width_bins = (unsigned short)m->width_bins;
+    h->width_max = (unsigned short)m->width_max;
+    h->count_bits = H2D_COUNT_BITS;
+    h->logmin = logmin;
+    h->logmax = logmax;
+    strncpy(h->pops_sn, sn, sizeof(h->pops_sn) - 1);
+    h->rec_bytes = sizeof(struct H2D_Rec);
+    h->cell_bytes = sizeof(unsigned int);
+    if (edges == NULL) return;
+
+    h->logmin = 0;                          // not log bins
+    h->logmax = 0;
+    h->edges = (unsigned short)(m->amp_bins + 1);
+    for (i = 0; i <= m->amp_bins; i++)      // a row is master/amp_bins bins
+        h->edge[i] = edges[i*(master/m->amp_bins)];
+    h->header_bytes += h->edges*sizeof(double);
+}
+
+//******************************************************************************
+//
+//  H2D_Write
+//
+//  Pack the cells with counts after the record, once for both the file and
+//  the datagram. Counts over H2D_COUNT_MAX are kept as H2D_COUNT_MAX.
+//
+//  Parameters: const struct H2D_Map *m (2D bins)
+//              const unsigned int *h2d (histogram, NULL for none)
+//              unsigned int n (peaks in the second)
+//              double t (s since 1970)
+//              FILE *fp (2D file, opened for append, NULL for none)
+//              const struct H2D_File_Header *h (written to a new file)
+//              int newh (write h again, the bins changed)
+//              int fd (UDP socket, < 0 for none)
+//              const void *addr, unsigned int addr_len (sendto address)
+//              unsigned int seq (seconds sent before)
+//
+//  Returns: int (cells written, -1 on a file write error)
+//
+//******************************************************************************
+
+int H2D_Write(const struct H2D_Map *m, const unsigned int *h2d,
+    unsigned int n, double t, FILE *fp, const struct H2D_File_Header *h,
+    int newh, int fd, const void *addr, unsigned int addr_len,
+    unsigned int seq)
+{
+    static struct {
+        struct H2D_Packet p;
+        struct H2D_Rec r;
+        unsigned int cell[H2D_CELLS_MAX];
+    } pkt;
+    unsigned int i, c, cells = 0, size;
+    int ret;
+
+    if (h2d != NULL)
+    {
+        size = m->amp_bins*m->width_bins;
+        for (i = 0; i < size; i++)
+        {
+            if ((c = h2d[i]) == 0) continue;
+            if (c > H2D_COUNT_MAX) c = H2D_COUNT_MAX;
+            pkt.cell[cells++] = (i << H2D_COUNT_BITS) | c;
+        }
+    }
+    pkt.r.t = t;
+    pkt.r.n = 0;
+    pkt.r.cells = 0;
+    pkt.r.sync = H2D_SYNC_HEADER;
+    ret = (int)cells;
+
+    if (fp != NULL)
+    {
+        fseek(fp, 0, SEEK_END);
+        if (ftell(fp) == 0) newh = 1;       // new file, the header only
+        else if (newh && fwrite(&pkt.r, sizeof(pkt.r), 1, fp) != 1) ret = -1;
+        if (newh && fwrite(h, h->header_bytes, 1, fp) != 1) ret = -1;
+    }
+
+    pkt.r.n = n;
+    pkt.r.cells = (unsigned short)cells;
+    pkt.r.sync = H2D_SYNC;
+    size = sizeof(pkt.r) + cells*sizeof(unsigned int);
+    if (fp != NULL && ret >= 0 && fwrite(&pkt.r, size, 1, fp) != 1) ret = -1;
+
+    if (fd >= 0)
+    {
+        memcpy(pkt.p.magic, H2D_FILE_MAGIC, 4);
+        pkt.p.seq = seq;
+        pkt.p.amp_bins = (unsigned short)m->amp_bins;
+        pkt.p.width_bins = (unsigned short)m->width_bins;
+        pkt.p.width_max = (unsigned short)m->width_max;
+        pkt.p.count_bits = H2D_COUNT_BITS;
+        sendto(fd, &pkt, sizeof(pkt.p) + size, 0,
+            (const struct sockaddr *)addr, addr_len);
+    }
+    return ret;
+}
@@ -0,0 +1,87 @@
+// pops_h2d.h
+// 2D histogram of amplitude against width for the POPS program.
+// Project: NOAA - POPS
+
+#ifndef _POPS_H2D_H_
+#define _POPS_H2D_H_
+
+#include <stdio.h>
+#include "pops_bins.h"
+
+// The ingest thread adds every peak to a 2D histogram of log10(max) against
+// width (struct Bin_Acc, struct H2D_Map), and once a second the 1 Hz loop
+// writes it to the 2D file (H2D_*.b) and, optionally, sends it over UDP.
+// Noise, coincident and real particles fall in different parts of it, so
+// they can be told apart on the ground without the peak file.
+//
+// 2D file: a struct H2D_File_Header, then for each second a struct H2D_Rec
+// followed by its cells. Only the cells with counts are kept, each as one
+// unsigned int, the cell (row*width_bins + column) in the high 12 bits and
+// the count, up to H2D_COUNT_MAX, in the low 20. UDP: each datagram is a
+// struct H2D_Packet followed by one second as in the file. All values are
+// little endian, as written by the BBB.
+//
+// The header is header_bytes long. With diameter bins (Setting.Diameter)
+// logmin and logmax are 0 and the amp_bins + 1 row edges follow, in um.
+// When the bins change (the logmin and logmax commands) a record with sync
+// H2D_SYNC_HEADER and no cells is written, then a new header for the
+// seconds after it. A second binned by the old table has no cells.
+#define H2D_FILE_MAGIC "PO2D"
+#define H2D_FILE_VERSION 2
+#define H2D_SYNC 0x2D32                     // "2-" at the start of a second
+#define H2D_SYNC_HEADER 0x4832              // "2H", a header follows
+#define H2D_COUNT_BITS 20
+#define H2D_COUNT_MAX ((1 << H2D_COUNT_BITS) - 1)
+
+struct H2D_File_Header {                    // 56 bytes, then the edges
+    char magic[4];                          // H2D_FILE_MAGIC, no '\0'
+    unsigned short version;                 // H2D_FILE_VERSION
+    unsigned short header_bytes;            // size of this header
+    unsigned short amp_bins;                // rows, log10(max)
+    unsigned short width_bins;              // columns, width
+    unsigned short width_max;               // points, the last column wider
+    unsigned short count_bits;              // H2D_COUNT_BITS
+    double logmin;                          // amplitude range, log10(max)
+    double logmax;
+    char pops_sn[12];                       // instrument serial number
+    unsigned short rec_bytes;               // size of struct H2D_Rec
+    unsigned short cell_bytes;              // size of a cell
+    unsigned short edges;                   // row edges that follow, 0 none
+    unsigned short spare[3];
+    double edge[H2D_AMP_MAX + 1];           // diameter of each row edge, um
+};
+
+struct H2D_Rec {                            // 16 bytes
+    double t;                               // s since 1970, end of the second
+    unsigned int n;                         // peaks in the second
+    unsigned short cells;                   // cells that follow
+    unsigned short sync;                    // H2D_SYNC
+};
+
+struct H2D_Packet {                         // 16 bytes
+    char magic[4];                          // H2D_FILE_MAGIC
+    unsigned int seq;                       // seconds sent before this one
+    unsigned short amp_bins;
+    unsigned short width_bins;
+    unsigned short width_max;
+    unsigned short count_bits;
+};
+
+// Fill in a file header, for log bins from logmin to logmax, or for
+// diameter bins with edges, the master + 1 master bin edges in um (NULL
+// for log bins).
+void H2D_File_Header_Set(struct H2D_File_Header *h, const struct H2D_Map *m,
+    double logmin, double logmax, const double *edges, unsigned int master,
+    const char *sn);
+
+// Append one second, the histogram h2d of n peaks (NULL if the second was
+// not closed), to the file (NULL for none), with the file header h when the
+// file is empty, or after a H2D_SYNC_HEADER record if newh is set, and send
+// it as datagram seq to fd with sendto to addr (fd < 0 for none). Returns
+// the number of cells, or -1 on a file write error.
+int H2D_Write(const struct H2D_Map *m, const unsigned int *h2d,
+    unsigned int n, double t, FILE *fp, const struct H2D_File_Header *h,
+    int newh, int fd, const void *addr, unsigned int addr_len,
+    unsigned int seq);
+
+#endif // _POPS_H2D_H_
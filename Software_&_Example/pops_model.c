@@ -0,0 +1,474 @@
+/*
+// Filename: pops_model.c
+// Version: 1.0
+//
+// Project: NOAA - POPS
+//
+// Description - Host model of the PRU1_All.p data loop: READ_BLTH,
+// CAPTURE, SNIPPET, CHECK_PT, STORE_BL, the jobs, PEAK_PT, CHECK_MAX,
+// WRITE_PK, SNIP_TRIG and OU_FLOW.
+// Each input sample is one DR cycle. The baseline buffer, the raw buffer,
+// the point buffer and the parameter block are written in the same order,
+// at the same addresses and with the same 16 bit wrap as the PRU code, so
+// the memory can be compared word for word with the PRU memory.
+//
+// The IEP stamp in a point record is the time of the sample that ended the
+// peak, taken from the input sample times. Each pass is counted in PRU
+// cycles, stretch by stretch of the code it runs (CY_ below), the way the
+// header of PRU1_All.p counts them. A pass longer than cycles_sample misses
+// the samples that come before it is done, as PRU1 would.
+//
+// Any change to PRU1_All.p must be made here too.
+//
+// See SOFTWARE DISCLAIMER.md.
+*/
+
+//******************************************************************************
+//
+// Include files:
+//
+//******************************************************************************
+
+#include <string.h>
+#include "pops_model.h"
+
+//******************************************************************************
+//
+// Definitions
+//
+//******************************************************************************
+
+#define POINT_START 0x00010000              // r6 restarts here
+#define POINT_END 0x00012FF8                // last record
+#define RAW_START 0x00002000                // r13 wraps at 0x2400
+#define SNIP_HOLD 0x8080                    // r4.w0 hold off, t15 and 128
+
+// Cycles of each stretch of PRU1_All.p: 1 an instruction, LBBO and LBCO 3
+// and SBBO 2, and 1 more for every 4 bytes past the first 4. WAIT_NDR1 and
+// WAIT_DR are counted as seeing their edge at once.
+#define CY_READ 16                          // READ_BLTH to the capture test
+#define CY_OU 8                             // READ_BLTH to OU_FLOW's test
+#define CY_OU_PEAK 2                        // OU_FLOW in a peak
+#define CY_CAPTURE 7                        // CAPTURE
+#define CY_CAPTURE_WRAP 2                   // and the DDR ring restarted
+#define CY_SNIP 4                           // SNIPPET, nothing waiting
+#define CY_SNIP_WAIT 3                      // one less sample to wait
+#define CY_SNIP_FREE 1                      // hold off over
+#define CY_SNIP_KEEP 7                      // SNIP_POST, slot kept
+#define CY_SNIP_LAST 1                      // and back to the first slot
+#define CY_SNIP_DROP 3                      // SNIP_POST, KEEP still waiting
+#define CY_CHECK_PEAK 1                     // CHECK_PT to PEAK_PT
+#define CY_CHECK_BL 2                       // CHECK_PT to STORE_BL or WRITE_PK
+#define CY_STORE_BL 10                      // STORE_BL
+#define CY_STORE_WRAP 3                     // and the buffer wrapped
+#define CY_PEAK_START 6                     // PEAK_PT, first point
+#define CY_PEAK_MORE 2                      // PEAK_PT to CHECK_MAX
+#define CY_MAX 3                            // CHECK_MAX
+#define CY_MAX_SET 1                        // SET_MAX
+#define CY_PK_SHORT 2                       // WRITE_PK, too few points
+#define CY_PK_LONG 3                        // WRITE_PK, too many points
+#define CY_PK 13                            // WRITE_PK, peak written
+#define CY_PK_WRAP 1                        // and the point buffer restarted
+#define CY_TRIG_WAIT 1                      // SNIP_TRIG, snippet waiting
+#define CY_TRIG_OFF 2                       // SNIP_TRIG, no snippets
+#define CY_TRIG_NOT_YET 4                   // SNIP_TRIG, not N peaks yet
+#define CY_TRIG 10                          // SNIP_TRIG, snippet started
+#define CY_JOBS 1                           // STORE_BL to JOBS
+#define CY_KEEP 14                          // QBBS, KEEP
+#define CY_BLOCK 16                         // 2 QBBS, BLOCK
+#define CY_PUB 10                           // 3 QBBS, PUB to the N test
+#define CY_PUB_N 1                          // the N peaks test
+#define CY_PUB_FILL 2                       // PUB_FILL
+#define CY_FILL 6                           // 4 QBBS, FILL to the level test
+#define CY_FILL_CMP 6                       // the unread bytes and compare
+#define CY_SEND 3                           // SEND_EVT
+#define CY_PARAM 16                         // 5 QBBS, PARAM
+#define CY_PARAM2 17                        // 5 QBBS, PARAM2, capture off
+#define CY_PARAM2_HOLD 2                    // capture on, snippets held off
+
+//******************************************************************************
+//
+//  Store_Half
+//
+//  SBBO of a 16 bit value to a byte address of a little endian word buffer.
+//
+//******************************************************************************
+
+static void Store_Half(volatile unsigned int *mem, unsigned int addr,
+    unsigned int v)
+{
+    volatile unsigned short *h = (volatile unsigned short *)mem;
+
+    h[addr >> 1] = (unsigned short)v;
+}
+
+//******************************************************************************
+//
+//  Load_Param
+//
+//  Job PARAM: the peak and notify parameters, half word loads.
+//
+//******************************************************************************
+
+static void Load_Param(struct PRU1_Model *s, const struct PRU1_Params *p1)
+{
+    s->min_pts = p1->peak_pts & 0xFFFF;
+    s->max_pts = p1->peak_pts >> 16;
+    s->notify_n = p1->notify_peaks & 0xFFFF;
+    s->notify_fill = p1->notify_fill & 0xFFFF;
+}
+
+//******************************************************************************
+//
+//  Load_Param2
+//
+//  Job PARAM2: the snippet parameters and the raw ring.
+//
+//******************************************************************************
+
+static void Load_Param2(struct PRU1_Model *s, const struct PRU1_Params *p1)
+{
+    s->snip_post = p1->snip_post & 0xFFFF;
+    s->snip_every = p1->snip_every & 0xFFFF;
+    s->ddr = p1->raw_ddr;
+    s->ddr_bytes = p1->raw_bytes;
+}
+
+//******************************************************************************
+//
+//  PRU1_Model_Block
+//
+//  Job BLOCK: record the sums since START at the block count modulo
+//  PRU_BL_RECS, and count the block. The host keeps the window.
+//
+//  Parameters: struct PRU_Mem *m
+//              unsigned int sum, unsigned long long sumsq (sums since START)
+//
+//******************************************************************************
+
+void PRU1_Model_Block(struct PRU_Mem *m, unsigned int sum,
+    unsigned long long sumsq)
+{
+    struct PRU1_Params *p1 = m->p1;
+    struct PRU_BL_Block *b;
+    unsigned int count = p1->bl_block_count;
+
+    b = &m->bl_block[count % PRU_BL_RECS];
+    b->sum = sum;
+    b->sumsq_lo = (unsigned int)sumsq;
+    b->sumsq_hi = (unsigned int)(sumsq >> 32);
+    p1->bl_block_count = count + 1;
+}
+
+//******************************************************************************
+//
+//  PRU1_Model_Init
+//
+//  The START code: registers to their initial values, IEP timer enabled,
+//  LOAD_PARAMS, LOAD_NOSTOP and SETPEAKPTR.
+//
+//  Parameters: struct PRU1_Model *s
+//              struct PRU_Mem *m (memory the model writes)
+//
+//******************************************************************************
+
+void PRU1_Model_Init(struct PRU1_Model *s, struct PRU_Mem *m)
+{
+    memset(s, 0, sizeof(*s));
+    s->point = POINT_START;
+    s->bl_ptr = 0;
+    s->raw_ptr = RAW_START;
+    s->snip_wait = SNIP_HOLD;
+    s->snip_ptr = PRU_SNIP_BASE;
+    s->cycles_sample = PRU1_CYCLES_SAMPLE;
+
+    Load_Param(s, m->p1);                   // LOAD_PARAMS
+    Load_Param2(s, m->p1);
+    Store_Half(&m->p1->stop, 0, 0);         // SBBO r19, r8, 0x0C, 2
+    m->p1->point_ptr = s->point;
+    m->p1->peak_count = s->count;
+    m->p1->raw_count = s->raw_count;
+    m->p1->snip_count = 0;
+    m->p1->bl_block_count = 0;
+}
+
+//******************************************************************************
+//
+//  PRU1_Model_Run
+//
+//  The data loop, one pass per sample. The labels of PRU1_All.p are kept as
+//  comments so the two can be read side by side. c counts the cycles of the
+//  pass.
+//
+//  Parameters: struct PRU1_Model *s
+//              struct PRU_Mem *m (memory the model writes)
+//              const unsigned int *in (samples and PRU1_IN_ flags)
+//              unsigned int n (number of samples)
+//
+//  Returns: unsigned int (samples used)
+//
+//******************************************************************************
+
+unsigned int PRU1_Model_Run(struct PRU1_Model *s, struct PRU_Mem *m,
+    const unsigned int *in, unsigned int n)
+{
+    struct PRU1_Params *p1 = m->p1;
+    unsigned int i, x, c, bl, blth, desc, unread;
+
+    if (s->halted) return 0;
+    for (i = 0; i < n; i++, s->t += s->cycles_sample)
+    {
+        if (s->skip != 0)                   // the last pass ran over
+        {
+            s->skip--;
+            s->missed++;
+            continue;
+        }
+
+        // READ_BLTH, BL and BLTH in one word
+        bl = p1->bl_blth & 0xFFFF;
+        blth = p1->bl_blth >> 16;
+
+        // WAIT_DR
+        if (in[i] & PRU1_IN_STOP)           // END
+        {
+            p1->point_ptr = s->point;
+            p1->peak_count = s->count;
+            Store_Half(&p1->stop, 0, 0xFFFF);
+            s->events++;
+            PRU_Mem_Event(m);
+            s->halted = 1;
+            *m->iep = (unsigned int)s->t;
+            return i;
+        }
+        if (in[i] & PRU1_IN_OU)             // OU_FLOW
+        {
+            c = CY_OU;
+            if (!s->in_peak) goto NEXT;
+            c += CY_OU_PEAK;
+            x = 0xFFFF;
+            goto CHECK_MAX;
+        }
+        x = in[i] & 0xFFFF;
+        Store_Half(m->raw, s->raw_ptr - RAW_START, x);
+        s->raw_ptr = (s->raw_ptr + 2) & ~0x400u;
+        c = CY_READ;
+
+        if (s->ddr_bytes != 0)              // CAPTURE
+        {
+            m->ddr[(s->ddr - m->ddr_phys + s->ddr_off) >> 1] =
+                (unsigned short)x;
+            s->ddr_off += 2;
+            s->raw_count++;
+            p1->raw_count = s->raw_count;
+            c += CY_CAPTURE;
+            if (s->ddr_off >= s->ddr_bytes)
+            {
+                s->ddr_off = 0;
+                c += CY_CAPTURE_WRAP;
+            }
+        }
+        else                                // SNIPPET, a ring of 256 bytes
+        {
+            Store_Half(m->bl, s->snip_ptr, x);
+            s->snip_ptr = (s->snip_ptr & ~0xFFu) | ((s->snip_ptr + 2) & 0xFF);
+            c += CY_SNIP;
+            if (s->snip_wait != 0)
+            {
+                s->snip_wait--;
+                c += CY_SNIP_WAIT;
+                if (s->snip_wait & 0x8000)  // hold off
+                {
+                    if ((s->snip_wait & 0xFF) == 0)
+                    {
+                        s->snip_wait = 0;
+                        c += CY_SNIP_FREE;
+                    }
+                }
+                else if (s->snip_wait == 0) // SNIP_POST
+                {
+                    if (s->jobs & PRU1_JOB_KEEP) c += CY_SNIP_DROP;
+                    else
+                    {
+                        s->kept = s->snip_ptr & 0xFFFF;
+                        s->jobs |= PRU1_JOB_KEEP;
+                        s->snip_ptr += PRU_SNIP_SLOT_BYTES;
+                        c += CY_SNIP_KEEP;
+                        if (s->snip_ptr >= PRU_SNIP_BASE
+                            + PRU_SNIP_SLOTS*PRU_SNIP_SLOT_BYTES)
+                        {
+                            s->snip_ptr -= PRU_SNIP_SLOTS*PRU_SNIP_SLOT_BYTES;
+                            c += CY_SNIP_LAST;
+                        }
+                    }
+                    s->snip_wait = SNIP_HOLD;   // SNIP_HOLD
+                }
+            }
+        }
+
+        // CHECK_PT
+        if (x >= blth)
+        {
+            // PEAK_PT
+            c += CY_CHECK_PEAK;
+            x = (x - bl) & 0xFFFF;
+            if (s->in_peak)
+            {
+                c += CY_PEAK_MORE;
+                goto CHECK_MAX;
+            }
+            s->in_peak = 1;
+            s->max = x;
+            s->width = 1;
+            c += CY_PEAK_START;
+            goto NEXT;
+        }
+        c += CY_CHECK_BL;
+        if (s->in_peak) goto WRITE_PK;
+
+        // STORE_BL, the sums since START only ever gain a point
+        if (s->jobs != 0) goto JOBS;
+        Store_Half(m->bl, s->bl_ptr, x);
+        s->bl_sum += x;
+        s->bl_sumsq += x*x;
+        s->bl_ptr = (s->bl_ptr + 2) & ~0x400u;
+        c += CY_STORE_BL;
+        if (s->bl_ptr == 0)
+        {
+            s->jobs |= PRU1_JOB_BLOCK | PRU1_JOB_PARAM | PRU1_JOB_PARAM2;
+            c += CY_STORE_WRAP;
+        }
+        goto NEXT;
+
+CHECK_MAX:
+        s->width = (s->width + 1) & 0xFFFF;
+        c += CY_MAX;
+        if (x > s->max)                     // SET_MAX
+        {
+            s->max = x;
+            c += CY_MAX_SET;
+        }
+        goto NEXT;
+
+WRITE_PK:
+        s->in_peak = 0;
+        if (s->width < s->min_pts)
+        {
+            c += CY_PK_SHORT;
+            goto NEXT;
+        }
+        if (s->width > s->max_pts)
+        {
+            c += CY_PK_LONG;
+            goto NEXT;
+        }
+        s->stamp = (unsigned int)s->t;
+        m->ring[(s->point - POINT_START) >> 2] = (s->width << 16) | s->max;
+        m->ring[((s->point - POINT_START) >> 2) + 1] = s->stamp;
+        s->point += 8;
+        s->count++;
+        s->jobs |= PRU1_JOB_PUB;
+        c += CY_PK;
+        if (s->point > POINT_END)
+        {
+            s->point = POINT_START;
+            c += CY_PK_WRAP;
+        }
+
+        // SNIP_TRIG
+        if (s->snip_wait != 0)
+        {
+            c += CY_TRIG_WAIT;
+            goto NEXT;
+        }
+        if (s->snip_every == 0)
+        {
+            c += CY_TRIG_OFF;
+            goto NEXT;
+        }
+        s->snip_since = (s->snip_since + 1) & 0xFFFF;
+        if (s->snip_since < s->snip_every)
+        {
+            c += CY_TRIG_NOT_YET;
+            goto NEXT;
+        }
+        s->snip_since = 0;
+        desc = 0x400 + ((s->snip_ptr >> 4) & ~0xFu);
+        m->bl[desc >> 2] = (s->width << 16) | s->max;
+        m->bl[(desc >> 2) + 1] = s->stamp;
+        s->snip_wait = s->snip_post;
+        c += CY_TRIG;
+        goto NEXT;
+
+JOBS:                                       // one in place of the point
+        c += CY_JOBS;
+        if (s->jobs & PRU1_JOB_KEEP)
+        {
+            s->jobs &= ~PRU1_JOB_KEEP;
+            desc = 0x400 + ((s->kept >> 4) & ~0xFu);
+            m->bl[(desc >> 2) + 2] = s->kept;
+            p1->snip_count = p1->snip_count + 1;
+            c += CY_KEEP;
+        }
+        else if (s->jobs & PRU1_JOB_BLOCK)
+        {
+            s->jobs &= ~PRU1_JOB_BLOCK;
+            PRU1_Model_Block(m, s->bl_sum, s->bl_sumsq);
+            c += CY_BLOCK;
+        }
+        else if (s->jobs & PRU1_JOB_PUB)
+        {
+            s->jobs &= ~PRU1_JOB_PUB;
+            p1->point_ptr = s->point;
+            p1->peak_count = s->count;
+            c += CY_PUB;
+            if (s->notify_n != 0)
+            {
+                c += CY_PUB_N;
+                if (s->count - s->last_event >= s->notify_n) goto SEND_EVT;
+            }
+            s->jobs |= PRU1_JOB_FILL;       // PUB_FILL
+            c += CY_PUB_FILL;
+        }
+        else if (s->jobs & PRU1_JOB_FILL)
+        {
+            s->jobs &= ~PRU1_JOB_FILL;
+            c += CY_FILL;
+            if (s->notify_fill == 0) goto NEXT;
+            c += CY_FILL_CMP;
+            unread = (s->count - p1->host_count) << 3;
+            if (unread < s->notify_fill) goto NEXT;
+            goto SEND_EVT;
+        }
+        else if (s->jobs & PRU1_JOB_PARAM)
+        {
+            s->jobs &= ~PRU1_JOB_PARAM;
+            Load_Param(s, p1);
+            c += CY_PARAM;
+        }
+        else                                // PARAM2
+        {
+            s->jobs &= ~PRU1_JOB_PARAM2;
+            Load_Param2(s, p1);
+            c += CY_PARAM2;
+            if (s->ddr_bytes != 0)
+            {
+                s->snip_wait = SNIP_HOLD;
+                c += CY_PARAM2_HOLD;
+            }
+        }
+        goto NEXT;
+
+SEND_EVT:
+        s->last_event = s->count;
+        s->events++;
+        PRU_Mem_Event(m);
+        c += CY_SEND;
+
+NEXT:
+        if (c > s->cycles_max) s->cycles_max = c;
+        s->skip = (c - 1)/s->cycles_sample; // samples gone by meanwhile
+    }
+    *m->iep = (unsigned int)s->t;           // the IEP timer runs on
+    return n;
+}
@@ -0,0 +1,84 @@
+// pops_model.h
+// Host model of the PRU1_All.p peak state machine.
+// Project: NOAA - POPS
+
+#ifndef _POPS_MODEL_H_
+#define _POPS_MODEL_H_
+
+#include "pops_pru.h"
+
+// Input samples: bits 0-15 the 16 bit A/D value, and the R31 flags PRU1
+// branches on. PRU1 takes OU_FLOW when R31.t9 is set and END when R31.t11
+// is clear, here both are active high.
+#define PRU1_IN_OU 0x00010000               // over/under flow (R31.t9)
+#define PRU1_IN_STOP 0x00020000             // stop input (R31.t11 low)
+
+// Cycles between A/D samples, 200 MHz / 4 MHz. Each pass of the data loop
+// is counted in PRU cycles from the code it runs (see pops_model.c), and a
+// pass longer than this misses the samples that come before it is done.
+#define PRU1_CYCLES_SAMPLE 50
+
+// Jobs left for the baseline points (r5.b1), see PRU1_All.p.
+#define PRU1_JOB_KEEP 0x01                  // r5.t8 kept snippet slot
+#define PRU1_JOB_BLOCK 0x02                 // r5.t9 baseline block record
+#define PRU1_JOB_PUB 0x04                   // r5.t10 pointer and peak count
+#define PRU1_JOB_FILL 0x08                  // r5.t11 fill level event
+#define PRU1_JOB_PARAM 0x10                 // r5.t12 peak and notify params
+#define PRU1_JOB_PARAM2 0x20                // r5.t13 snippet and raw ring
+
+// PRU1 registers kept between samples, named for the registers they model.
+struct PRU1_Model {
+    unsigned int max;                       // r2.w0 peak maximum
+    unsigned int width;                     // r2.w2 peak width
+    unsigned int stamp;                     // r3 IEP stamp of the peak
+    unsigned int snip_wait;                 // r4.w0 snippet samples to wait
+    unsigned int snip_since;                // r4.w2 peaks since the snippet
+    unsigned int in_peak;                   // r5.t0
+    unsigned int jobs;                      // r5.b1 PRU1_JOB_ flags
+    unsigned int kept;                      // r5.w2 oldest sample, kept slot
+    unsigned int point;                     // r6 point pointer
+    unsigned int bl_ptr;                    // r7 baseline pointer
+    unsigned int min_pts;                   // r9.w0 min points per peak
+    unsigned int max_pts;                   // r9.w2 max points per peak
+    unsigned int notify_n;                  // r10.w0 event every N peaks
+    unsigned int snip_post;                 // r10.w2 snippet post samples
+    unsigned int notify_fill;               // r11.w0 event at fill bytes
+    unsigned int snip_every;                // r11.w2 snippet every N peaks
+    unsigned int snip_ptr;                  // r12 snippet slot pointer
+    unsigned int raw_ptr;                   // r13 raw pointer (PRU0 DRAM)
+    unsigned int ddr;                       // r14 raw ring address (DDR)
+    unsigned int ddr_bytes;                 // r15 raw ring size, 0 = off
+    unsigned int bl_sum;                    // r16 baseline sum since START
+    unsigned long long bl_sumsq;            // r17, r18 sum of squares
+    unsigned int ddr_off;                   // r22 raw ring offset (DDR)
+    unsigned int raw_count;                 // r23 raw samples captured
+    unsigned int last_event;                // r24 peak count at the event
+    unsigned int count;                     // r25 peak count
+    unsigned long long t;                   // IEP time of the next sample
+    unsigned int cycles_sample;             // cycles per input sample
+    unsigned int cycles_max;                // longest pass, cycles
+    unsigned int skip;                      // samples the last pass ran over
+    unsigned int missed;                    // samples missed, total
+    unsigned int halted;                    // END reached
+    unsigned int events;                    // PRU_EVTOUT_1 sent
+};
+
+// START: set the registers, read the parameters and write the stop,
+// pointer, count and block count words.
+// The host writes the parameter block first, as on the BBB.
+void PRU1_Model_Init(struct PRU1_Model *s, struct PRU_Mem *m);
+
+// Run n samples through the data loop, writing the baseline, raw and point
+// buffers, the DDR raw ring, the snippet slots, the baseline block records
+// and the parameter block of m exactly as PRU1 does. Events go to
+// PRU_Mem_Event. The IEP count (m->iep) is left at the time of the next
+// sample. Returns the samples used, fewer than n if END is reached.
+unsigned int PRU1_Model_Run(struct PRU1_Model *s, struct PRU_Mem *m,
+    const unsigned int *in, unsigned int n);
+
+// Job BLOCK: record the baseline sums since START at the end of a block and
+// count it. Also used by the feeder (PRU_Feed.c).
+void PRU1_Model_Block(struct PRU_Mem *m, unsigned int sum,
+    unsigned long long sumsq);
+
+#endif // _POPS_MODEL_H_
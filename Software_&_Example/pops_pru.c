@@ -0,0 +1,831 @@
+/*
+// Filename: pops_pru.c
+// Version: 1.0
+//
+// Project: NOAA - POPS
+//
+// Description - Access to the PRU memory used by POPS_BBB.c. The particle
+// point buffer written by PRU1 is decoded here directly from the mapped
+// shared RAM, without first copying it to the stack. The decoded peaks are
+// handed from the ingest thread to the 1 Hz loop through a lock-free single
+// producer/single consumer queue.
+//
+// PRU1 stamps each peak from the free-running IEP timer. The stamps are
+// extended to 64 bits here and tied to the host clock, which gives each peak
+// an absolute time and the exact cycles since the peak before it.
+//
+// The PRU memory is mapped through PRU_Mem, from prussdrv on the BBB or from
+// an emulator file written by PRU_Feed, so the host side runs on any Linux.
+//
+// See SOFTWARE DISCLAIMER.md.
+*/
+
+//******************************************************************************
+//
+// Include files:
+//
+//******************************************************************************
+
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <time.h>
+#include <sys/mman.h>
+#ifndef PRU_EMU_ONLY
+#include <prussdrv.h>
+#include <pruss_intc_mapping.h>
+#endif
+#include "pops_pru.h"
+
+//******************************************************************************
+//
+//  PRU_Ring_Index
+//
+//  Convert the PRU1 point pointer to a word index of the shared RAM.
+//  PRU1 writes the pointer before it wraps, so the end of the buffer
+//  (0x00013000) is the same as the start.
+//
+//  Parameters: unsigned int ptr (PRU address of the next peak to be written)
+//
+//  Returns: unsigned int (word index, 0..PRU_RING_WORDS-1)
+//
+//******************************************************************************
+
+unsigned int PRU_Ring_Index(unsigned int ptr)
+{
+    unsigned int m;
+
+    m = (ptr - PRU_RING_BASE) >> 2;         // bytes to words
+    if (m >= PRU_RING_WORDS) m -= PRU_RING_WORDS;
+    return m;
+}
+
+//******************************************************************************
+//
+//  PRU_Ring_Decode
+//
+//  Decode the peaks between head and tail. The unread span is one or two
+//  contiguous pieces of the buffer, and each is read once, in place.
+//  The IEP stamp is kept raw, PRU_Ring_Time turns it into times.
+//
+//  Parameters: const volatile unsigned int *ring (mapped point buffer)
+//              unsigned int head (first word to read)
+//              unsigned int tail (word after the last one to read)
+//              unsigned short *max, *w (peak max and width columns)
+//              unsigned int *cycles (IEP stamp column)
+//              unsigned int room (space left in the columns)
+//
+//  Returns: unsigned int (number of peaks decoded)
+//
+//******************************************************************************
+
+unsigned int PRU_Ring_Decode(const volatile unsigned int *ring,
+    unsigned int head, unsigned int tail, unsigned short *max,
+    unsigned short *w, unsigned int *cycles, unsigned int room)
+{
+    unsigned int n = 0, end, word;
+
+    while (head != tail && n < room)
+    {
+        end = (tail > head) ? tail : PRU_RING_WORDS;    // piece to the wrap
+        for (; head + 1 < end && n < room; head += PRU_RING_REC_WORDS)
+        {
+            word = ring[head];
+            max[n] = (unsigned short)(word & 0x0000FFFF);
+            w[n] = (unsigned short)(word >> 16);
+            cycles[n] = ring[head + 1];
+            n++;
+        }
+        if (head + 1 >= end) head = (end == PRU_RING_WORDS) ? 0 : tail;
+    }
+    return n;
+}
+
+//******************************************************************************
+//
+//  PRU_Ring_Time
+//
+//  Replace the IEP stamps of n decoded peaks with the cycles since the peak
+//  before, and write their absolute times. A stamp is never newer than the
+//  last IEP read, so it is extended back from it. Cycles that do not fit 32
+//  bits, or a peak from before the first read, are 0xFFFFFFFF.
+//
+//  Parameters: struct PRU_Ring *r (host read state)
+//              unsigned int *cycles (IEP stamps in, cycles since last out)
+//              unsigned long long *t (absolute time column)
+//              unsigned int n (number of peaks)
+//
+//******************************************************************************
+
+static void PRU_Ring_Time(struct PRU_Ring *r, unsigned int *cycles,
+    unsigned long long *t, unsigned int n)
+{
+    unsigned long long stamp, dt;
+    unsigned int i;
+
+    for (i = 0; i < n; i++)
+    {
+        stamp = r->now - (unsigned int)((unsigned int)r->now - cycles[i]);
+        dt = stamp - r->last;               // wraps if before r->last
+        cycles[i] = (dt > 0xFFFFFFFFull) ? 0xFFFFFFFF : (unsigned int)dt;
+        r->last = stamp;
+        t[i] = stamp - r->epoch;
+    }
+}
+
+//******************************************************************************
+//
+//  PRU_Ring_Queue
+//
+//  Decode the point buffer straight into the free space of the queue. The
+//  free space is at most two contiguous pieces (before and after the end
+//  of the queue arrays). The new peaks are published by moving head after
+//  a memory barrier, so the consumer never sees a half written peak.
+//
+//  Parameters: const volatile unsigned int *ring (mapped point buffer)
+//              unsigned int head (first word to read)
+//              unsigned int tail (word after the last one to read)
+//              struct PRU_Ring *r (host read state, for the peak times)
+//              struct Peak_Queue *q (queue to fill)
+//
+//  Returns: unsigned int (new head word of the point buffer)
+//
+//******************************************************************************
+
+unsigned int PRU_Ring_Queue(const volatile unsigned int *ring,
+    unsigned int head, unsigned int tail, struct PRU_Ring *r,
+    struct Peak_Queue *q)
+{
+    unsigned int in, pos, room, n;
+
+    in = q->head;
+    __sync_synchronize();                   // see the consumer's last tail
+    room = PEAK_QUEUE_SIZE - (in - q->tail);
+
+    while (head != tail && room > 0)
+    {
+        pos = in & (PEAK_QUEUE_SIZE - 1);
+        n = PEAK_QUEUE_SIZE - pos;          // contiguous to the end
+        if (n > room) n = room;
+        n = PRU_Ring_Decode(ring, head, tail, q->max + pos, q->w + pos,
+            q->cycles + pos, n);
+        if (n == 0) break;
+        PRU_Ring_Time(r, q->cycles + pos, q->t + pos, n);
+        head += n*PRU_RING_REC_WORDS;
+        if (head >= PRU_RING_WORDS) head -= PRU_RING_WORDS;
+        in += n;
+        room -= n;
+    }
+
+    __sync_synchronize();                   // data before the index
+    q->head = in;
+    return head;
+}
+
+//******************************************************************************
+//
+//  Peak_Queue_Get
+//
+//  Move peaks from the queue to the column arrays, oldest first.
+//
+//  Parameters: struct Peak_Queue *q (queue to empty)
+//              unsigned short *max, *w (peak max and width columns)
+//              unsigned int *cycles (cycle count column)
+//              unsigned long long *t (absolute time column)
+//              unsigned int room (space left in the columns)
+//
+//  Returns: unsigned int (number of peaks moved)
+//
+//******************************************************************************
+
+unsigned int Peak_Queue_Get(struct Peak_Queue *q, unsigned short *max,
+    unsigned short *w, unsigned int *cycles, unsigned long long *t,
+    unsigned int room)
+{
+    unsigned int out, count, pos, n, total = 0;
+
+    out = q->tail;
+    count = q->head - out;
+    __sync_synchronize();                   // index before the data
+    if (count > room) count = room;
+
+    while (count > 0)
+    {
+        pos = out & (PEAK_QUEUE_SIZE - 1);
+        n = PEAK_QUEUE_SIZE - pos;
+        if (n > count) n = count;
+        memcpy(max + total, q->max + pos, n*sizeof(*max));
+        memcpy(w + total, q->w + pos, n*sizeof(*w));
+        memcpy(cycles + total, q->cycles + pos, n*sizeof(*cycles));
+        memcpy(t + total, q->t + pos, n*sizeof(*t));
+        out += n;
+        total += n;
+        count -= n;
+    }
+
+    __sync_synchronize();                   // done with the data
+    q->tail = out;
+    return total;
+}
+
+//******************************************************************************
+//
+//  Peak_Queue_Flush
+//
+//  Drop the queue up to a head the producer has passed, so the peaks
+//  queued after it are kept.
+//
+//  Parameters: struct Peak_Queue *q (queue to empty)
+//              unsigned int head (peaks written, q->head or an earlier one)
+//
+//  Returns: unsigned int (number of peaks dropped)
+//
+//******************************************************************************
+
+unsigned int Peak_Queue_Flush(struct Peak_Queue *q, unsigned int head)
+{
+    unsigned int n;
+
+    n = head - q->tail;
+    if (n > q->head - q->tail) return 0;    // not a head of this queue
+    __sync_synchronize();
+    q->tail = head;
+    return n;
+}
+
+//******************************************************************************
+//
+//  PRU_Ring_Now
+//
+//  Extend a new IEP count forward from the last one. The first count also
+//  starts the time of the last peak, so the first peak read has a dt.
+//
+//  Parameters: struct PRU_Ring *r (host read state)
+//              unsigned int cnt (IEP count)
+//
+//******************************************************************************
+
+static void PRU_Ring_Now(struct PRU_Ring *r, unsigned int cnt)
+{
+    r->now += (unsigned int)(cnt - (unsigned int)r->now);
+    if (r->last == 0) r->last = r->now;     // first read
+}
+
+//******************************************************************************
+//
+//  PRU_Ring_Read
+//
+//  Read the new peaks using the PRU1 peak count. If more than PRU_RING_SAFE
+//  peaks are unread the oldest ones are already overwritten, or about to be,
+//  so they are skipped and counted as lost. The count is 32 bits and wraps,
+//  the unsigned subtraction handles that. 1536 records do not divide 2^32,
+//  so the position in the buffer is kept as well, moved on by the same
+//  number of records, not taken from the count. The high water is the
+//  unread peaks, at most the whole buffer when PRU1 has lapped the host.
+//
+//  The IEP count is read after the peak count, so it is newer than every
+//  stamp being read, and is extended forward from the last read. This is
+//  done on every call, with or without peaks, to follow the wraps.
+//
+//  Parameters: const volatile unsigned int *ring (mapped point buffer)
+//              unsigned int count (PRU1 peak count)
+//              const volatile unsigned int *iep (IEP count register)
+//              struct PRU_Ring *r (host read state)
+//              struct Peak_Queue *q (queue to fill)
+//
+//  Returns: unsigned int (number of peaks queued)
+//
+//******************************************************************************
+
+unsigned int PRU_Ring_Read(const volatile unsigned int *ring,
+    unsigned int count, const volatile unsigned int *iep, struct PRU_Ring *r,
+    struct Peak_Queue *q)
+{
+    unsigned int avail, head, tail, n, high;
+
+    __sync_synchronize();                   // peak count before the IEP count
+    PRU_Ring_Now(r, *iep);
+
+    avail = count - r->seq;
+    if (avail == 0) return 0;
+    n = (avail < PRU_RING_RECS) ? avail : PRU_RING_RECS;
+    do                                      // the 1 Hz loop resets it
+    {
+        high = r->high;
+        if (n <= high) break;
+    } while (!__sync_bool_compare_and_swap(&r->high, high, n));
+    if (avail > PRU_RING_SAFE)                  // PRU1 has lapped the host
+    {
+        n = avail - PRU_RING_SAFE;
+        r->lost += n;
+        r->seq += n;
+        r->pos = (r->pos + n % PRU_RING_RECS) % PRU_RING_RECS;
+        avail = PRU_RING_SAFE;
+    }
+
+    head = r->pos*PRU_RING_REC_WORDS;
+    tail = ((r->pos + avail) % PRU_RING_RECS)*PRU_RING_REC_WORDS;
+    n = PRU_Ring_Queue(ring, head, tail, r, q);
+    n = ((n + PRU_RING_WORDS - head) % PRU_RING_WORDS)/PRU_RING_REC_WORDS;
+    r->seq += n;
+    r->pos = (r->pos + n) % PRU_RING_RECS;
+    return n;
+}
+
+//******************************************************************************
+//
+//  PRU_Ring_Anchor
+//
+//  Tie the IEP count to the host clock. cnt is extended to the nearest 64
+//  bit count, it may be a little older or newer than the last read. The
+//  host time is split in whole and part seconds so the 5 ns counts are
+//  not rounded in the double.
+//
+//  Parameters: struct PRU_Ring *r (host read state)
+//              unsigned int cnt (IEP count read next to sec)
+//              double sec (host time, s since 1970)
+//
+//******************************************************************************
+
+void PRU_Ring_Anchor(struct PRU_Ring *r, unsigned int cnt, double sec)
+{
+    unsigned long long c, epoch;
+    double whole;
+    long long err;
+
+    if (r->last == 0) PRU_Ring_Now(r, cnt); // nothing read yet
+    c = r->now + (long long)(int)(cnt - (unsigned int)r->now);
+    whole = (double)(long long)sec;         // sec > 0
+    epoch = c - (unsigned long long)whole*PRU_CLOCK_HZ
+        - (unsigned long long)((sec - whole)*PRU_CLOCK_HZ + 0.5);
+
+    err = (long long)(epoch - r->epoch);
+    if (r->anchors == 0 || err > PRU_ANCHOR_STEP || err < -PRU_ANCHOR_STEP)
+    {
+        if (r->anchors > 0) r->steps++;
+        r->epoch = epoch;
+    }
+    else r->epoch += err/PRU_ANCHOR_GAIN;
+    r->anchors++;
+}
+
+//******************************************************************************
+//
+//  PRU_Ring_Sec
+//
+//  Convert an absolute peak time to seconds since 1970.
+//
+//  Parameters: unsigned long long t (absolute time, PRU cycles)
+//
+//  Returns: double (s since 1970)
+//
+//******************************************************************************
+
+double PRU_Ring_Sec(unsigned long long t)
+{
+    return (double)(t/PRU_CLOCK_HZ) + (double)(t % PRU_CLOCK_HZ)/PRU_CLOCK_HZ;
+}
+
+//******************************************************************************
+//
+//  PRU_Ring_Stamp
+//
+//  Extend an IEP stamp back from the last read to an absolute time, as
+//  PRU_Ring_Time does for the peaks.
+//
+//  Parameters: const struct PRU_Ring *r (host read state)
+//              unsigned int stamp (IEP count, not newer than r->now)
+//
+//  Returns: unsigned long long (absolute time, PRU cycles)
+//
+//******************************************************************************
+
+unsigned long long PRU_Ring_Stamp(const struct PRU_Ring *r,
+    unsigned int stamp)
+{
+    return r->now - (unsigned int)((unsigned int)r->now - stamp) - r->epoch;
+}
+
+//******************************************************************************
+//
+//  PRU_BL_Stats
+//
+//  Mean and STD of the last block from the two newest block records, or of
+//  the buffer itself before PRU1 has recorded a block. The records are read
+//  again if PRU1 wrote over them meanwhile. The variance is worked out in
+//  integers, n*sumsq - sum*sum, which fits 64 bits for 512 16 bit points,
+//  so nothing cancels in the double.
+//
+//  Parameters: const struct PRU_Mem *m
+//              double *mean, double *std (results)
+//
+//  Returns: int (0 ok, -1 the records were being overwritten, the last
+//           read is used)
+//
+//******************************************************************************
+
+int PRU_BL_Stats(const struct PRU_Mem *m, double *mean, double *std)
+{
+    const struct PRU_BL_Block *b;
+    unsigned int count, sum, tries, i, lo, hi;
+    unsigned long long sumsq, v;
+    int ret = -1;
+
+    sum = 0;
+    sumsq = 0;
+    for (tries = 0; tries < 8 && ret != 0; tries++)
+    {
+        count = m->p1->bl_block_count;
+        __sync_synchronize();               // the count before the records
+        if (count == 0)                     // no block yet, the buffer
+        {
+            for (i = 0, sum = 0, sumsq = 0; i < PRU_BL_WORDS; i++)
+            {
+                lo = m->bl[i] & 0xFFFF;
+                hi = m->bl[i] >> 16;
+                sum += lo + hi;
+                sumsq += (unsigned long long)lo*lo + (unsigned long long)hi*hi;
+            }
+            ret = 0;
+            break;
+        }
+        b = &m->bl_block[(count - 1) % PRU_BL_RECS];
+        sum = b->sum;
+        sumsq = ((unsigned long long)b->sumsq_hi << 32) | b->sumsq_lo;
+        if (count > 1)                      // less the block before
+        {
+            b = &m->bl_block[(count - 2) % PRU_BL_RECS];
+            sum -= b->sum;
+            sumsq -= ((unsigned long long)b->sumsq_hi << 32) | b->sumsq_lo;
+        }
+        __sync_synchronize();
+        if (m->p1->bl_block_count - count < PRU_BL_SAFE) ret = 0;
+    }
+
+    v = PRU_BL_POINTS*sumsq - (unsigned long long)sum*sum;
+    if ((long long)v < 0) v = 0;            // torn read
+    *mean = (double)sum/PRU_BL_POINTS;
+    *std = sqrt((double)v/((double)PRU_BL_POINTS*(PRU_BL_POINTS - 1)));
+    return ret;
+}
+
+//******************************************************************************
+//
+//  PRU_BL_Win_Init
+//
+//  Empty the baseline window.
+//
+//  Parameters: struct PRU_BL_Win *w
+//              unsigned int blocks (window, blocks of PRU_BL_POINTS)
+//
+//******************************************************************************
+
+void PRU_BL_Win_Init(struct PRU_BL_Win *w, unsigned int blocks)
+{
+    memset(w, 0, sizeof(*w));
+    w->blocks = (blocks > PRU_BL_BLOCKS_MAX) ? PRU_BL_BLOCKS_MAX : blocks;
+}
+
+//******************************************************************************
+//
+//  PRU_BL_Window
+//
+//  Mean and STD of the baseline window. The sums of each block PRU1 has
+//  recorded since the last call, its record less the one before, are copied
+//  into the window and added to its sums, and the block they replace taken
+//  off. If PRU1 has lapped the host, the window starts again from the
+//  records still safe to read. The sum of squares
+//  about q, the mean cut to an integer, fits 64 bits for any window, where
+//  n*sumsq - sum*sum does not, so the variance is worked out from it. The
+//  64 bit sums wrap the same way, so nothing is lost.
+//
+//  Parameters: const struct PRU_Mem *m
+//              struct PRU_BL_Win *w (window, moved on)
+//              double *mean, double *std (results)
+//              unsigned int *n (points in the window)
+//
+//  Returns: int (0 ok, -1 records lost or the buffer sums were changing)
+//
+//******************************************************************************
+
+int PRU_BL_Window(const struct PRU_Mem *m, struct PRU_BL_Win *w,
+    double *mean, double *std, unsigned int *n)
+{
+    const struct PRU_BL_Block *b;
+    unsigned int count, sum;
+    unsigned long long sumsq, q, r, dev;
+    int ret = 0;
+
+    if (w->blocks < 2)
+    {
+        *n = PRU_BL_POINTS;
+        return PRU_BL_Stats(m, mean, std);
+    }
+
+    count = m->p1->bl_block_count;
+    __sync_synchronize();                   // the count before the records
+    if (count - w->seen > PRU_BL_SAFE)      // lapped, start again
+    {
+        PRU_BL_Win_Init(w, w->blocks);
+        w->seen = count - PRU_BL_SAFE;
+        b = &m->bl_block[(w->seen - 1) % PRU_BL_RECS];
+        w->last_sum = b->sum;
+        w->last_sumsq = ((unsigned long long)b->sumsq_hi << 32) | b->sumsq_lo;
+        ret = -1;
+    }
+    for ( ; w->seen != count; w->seen++)
+    {
+        b = &m->bl_block[w->seen % PRU_BL_RECS];
+        sum = b->sum;
+        sumsq = ((unsigned long long)b->sumsq_hi << 32) | b->sumsq_lo;
+        sum -= w->last_sum;                 // the block, less the record
+        sumsq -= w->last_sumsq;             // before
+        w->last_sum += sum;
+        w->last_sumsq += sumsq;
+        if (w->n == w->blocks)              // the block leaving the window
+        {
+            w->sum -= w->bsum[w->next];
+            w->sumsq -= w->bsumsq[w->next];
+        }
+        else w->n++;
+        w->bsum[w->next] = sum;
+        w->bsumsq[w->next] = sumsq;
+        w->sum += sum;
+        w->sumsq += sumsq;
+        w->next = (w->next + 1) % w->blocks;
+    }
+    if (w->n == 0)
+    {
+        *n = PRU_BL_POINTS;
+        return PRU_BL_Stats(m, mean, std);
+    }
+
+    *n = w->n*PRU_BL_POINTS;
+    q = w->sum / *n;
+    r = w->sum - q * *n;                    // sum about q
+    dev = w->sumsq - 2*q*w->sum + q*q * *n; // sum of squares about q
+    *mean = (double)w->sum / *n;
+    *std = (double)dev - (double)r*r / *n;
+    *std = (*std > 0.) ? sqrt(*std/(*n - 1)) : 0.;
+    return ret;
+}
+
+//******************************************************************************
+//
+//  PRU_Mem_Map
+//
+//  Point the typed views at the mapped memory.
+//
+//  Parameters: struct PRU_Mem *m
+//              void *pru0 (PRU0 DRAM), void *pru1 (PRU1 DRAM)
+//              void *shared (shared RAM)
+//
+//******************************************************************************
+
+static void PRU_Mem_Map(struct PRU_Mem *m, void *pru0, void *pru1,
+    void *shared)
+{
+    m->raw = (volatile unsigned int *)pru0;
+    m->bl = (volatile unsigned int *)pru1;
+    m->p1 = (struct PRU1_Params *)((char *)pru1 + 0x400);
+    m->snip = (volatile unsigned short *)((char *)pru1 + PRU_SNIP_BASE);
+    m->snip_desc = (struct PRU_Snip_Desc *)((char *)pru1 + PRU_SNIP_DESC);
+    m->bl_block = (struct PRU_BL_Block *)((char *)pru0
+        + PRU_BL_BLOCK_BASE - 0x2000);
+    m->ring = (volatile unsigned int *)shared;
+}
+
+//******************************************************************************
+//
+//  PRU_Mem_DDR
+//
+//  Set the DDR raw ring. The size is cut to a power of 2, so the PRU1
+//  offset stays the sample count times 2 modulo the size.
+//
+//  Parameters: struct PRU_Mem *m
+//              void *ddr (mapped ring), unsigned int phys (PRU address)
+//              unsigned int bytes (mapped size)
+//
+//******************************************************************************
+
+static void PRU_Mem_DDR(struct PRU_Mem *m, void *ddr, unsigned int phys,
+    unsigned int bytes)
+{
+    m->ddr = (volatile unsigned short *)ddr;
+    m->ddr_phys = phys;
+    m->ddr_bytes = 0;
+    if (ddr == NULL || bytes < 4096) return;    // no extmem
+    m->ddr_bytes = 4096;
+    while (m->ddr_bytes <= bytes/2) m->ddr_bytes *= 2;
+}
+
+//******************************************************************************
+//
+//  PRU_Mem_Open
+//
+//  Open the PRU backend. For prussdrv the host interrupts are opened and
+//  mapped as POPS_BBB.c has always done, with the IEP timer and the DDR
+//  extmem. The extmem is 256 KB unless uio_pruss is loaded with a larger
+//  extram_pool_sz. The emulator file is created if needed and mapped shared,
+//  so the feeder and the host see the same memory.
+//
+//  Parameters: struct PRU_Mem *m
+//              int backend (PRU_BACKEND_PRUSSDRV, _EMU or _MEM)
+//              const char *path (emulator file, NULL for PRU_EMU_PATH)
+//
+//  Returns: int (0 ok, -1 PRU_EVTOUT_0, -2 PRU_EVTOUT_1, -3 emulator file,
+//                -4 backend not built in)
+//
+//******************************************************************************
+
+int PRU_Mem_Open(struct PRU_Mem *m, int backend, const char *path)
+{
+    int fd;
+    char *base;
+
+    memset(m, 0, sizeof(*m));
+    m->backend = backend;
+
+    if (backend == PRU_BACKEND_MEM)
+    {
+        m->map = calloc(1, PRU_EMU_BYTES);
+        if (m->map == NULL) return -3;
+        base = (char *)m->map;
+        PRU_Mem_Map(m, base + PRU_EMU_PRU0_DRAM, base + PRU_EMU_PRU1_DRAM,
+            base + PRU_EMU_SHARED);
+        m->iep = &((struct PRU_Emu_Ctl *)(base + PRU_EMU_CTL))->iep;
+        PRU_Mem_DDR(m, base + PRU_EMU_DDR, PRU_EMU_DDR_PHYS,
+            PRU_EMU_DDR_BYTES);
+        return 0;
+    }
+
+    if (backend == PRU_BACKEND_EMU)
+    {
+        if (path == NULL) path = PRU_EMU_PATH;
+        fd = open(path, O_RDWR | O_CREAT, 0666);
+        if (fd < 0) return -3;
+        if (ftruncate(fd, PRU_EMU_BYTES) != 0)
+        {
+            close(fd);
+            return -3;
+        }
+        m->map = mmap(NULL, PRU_EMU_BYTES, PROT_READ | PROT_WRITE, MAP_SHARED,
+            fd, 0);
+        close(fd);
+        if (m->map == MAP_FAILED)
+        {
+            m->map = NULL;
+            return -3;
+        }
+        base = (char *)m->map;
+        PRU_Mem_Map(m, base + PRU_EMU_PRU0_DRAM, base + PRU_EMU_PRU1_DRAM,
+            base + PRU_EMU_SHARED);
+        m->emu = (struct PRU_Emu_Ctl *)(base + PRU_EMU_CTL);
+        m->iep = &m->emu->iep;
+        PRU_Mem_DDR(m, base + PRU_EMU_DDR, PRU_EMU_DDR_PHYS,
+            PRU_EMU_DDR_BYTES);
+        m->event_seen = m->emu->event;
+        return 0;
+    }
+
+#ifndef PRU_EMU_ONLY
+    {
+        tpruss_intc_initdata pruss_intc_initdata = PRUSS_INTC_INITDATA;
+        void *pru0, *pru1, *shared, *iep, *ddr = NULL;
+
+        prussdrv_init ();
+        if (prussdrv_open (PRU_EVTOUT_0)) return -1;
+        if (prussdrv_open (PRU_EVTOUT_1)) return -2;
+
+        prussdrv_map_prumem (PRUSS0_PRU1_DATARAM, &pru1);
+        prussdrv_map_prumem (PRUSS0_SHARED_DATARAM, &shared);
+        prussdrv_map_prumem (PRUSS0_PRU0_DATARAM, &pru0);
+        PRU_Mem_Map(m, pru0, pru1, shared);
+        prussdrv_map_peripheral_io (PRUSS0_IEP, &iep);
+        m->iep = (volatile unsigned int *)((char *)iep + 0x0C); // IEP_TMR_CNT
+        if (prussdrv_map_extmem (&ddr) != 0) ddr = NULL;
+        if (ddr != NULL) PRU_Mem_DDR(m, ddr, prussdrv_get_phys_addr(ddr),
+            prussdrv_extmem_size());
+
+        prussdrv_pruintc_init(&pruss_intc_initdata);
+        return 0;
+    }
+#else
+    return -4;
+#endif
+}
+
+//******************************************************************************
+//
+//  PRU_Mem_Start
+//
+//  Start PRU1 then PRU0. For the emulator, tell the feeder to start.
+//
+//  Parameters: struct PRU_Mem *m
+//              const char *pru1_bin, *pru0_bin (PRU program files)
+//
+//******************************************************************************
+
+void PRU_Mem_Start(struct PRU_Mem *m, const char *pru1_bin,
+    const char *pru0_bin)
+{
+    if (m->emu != NULL)
+    {
+        __sync_synchronize();               // parameters before run
+        m->emu->run = 1;
+        return;
+    }
+    if (m->backend == PRU_BACKEND_MEM) return;
+#ifndef PRU_EMU_ONLY
+    prussdrv_exec_program (PRU_NUM1, pru1_bin);
+    prussdrv_exec_program (PRU_NUM0, pru0_bin);
+#else
+    (void)pru1_bin;
+    (void)pru0_bin;
+#endif
+}
+
+//******************************************************************************
+//
+//  PRU_Mem_Wait
+//
+//  Wait for PRU_EVTOUT_1. The emulator has no interrupt, the event count is
+//  polled every 100 us, well inside the 1 ms the host allows.
+//
+//  Parameters: struct PRU_Mem *m
+//
+//******************************************************************************
+
+void PRU_Mem_Wait(struct PRU_Mem *m)
+{
+    struct timespec ts = {0, 100000};
+
+    if (m->emu != NULL)
+    {
+        while (m->emu->event == m->event_seen) nanosleep(&ts, NULL);
+        m->event_seen = m->emu->event;
+        return;
+    }
+    if (m->backend == PRU_BACKEND_MEM) return;
+#ifndef PRU_EMU_ONLY
+    prussdrv_pru_wait_event(PRU_EVTOUT_1);
+    prussdrv_pru_clear_event(PRU_EVTOUT_1, PRU1_ARM_INTERRUPT);
+#endif
+}
+
+//******************************************************************************
+//
+//  PRU_Mem_Event
+//
+//  Raise PRU_EVTOUT_1 from the host, the same event PRU1 sends.
+//
+//  Parameters: struct PRU_Mem *m
+//
+//******************************************************************************
+
+void PRU_Mem_Event(struct PRU_Mem *m)
+{
+    if (m->emu != NULL)
+    {
+        __sync_fetch_and_add(&m->emu->event, 1);
+        return;
+    }
+    if (m->backend == PRU_BACKEND_MEM) return;
+#ifndef PRU_EMU_ONLY
+    prussdrv_pru_send_event(PRU1_ARM_INTERRUPT);
+#endif
+}
+
+//******************************************************************************
+//
+//  PRU_Mem_Close
+//
+//  Halt the PRUs (or the feeder) and release the memory.
+//
+//  Parameters: struct PRU_Mem *m
+//
+//******************************************************************************
+
+void PRU_Mem_Close(struct PRU_Mem *m)
+{
+    if (m->emu != NULL)
+    {
+        m->emu->run = 0;
+        munmap(m->map, PRU_EMU_BYTES);
+        memset(m, 0, sizeof(*m));
+        return;
+    }
+    if (m->backend == PRU_BACKEND_MEM)
+    {
+        free(m->map);
+        memset(m, 0, sizeof(*m));
+        return;
+    }
+#ifndef PRU_EMU_ONLY
+    prussdrv_pru_disable(0);
+    prussdrv_pru_disable(1);
+    prussdrv_exit();
+#endif
+}
@@ -0,0 +1,274 @@
+// pops_pru.h
+// PRU shared memory access for the POPS program.
+// Project: NOAA - POPS
+
+#ifndef _POPS_PRU_H_
+#define _POPS_PRU_H_
+
+// Rolling point buffer written by PRU1 (WRITE_PK) in the shared RAM.
+// Each peak is 8 bytes: word 0 = (width << 16) | max, word 1 = the IEP
+// timer count when the peak ended. The IEP timer runs free at 200 MHz and
+// wraps every 21.5 s, the host extends it to 64 bits (PRU_Ring_Read).
+#define PRU_RING_BASE 0x00010000            // PRU address of the point buffer
+#define PRU_RING_WORDS 3072                 // 12 KB of 4 byte words
+#define PRU_RING_REC_WORDS 2                // words per peak record
+#define PRU_RING_RECS 1536                  // peak records in the buffer
+#define PRU_RING_SAFE (PRU_RING_RECS - 16)  // unread peaks safe to read while
+                                            // PRU1 keeps writing
+#define PRU_CLOCK_HZ 200000000              // IEP timer counts per second
+
+// Decode the point buffer in place from word head up to (not including) word
+// tail into the max, w and cycles columns. At most room peaks are written.
+// The cycles column gets the raw IEP stamps.
+// Returns the number of peaks decoded. Integer math only, a single pass.
+unsigned int PRU_Ring_Decode(const volatile unsigned int *ring,
+    unsigned int head, unsigned int tail, unsigned short *max,
+    unsigned short *w, unsigned int *cycles, unsigned int room);
+
+// Single producer/single consumer queue of decoded peaks. The ingest thread
+// is the only writer of head and the 1 Hz loop the only writer of tail, so
+// no lock is needed, only a memory barrier between the data and the index.
+#define PEAK_QUEUE_SIZE 131072              // peaks, must be a power of 2
+
+struct Peak_Queue {
+    unsigned short max[PEAK_QUEUE_SIZE];    // peak maximum above baseline
+    unsigned short w[PEAK_QUEUE_SIZE];      // width, number of points
+    unsigned int cycles[PEAK_QUEUE_SIZE];   // PRU cycles since last peak
+    unsigned long long t[PEAK_QUEUE_SIZE];  // absolute time, PRU cycles
+    volatile unsigned int head;             // peaks written (producer)
+    volatile unsigned int tail;             // peaks read (consumer)
+};
+
+struct PRU_Ring;
+
+// Producer: decode the point buffer from word head to word tail into the
+// queue, and time the peaks from their stamps with r (see PRU_Ring).
+// Returns the new head, which stops short of tail if the queue is full.
+unsigned int PRU_Ring_Queue(const volatile unsigned int *ring,
+    unsigned int head, unsigned int tail, struct PRU_Ring *r,
+    struct Peak_Queue *q);
+
+// Consumer: move up to room peaks from the queue into the columns.
+// Returns the number of peaks moved.
+unsigned int Peak_Queue_Get(struct Peak_Queue *q, unsigned short *max,
+    unsigned short *w, unsigned int *cycles, unsigned long long *t,
+    unsigned int room);
+
+// Consumer: discard the queue up to peak head (q->head for all of it).
+// Returns the number discarded.
+unsigned int Peak_Queue_Flush(struct Peak_Queue *q, unsigned int head);
+
+// Host side of the point buffer. PRU1 counts every peak it writes
+// (PRU1_Params.peak_count), so peaks overwritten before the host read them are
+// found from the count, not from the pointer, which can wrap past the host.
+//
+// The 32 bit IEP stamps are extended to 64 bits from the IEP count, which the
+// host reads after the peak count, so every stamp is at most one wrap older.
+// The host reads it at least once a second. The extended count is tied to
+// the host clock (gFullSec) by epoch, the count at 1970-01-01, so the
+// absolute time of a peak is one subtraction, stamp - epoch. The cycles
+// since the last peak are the difference of the stamps, none are lost.
+#define PRU_ANCHOR_STEP 200000              // 1 ms, step the epoch beyond this
+#define PRU_ANCHOR_GAIN 16                  // else slew 1/16 of the error
+
+struct PRU_Ring {
+    unsigned int seq;                       // peaks read or lost so far
+    unsigned int pos;                       // record of seq in the buffer
+    unsigned int lost;                      // peaks overwritten, total
+    volatile unsigned int high;             // most unread peaks seen,
+                                            // reset by the reader
+    unsigned long long now;                 // IEP count at the last read
+    unsigned long long last;                // IEP count of the last peak
+    unsigned long long epoch;               // IEP count at time 0 (1970)
+    unsigned int anchors;                   // anchors taken
+    unsigned int steps;                     // anchors that stepped the epoch
+};
+
+// Read everything PRU1 has written up to its peak count into the queue.
+// iep is the IEP count register, read after count.
+// Returns the number of peaks queued.
+unsigned int PRU_Ring_Read(const volatile unsigned int *ring,
+    unsigned int count, const volatile unsigned int *iep, struct PRU_Ring *r,
+    struct Peak_Queue *q);
+
+// Tie the IEP count cnt, read next to the host time sec (s since 1970), to
+// the host clock. Steps the epoch the first time or when it is off more than
+// PRU_ANCHOR_STEP, otherwise slews it, so the peak times do not jump.
+void PRU_Ring_Anchor(struct PRU_Ring *r, unsigned int cnt, double sec);
+
+// Seconds since 1970 of an absolute peak time (Peak_Queue.t).
+double PRU_Ring_Sec(unsigned long long t);
+
+// Absolute time of an IEP stamp older than the last read (r->now).
+unsigned long long PRU_Ring_Stamp(const struct PRU_Ring *r,
+    unsigned int stamp);
+
+// Convert the PRU1 point pointer (PRU1_Params.point_ptr) to a ring word index.
+unsigned int PRU_Ring_Index(unsigned int ptr);
+
+// PRU memory used by the host. The PRUs are reached through a backend:
+// prussdrv on the BBB, or an emulator, a file (or /dev/shm file) laid out as
+// PRU0 sees the PRU memory, which a feeder process (PRU_Feed.c) writes in
+// place of the PRUs. Build with -DPRU_EMU_ONLY where there is no prussdrv.
+#define PRU_BACKEND_PRUSSDRV 0
+#define PRU_BACKEND_EMU 1
+#define PRU_BACKEND_MEM 2                   // private memory, no events
+#define PRU_NUM0 0                          // PRU 0 high byte
+#define PRU_NUM1 1                          // PRU 1 low byte and ctrl
+
+#define PRU_BL_WORDS 256                    // PRU1 DRAM 0x000, baseline buffer
+#define PRU_BL_POINTS 512                   // 16 bit baseline points in it
+#define PRU_RAW_WORDS 256                   // PRU0 DRAM 0x000, raw data buffer
+
+// PRU1 parameter block, PRU1 DRAM 0x400. See the header
+// of PRU1_All.p, which must match.
+struct PRU1_Params {
+    volatile unsigned int bl_blth;          // 0x00 (BLTH << 16) | BL (host)
+    volatile unsigned int unused;           // 0x04
+    volatile unsigned int point_ptr;        // 0x08 next point to write (PRU1)
+    volatile unsigned int stop;             // 0x0C stop condition (PRU1)
+    volatile unsigned int peak_pts;         // 0x10 (max << 16) | min points
+    volatile unsigned int notify_peaks;     // 0x14 event every N peaks (host)
+    volatile unsigned int notify_fill;      // 0x18 event at fill bytes (host)
+    volatile unsigned int host_count;       // 0x1C peaks read or lost (host)
+    volatile unsigned int peak_count;       // 0x20 peaks written (PRU1)
+    volatile unsigned int raw_ddr;          // 0x24 raw ring address (host)
+    volatile unsigned int raw_bytes;        // 0x28 raw ring size, 0 = off
+    volatile unsigned int raw_count;        // 0x2C samples captured (PRU1)
+    volatile unsigned int snip_every;       // 0x30 snippet every N peaks
+    volatile unsigned int snip_post;        // 0x34 samples after the peak
+    volatile unsigned int snip_count;       // 0x38 snippets kept (PRU1)
+    volatile unsigned int bl_block_count;   // 0x3C blocks recorded (PRU1)
+};
+
+// PRU1 reads the 16 bit parameters (notify_peaks, notify_fill, snip_every)
+// as half words, the host keeps them to this.
+#define PRU1_PARAM_MAX 0xFFFF
+
+// Baseline window. Each time the baseline buffer pointer wraps, the buffer
+// holds the PRU_BL_POINTS points since the last wrap, a block. PRU1 writes
+// the sum and sum of squares of every baseline point since START, as they
+// are at the end of the block, to record bl_block_count % PRU_BL_RECS of a
+// ring in PRU0 DRAM, then counts it. The sums of a block are its record
+// less the one before (0 before the first). The host keeps the window from
+// the records (PRU_BL_Window), so a block costs PRU1 one record.
+#define PRU_BL_BLOCK_BASE 0x3000            // PRU1 address of record 0
+#define PRU_BL_RECS 256                     // records in the ring
+#define PRU_BL_SAFE (PRU_BL_RECS - 16)      // unread records safe to read
+                                            // while PRU1 keeps writing
+#define PRU_BL_BLOCKS_MAX 512               // window, 262144 points
+
+struct PRU_BL_Block {
+    volatile unsigned int sum;              // sum since START, mod 2^32
+    volatile unsigned int sumsq_lo;         // and sum of squares, 64 bits
+    volatile unsigned int sumsq_hi;
+    volatile unsigned int unused;
+};
+
+// Host side of the baseline window: the sums of the last blocks and their
+// totals, moved on by the records PRU1 has written since the last call.
+struct PRU_BL_Win {
+    unsigned int blocks;                    // window, 0 or 1 = the buffer
+    unsigned int seen;                      // block count read up to
+    unsigned int n;                         // blocks in the window
+    unsigned int next;                      // slot of the next block
+    unsigned int last_sum;                  // record seen - 1, 0 before
+    unsigned long long last_sumsq;          // the first
+    unsigned long long sum;                 // sums of the window, 64 bits
+    unsigned long long sumsq;
+    unsigned int bsum[PRU_BL_BLOCKS_MAX];   // sums of each block in it,
+    unsigned long long bsumsq[PRU_BL_BLOCKS_MAX];   // a ring from next
+};
+
+// Snippet slots in PRU1 DRAM. PRU1 writes every sample to the current slot,
+// a ring of PRU_SNIP_SAMPLES. For every snip_every'th peak it fills in the
+// slot descriptor, writes snip_post more samples, then moves on to the next
+// slot and counts the snippet. Slot k holds snippet k % PRU_SNIP_SLOTS.
+#define PRU_SNIP_BASE 0x1000                // PRU1 DRAM address of slot 0
+#define PRU_SNIP_DESC 0x0500                // PRU1 DRAM address of descriptor 0
+#define PRU_SNIP_SLOTS 16
+#define PRU_SNIP_SAMPLES 128                // samples in a slot
+#define PRU_SNIP_SLOT_BYTES 256
+
+struct PRU_Snip_Desc {
+    volatile unsigned int peak;             // (width << 16) | max
+    volatile unsigned int stamp;            // IEP count when the peak ended
+    volatile unsigned int oldest;           // PRU1 address of the oldest sample
+    volatile unsigned int unused;
+};
+
+// Emulator file, PRU0 addresses. The control block follows the shared RAM,
+// then the DDR raw ring, which PRU1 sees at PRU_EMU_DDR_PHYS.
+#define PRU_EMU_PRU0_DRAM 0x00000
+#define PRU_EMU_PRU1_DRAM 0x02000
+#define PRU_EMU_SHARED 0x10000
+#define PRU_EMU_CTL 0x13000
+#define PRU_EMU_DDR 0x14000
+#define PRU_EMU_DDR_BYTES 0x800000          // 8 MB, 1 s of raw samples
+#define PRU_EMU_DDR_PHYS 0x9F000000         // made up DDR address
+#define PRU_EMU_BYTES (PRU_EMU_DDR + PRU_EMU_DDR_BYTES)
+#define PRU_EMU_PATH "/dev/shm/pops_pru"    // default emulator file
+
+struct PRU_Emu_Ctl {
+    volatile unsigned int run;              // PRUs "running", set by the host
+    volatile unsigned int event;            // PRU_EVTOUT_1 count
+    volatile unsigned int iep;              // IEP timer count
+};
+
+struct PRU_Mem {
+    int backend;                            // PRU_BACKEND_*
+    volatile unsigned int *bl;              // PRU1 baseline buffer
+    struct PRU1_Params *p1;                 // PRU1 parameter block
+    volatile unsigned int *ring;            // shared RAM point buffer
+    volatile unsigned int *raw;             // PRU0 raw data buffer
+    volatile unsigned short *ddr;           // DDR raw ring (extmem)
+    unsigned int ddr_phys;                  // its address as PRU1 sees it
+    unsigned int ddr_bytes;                 // its size, a power of 2
+    volatile unsigned int *iep;             // IEP timer count register
+    volatile unsigned short *snip;          // PRU1 snippet slots
+    struct PRU_Snip_Desc *snip_desc;        // and their descriptors
+    struct PRU_BL_Block *bl_block;          // baseline block records
+    struct PRU_Emu_Ctl *emu;                // emulator control, else NULL
+    unsigned int event_seen;                // last emulator event waited on
+    void *map;                              // emulator or private memory
+};
+
+// Mean and STD (n - 1) of the last block of the baseline buffer from the
+// PRU1 block records, in O(1). Before the first block, from the buffer.
+// Returns 0, or -1 if PRU1 kept overwriting the records as they were read.
+int PRU_BL_Stats(const struct PRU_Mem *m, double *mean, double *std);
+
+// Empty the window w of blocks blocks (cut to PRU_BL_BLOCKS_MAX), before
+// PRU1 starts with its block count at 0.
+void PRU_BL_Win_Init(struct PRU_BL_Win *w, unsigned int blocks);
+
+// Mean and STD (n - 1) of the baseline window, the last w->blocks blocks.
+// The records PRU1 has written since the last call are added and the blocks
+// they push out taken off, so the cost is per new block, not per window.
+// Until the first block is done, or with no window, those of PRU_BL_Stats.
+// *n is set to the points they cover. Returns 0, or -1 if the records were
+// overwritten before they were read (the window starts again).
+int PRU_BL_Window(const struct PRU_Mem *m, struct PRU_BL_Win *w,
+    double *mean, double *std, unsigned int *n);
+
+// Open the backend and map the memory. path is the emulator file.
+// PRU_BACKEND_MEM is the emulator layout in private memory, for the PRU1
+// model (pops_model.c) run on its own.
+// Returns 0, -1 PRU_EVTOUT_0 failed, -2 PRU_EVTOUT_1 failed,
+// -3 the emulator file could not be mapped, -4 backend not built in.
+int PRU_Mem_Open(struct PRU_Mem *m, int backend, const char *path);
+
+// Start the PRU programs (the feeder, for the emulator).
+void PRU_Mem_Start(struct PRU_Mem *m, const char *pru1_bin,
+    const char *pru0_bin);
+
+// Wait for PRU_EVTOUT_1 and clear it.
+void PRU_Mem_Wait(struct PRU_Mem *m);
+
+// Raise PRU_EVTOUT_1 from the host, to wake PRU_Mem_Wait.
+void PRU_Mem_Event(struct PRU_Mem *m);
+
+// Stop the PRUs and unmap.
+void PRU_Mem_Close(struct PRU_Mem *m);
+
+#endif // _POPS_PRU_H_
@@ -0,0 +1,164 @@
+/*
+// Filename: pops_snip.c
+// Version: 1.0
+//
+// Project: NOAA - POPS
+//
+// Description - Triggered waveform snippets. PRU1 keeps a window of raw
+// samples around every Nth peak in one of the snippet slots in its DRAM
+// (see PRU1_All.p). The ingest thread copies the new slots into a queue
+// before PRU1 comes back round to them, and the 1 Hz loop writes the queue
+// to the snippet file (Snip_*.b). See pops_snip.h for the format.
+//
+// See SOFTWARE DISCLAIMER.md.
+*/
+
+//******************************************************************************
+//
+// Include files:
+//
+//******************************************************************************
+
+#include <string.h>
+#include "pops_snip.h"
+
+//******************************************************************************
+//
+//  Snip_Read
+//
+//  Copy the new snippets into the queue. PRU1 is writing the slot after the
+//  last one kept, so up to PRU_SNIP_SLOTS - 1 snippets can be read; any
+//  older ones are lost. Each slot is a ring, copied oldest sample first.
+//  PRU1 keeps writing during the copy, so the count is read again after it
+//  and a snippet whose slot PRU1 may have reached is dropped as lost.
+//
+//  Parameters: struct Snip_Queue *q (queue to fill)
+//              const struct PRU_Mem *m (PRU memory with the slots)
+//              unsigned int count (PRU1 snippet count)
+//              const struct PRU_Ring *r (host read state, for the time)
+//
+//  Returns: unsigned int (snippets queued)
+//
+//******************************************************************************
+
+unsigned int Snip_Read(struct Snip_Queue *q, const struct PRU_Mem *m,
+    unsigned int count, const struct PRU_Ring *r)
+{
+    const volatile unsigned short *slot;
+    const struct PRU_Snip_Desc *d;
+    struct Snip_Rec *rec;
+    unsigned int avail, k, i, first, in = q->head, n = 0;
+
+    avail = count - q->seq;
+    if (avail == 0) return 0;
+    if (avail > PRU_SNIP_SLOTS - 1)         // PRU1 has lapped the host
+    {
+        q->lost += avail - (PRU_SNIP_SLOTS - 1);
+        q->seq = count - (PRU_SNIP_SLOTS - 1);
+    }
+
+    __sync_synchronize();                   // count before the slots
+    for (; q->seq != count; q->seq++)
+    {
+        if (in - q->tail >= SNIP_QUEUE_SIZE)    // full until the next second
+        {
+            q->lost += count - q->seq;
+            q->seq = count;
+            break;
+        }
+        k = q->seq % PRU_SNIP_SLOTS;
+        d = &m->snip_desc[k];
+        slot = m->snip + k*PRU_SNIP_SAMPLES;
+        first = (d->oldest % PRU_SNIP_SLOT_BYTES)/2;
+
+        rec = &q->rec[in % SNIP_QUEUE_SIZE];
+        rec->t = PRU_Ring_Stamp(r, d->stamp);
+        rec->max = d->peak & 0xFFFF;
+        rec->w = d->peak >> 16;
+        rec->post = m->p1->snip_post;
+        rec->every = m->p1->snip_every;
+        for (i = 0; i < PRU_SNIP_SAMPLES; i++)
+            rec->s[i] = slot[(first + i) % PRU_SNIP_SAMPLES];
+
+        __sync_synchronize();               // copy before the count
+        if (m->p1->snip_count - q->seq >= PRU_SNIP_SLOTS)
+        {
+            q->lost++;                      // PRU1 is writing this slot
+            continue;
+        }
+        in++;
+        n++;
+    }
+    __sync_synchronize();                   // snippets before the head
+    q->head = in;
+    return n;
+}
+
+//******************************************************************************
+//
+//  Snip_File_Header_Set
+//
+//  Fill in the snippet file header.
+//
+//  Parameters: struct Snip_File_Header *h
+//              const char *sn (POPS serial number, cut to 11 characters)
+//
+//******************************************************************************
+
+void Snip_File_Header_Set(struct Snip_File_Header *h, const char *sn)
+{
+    memset(h, 0, sizeof(*h));
+    memcpy(h->magic, SNIP_FILE_MAGIC, 4);
+    h->version = SNIP_FILE_VERSION;
+    h->header_bytes = sizeof(struct Snip_File_Header);
+    h->rec_bytes = sizeof(struct Snip_Rec);
+    h->samples = PRU_SNIP_SAMPLES;
+    h->rate_hz = SNIP_RATE_HZ;
+    h->clock_hz = PRU_CLOCK_HZ;
+    strncpy(h->pops_sn, sn, sizeof(h->pops_sn) - 1);
+}
+
+//******************************************************************************
+//
+//  Snip_File_Write
+//
+//  Write the queued snippets, at most two contiguous pieces of the queue,
+//  and free them.
+//
+//  Parameters: FILE *fp (snippet file, opened for append)
+//              struct Snip_Queue *q
+//              const char *sn (POPS serial number)
+//
+//  Returns: int (snippets written, -1 on a write error)
+//
+//******************************************************************************
+
+int Snip_File_Write(FILE *fp, struct Snip_Queue *q, const char *sn)
+{
+    struct Snip_File_Header h;
+    unsigned int head, out, pos, n, total = 0;
+
+    head = q->head;
+    __sync_synchronize();                   // head before the snippets
+    if (head == q->tail) return 0;
+
+    fseek(fp, 0, SEEK_END);
+    if (ftell(fp) == 0)                     // new file
+    {
+        Snip_File_Header_Set(&h, sn);
+        if (fwrite(&h, sizeof(h), 1, fp) != 1) return -1;
+    }
+
+    for (out = q->tail; out != head; out += n)
+    {
+        pos = out % SNIP_QUEUE_SIZE;
+        n = SNIP_QUEUE_SIZE - pos;          // contiguous to the end
+        if (n > head - out) n = head - out;
+        if (fwrite(&q->rec[pos], sizeof(struct Snip_Rec), n, fp) != n)
+            return -1;
+        total += n;
+    }
+    __sync_synchronize();                   // snippets before the tail
+    q->tail = head;
+    return (int)total;
+}
@@ -0,0 +1,64 @@
+// pops_snip.h
+// Triggered waveform snippets from PRU1 for the POPS program.
+// Project: NOAA - POPS
+
+#ifndef _POPS_SNIP_H_
+#define _POPS_SNIP_H_
+
+#include <stdio.h>
+#include "pops_pru.h"
+
+// Snippet file (Snip_*.b). A struct Snip_File_Header, then one struct
+// Snip_Rec for each snippet. All values are little endian, as written by the
+// BBB. The sample that ended the peak is s[PRU_SNIP_SAMPLES - 1 - post], the
+// w samples before it are the peak, and the rest is the baseline before it.
+#define SNIP_FILE_MAGIC "POSN"
+#define SNIP_FILE_VERSION 1
+#define SNIP_RATE_HZ 4000000                // A/D samples per second
+#define SNIP_POST 32                        // default post trigger samples
+#define SNIP_QUEUE_SIZE 1024                // snippets, must be a power of 2
+
+struct Snip_File_Header {                   // 32 bytes
+    char magic[4];                          // SNIP_FILE_MAGIC, no '\0'
+    unsigned short version;                 // SNIP_FILE_VERSION
+    unsigned short header_bytes;            // size of this header
+    unsigned short rec_bytes;               // size of struct Snip_Rec
+    unsigned short samples;                 // samples in a record
+    unsigned int rate_hz;                   // sample rate
+    unsigned int clock_hz;                  // clock of the time
+    char pops_sn[12];                       // instrument serial number
+};
+
+struct Snip_Rec {                           // 272 bytes
+    unsigned long long t;                   // peak end, PRU cycles since 1970
+    unsigned short max;                     // peak maximum above baseline
+    unsigned short w;                       // width, number of points
+    unsigned short post;                    // samples after the peak end
+    unsigned short every;                   // one snippet every N peaks
+    unsigned short s[PRU_SNIP_SAMPLES];     // raw A/D samples, oldest first
+};
+
+// Single producer/single consumer queue, as struct Peak_Queue. The ingest
+// thread copies the snippets out of the PRU1 slots, the 1 Hz loop writes
+// them to the file.
+struct Snip_Queue {
+    struct Snip_Rec rec[SNIP_QUEUE_SIZE];
+    volatile unsigned int head;             // snippets written (producer)
+    volatile unsigned int tail;             // snippets read (consumer)
+    unsigned int seq;                       // PRU1 snippets read or lost
+    volatile unsigned int lost;             // overwritten or queue full
+};
+
+// Producer: copy the snippets PRU1 has kept up to its snippet count (read
+// before r->now) into the queue. Returns the number queued.
+unsigned int Snip_Read(struct Snip_Queue *q, const struct PRU_Mem *m,
+    unsigned int count, const struct PRU_Ring *r);
+
+// Fill in a file header.
+void Snip_File_Header_Set(struct Snip_File_Header *h, const char *sn);
+
+// Consumer: append the queued snippets to the file, with the file header
+// when the file is empty. Returns the number written, or -1 on an error.
+int Snip_File_Write(FILE *fp, struct Snip_Queue *q, const char *sn);
+
+#endif // _POPS_SNIP_H_
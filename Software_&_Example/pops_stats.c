@@ -0,0 +1,238 @@
+/*
+// Filename: pops_stats.c
+// Version: 1.0
+//
+// Project: NOAA - POPS
+//
+// Description - Streaming statistics of the peak width, max and dt. The
+// ingest thread adds each chunk of peaks it queues to the moments and the
+// quantile sketch of the second, and the 1 Hz loop reads the mean, STD and
+// quantiles from them. See pops_stats.h.
+//
+// See SOFTWARE DISCLAIMER.md.
+*/
+
+//******************************************************************************
+//
+// Include files:
+//
+//******************************************************************************
+
+#include <math.h>
+#include <string.h>
+#include "pops_stats.h"
+
+//******************************************************************************
+//
+//  Stat_Bucket
+//
+//  Sketch bucket of a value, from its highest set bit.
+//
+//  Parameters: unsigned int x
+//
+//  Returns: unsigned int (bucket)
+//
+//******************************************************************************
+
+static unsigned int Stat_Bucket(unsigned int x)
+{
+    unsigned int e;
+
+    if (x < 2*STAT_SUB) return x;
+    e = 31 - __builtin_clz(x);              // STAT_SUB_BITS + 1 to 31
+    return (e - STAT_SUB_BITS + 1)*STAT_SUB
+        + ((x >> (e - STAT_SUB_BITS)) & (STAT_SUB - 1));
+}
+
+//******************************************************************************
+//
+//  Stat_Bucket_Mid
+//
+//  Middle of a sketch bucket.
+//
+//  Parameters: unsigned int b (bucket)
+//
+//  Returns: double (value)
+//
+//******************************************************************************
+
+static double Stat_Bucket_Mid(unsigned int b)
+{
+    unsigned int e, lo;
+
+    if (b < 2*STAT_SUB) return b;
+    e = b/STAT_SUB + STAT_SUB_BITS - 1;
+    lo = (STAT_SUB + b % STAT_SUB) << (e - STAT_SUB_BITS);
+    return lo + 0.5*((1u << (e - STAT_SUB_BITS)) - 1);
+}
+
+//******************************************************************************
+//
+//  Stat_Clear
+//
+//  Empty the statistics for the next second.
+//
+//  Parameters: struct Stat *s
+//
+//******************************************************************************
+
+void Stat_Clear(struct Stat *s)
+{
+    memset(s, 0, sizeof(*s));
+    s->min = 0xFFFFFFFF;
+}
+
+//******************************************************************************
+//
+//  Stat_Merge
+//
+//  Merge a chunk's count, mean and sum of squared deviations into s.
+//
+//  Parameters: struct Stat *s
+//              unsigned int n, double mean, double m2 (the chunk)
+//
+//******************************************************************************
+
+static void Stat_Merge(struct Stat *s, unsigned int n, double mean, double m2)
+{
+    double d = mean - s->mean;
+    unsigned int total = s->n + n;
+
+    s->m2 += m2 + d*d*((double)s->n*n/total);
+    s->mean += d*n/total;
+    s->n = total;
+}
+
+//******************************************************************************
+//
+//  Stat_Add_U16, Stat_Add_U32
+//
+//  Add a chunk of values: sketch them and add them up in one pass, then
+//  take their deviations from the chunk mean in a second, while they are
+//  still in the cache, and merge.
+//
+//  Parameters: struct Stat *s
+//              const unsigned short *x or const unsigned int *x (values)
+//              unsigned int n (number of values)
+//
+//******************************************************************************
+
+void Stat_Add_U16(struct Stat *s, const unsigned short *x, unsigned int n)
+{
+    unsigned long long sum = 0;
+    unsigned int i;
+    double mean, d, m2 = 0;
+
+    if (n == 0) return;
+    for (i = 0; i < n; i++)
+    {
+        s->sketch[Stat_Bucket(x[i])]++;
+        if (x[i] < s->min) s->min = x[i];
+        if (x[i] > s->max) s->max = x[i];
+        sum += x[i];
+    }
+    mean = (double)sum/n;
+    for (i = 0; i < n; i++)
+    {
+        d = x[i] - mean;
+        m2 += d*d;
+    }
+    Stat_Merge(s, n, mean, m2);
+}
+
+void Stat_Add_U32(struct Stat *s, const unsigned int *x, unsigned int n)
+{
+    unsigned long long sum = 0;
+    unsigned int i;
+    double mean, d, m2 = 0;
+
+    if (n == 0) return;
+    for (i = 0; i < n; i++)
+    {
+        s->sketch[Stat_Bucket(x[i])]++;
+        if (x[i] < s->min) s->min = x[i];
+        if (x[i] > s->max) s->max = x[i];
+        sum += x[i];
+    }
+    mean = (double)sum/n;
+    for (i = 0; i < n; i++)
+    {
+        d = x[i] - mean;
+        m2 += d*d;
+    }
+    Stat_Merge(s, n, mean, m2);
+}
+
+//******************************************************************************
+//
+//  Stat_Sum
+//
+//  Add another set of statistics, as one chunk of values.
+//
+//  Parameters: struct Stat *s
+//              const struct Stat *t (added to s)
+//
+//******************************************************************************
+
+void Stat_Sum(struct Stat *s, const struct Stat *t)
+{
+    unsigned int i;
+
+    if (t->n == 0) return;
+    for (i = 0; i < STAT_BUCKETS; i++) s->sketch[i] += t->sketch[i];
+    if (t->min < s->min) s->min = t->min;
+    if (t->max > s->max) s->max = t->max;
+    Stat_Merge(s, t->n, t->mean, t->m2);
+}
+
+//******************************************************************************
+//
+//  Stat_STD
+//
+//  Sample standard deviation.
+//
+//  Parameters: const struct Stat *s
+//
+//  Returns: double (STD)
+//
+//******************************************************************************
+
+double Stat_STD(const struct Stat *s)
+{
+    if (s->n < 2 || s->m2 <= 0) return 0;
+    return sqrt(s->m2/(s->n - 1));
+}
+
+//******************************************************************************
+//
+//  Stat_Quantile
+//
+//  Walk the sketch to the bucket holding rank q*(n - 1), and take its
+//  middle, kept within the smallest and largest value.
+//
+//  Parameters: const struct Stat *s
+//              double q (0 to 1)
+//
+//  Returns: double (value)
+//
+//******************************************************************************
+
+double Stat_Quantile(const struct Stat *s, double q)
+{
+    unsigned int b, k, c = 0;
+    double v;
+
+    if (s->n == 0) return 0;
+    if (q < 0) q = 0;
+    if (q > 1) q = 1;
+    k = (unsigned int)(q*(s->n - 1));
+    for (b = 0; b < STAT_BUCKETS - 1; b++)
+    {
+        c += s->sketch[b];
+        if (c > k) break;
+    }
+    v = Stat_Bucket_Mid(b);
+    if (v < s->min) v = s->min;
+    if (v > s->max) v = s->max;
+    return v;
+}
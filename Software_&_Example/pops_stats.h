@@ -0,0 +1,50 @@
+// pops_stats.h
+// Streaming statistics of the peaks for the POPS program.
+// Project: NOAA - POPS
+
+#ifndef _POPS_STATS_H_
+#define _POPS_STATS_H_
+
+// Count, mean, STD and quantiles of one value of the peaks (width, max or
+// dt) over a second, kept up to date by the ingest thread as it queues
+// them, so the 1 Hz loop reads them with no pass over the peaks.
+//
+// The moments are Welford's mean and sum of squared deviations, merged a
+// chunk of the queue at a time (Chan et al.): the chunk's own mean and
+// deviations are from its integer sum, so there is no divide per peak and
+// no sum of squares to lose precision or overflow (dt is 32 bits).
+//
+// The quantiles are from a log-linear sketch of fixed size: values under
+// 2*STAT_SUB each have a bucket, then each octave is split into STAT_SUB
+// buckets. A quantile is the middle of its bucket, within 1/(2*STAT_SUB)
+// (1.6%) of the value, and exact for the small widths.
+#define STAT_SUB_BITS 5
+#define STAT_SUB (1u << STAT_SUB_BITS)    // buckets an octave
+#define STAT_BUCKETS (2*STAT_SUB + (31 - STAT_SUB_BITS)*STAT_SUB)
+
+struct Stat {
+    unsigned int n;                         // values
+    double mean;
+    double m2;                              // sum of squared deviations
+    unsigned int min;
+    unsigned int max;
+    unsigned int sketch[STAT_BUCKETS];      // values in each bucket
+};
+
+// Empty s.
+void Stat_Clear(struct Stat *s);
+
+// Add n values.
+void Stat_Add_U16(struct Stat *s, const unsigned short *x, unsigned int n);
+void Stat_Add_U32(struct Stat *s, const unsigned int *x, unsigned int n);
+
+// Add the values of t, kept apart, to s.
+void Stat_Sum(struct Stat *s, const struct Stat *t);
+
+// STD (n - 1), 0 for under 2 values.
+double Stat_STD(const struct Stat *s);
+
+// Value at fraction q (0 to 1) of the values, 0 for none.
+double Stat_Quantile(const struct Stat *s, double q);
+
+#endif // _POPS_STATS_H_
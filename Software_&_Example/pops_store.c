@@ -0,0 +1,219 @@
+/*
+// Filename: pops_store.c
+// Version: 1.0
+//
+// Project: NOAA - POPS
+//
+// Description - Per second particle store used by POPS_BBB.c. The peaks
+// read from PRU1 are kept in chunks of column arrays taken from a pool, so
+// there is no fixed particle maximum per second other than the configured
+// memory limit.
+//
+// See SOFTWARE DISCLAIMER.md.
+*/
+
+//******************************************************************************
+//
+// Include files:
+//
+//******************************************************************************
+
+#include <stdlib.h>
+#include <string.h>
+#include "pops_store.h"
+
+//******************************************************************************
+//
+//  Peak_Store_Chunk
+//
+//  Get an empty chunk for the end of the list, from the pool if there is one,
+//  otherwise allocated while under the limit.
+//
+//  Parameters: struct Peak_Store *s
+//
+//  Returns: struct Peak_Chunk * (NULL at the limit or out of memory)
+//
+//******************************************************************************
+
+static struct Peak_Chunk *Peak_Store_Chunk(struct Peak_Store *s)
+{
+    struct Peak_Chunk *c;
+
+    c = s->pool;
+    if (c != NULL) s->pool = c->next;
+    else
+    {
+        if (s->chunks >= s->max_chunks) return NULL;
+        c = malloc(sizeof(struct Peak_Chunk));
+        if (c == NULL) return NULL;
+        s->chunks++;
+    }
+    c->n = 0;
+    c->next = NULL;
+
+    if (s->last != NULL) s->last->next = c;
+    else s->first = c;
+    s->last = c;
+    return c;
+}
+
+//******************************************************************************
+//
+//  Peak_Store_Init
+//
+//  Empty the store, set the limit and fill the pool with enough chunks for
+//  prealloc peaks, so a normal second never calls malloc.
+//
+//  Parameters: struct Peak_Store *s
+//              unsigned int max_peaks (most peaks kept per second)
+//              unsigned int prealloc (peaks to allocate chunks for now)
+//
+//  Returns: int (0 ok, -1 allocation failed)
+//
+//******************************************************************************
+
+int Peak_Store_Init(struct Peak_Store *s, unsigned int max_peaks,
+    unsigned int prealloc)
+{
+    unsigned int i, n;
+
+    memset(s, 0, sizeof(*s));
+    if (max_peaks == 0) max_peaks = 1;
+    s->max_peaks = max_peaks;
+    s->max_chunks = (max_peaks + PEAK_CHUNK - 1)/PEAK_CHUNK;
+
+    n = (prealloc + PEAK_CHUNK - 1)/PEAK_CHUNK;
+    for (i = 0; i < n && i < s->max_chunks; i++)
+    {
+        if (Peak_Store_Chunk(s) == NULL) return -1;
+    }
+    Peak_Store_Clear(s);
+    return 0;
+}
+
+//******************************************************************************
+//
+//  Peak_Store_Add
+//
+//  Copy peaks from column arrays onto the end of the store.
+//
+//  Parameters: struct Peak_Store *s
+//              const unsigned short *max, *w (peak max and width columns)
+//              const unsigned int *cycles (cycle count column)
+//              const unsigned long long *t (absolute time column)
+//              unsigned int n (peaks to add)
+//
+//  Returns: unsigned int (peaks added)
+//
+//******************************************************************************
+
+unsigned int Peak_Store_Add(struct Peak_Store *s, const unsigned short *max,
+    const unsigned short *w, const unsigned int *cycles,
+    const unsigned long long *t, unsigned int n)
+{
+    struct Peak_Chunk *c;
+    unsigned int k, total = 0;
+
+    while (total < n && s->n + total < s->max_peaks)
+    {
+        c = s->last;
+        if (c == NULL || c->n == PEAK_CHUNK) c = Peak_Store_Chunk(s);
+        if (c == NULL) break;                   // at the limit
+
+        k = PEAK_CHUNK - c->n;
+        if (k > n - total) k = n - total;
+        if (k > s->max_peaks - s->n - total) k = s->max_peaks - s->n - total;
+        memcpy(c->max + c->n, max + total, k*sizeof(*max));
+        memcpy(c->w + c->n, w + total, k*sizeof(*w));
+        memcpy(c->cycles + c->n, cycles + total, k*sizeof(*cycles));
+        memcpy(c->t + c->n, t + total, k*sizeof(*t));
+        c->n += k;
+        total += k;
+    }
+    s->n += total;
+    return total;
+}
+
+//******************************************************************************
+//
+//  Peak_Store_Fill
+//
+//  Empty the queue up to head straight into the free space of the chunks.
+//  The peaks the ingest thread queued after head are left for the next
+//  second.
+//
+//  Parameters: struct Peak_Store *s
+//              struct Peak_Queue *q (queue filled by the ingest thread)
+//              unsigned int head (peaks written, q->head or an earlier one)
+//
+//  Returns: unsigned int (peaks moved)
+//
+//******************************************************************************
+
+unsigned int Peak_Store_Fill(struct Peak_Store *s, struct Peak_Queue *q,
+    unsigned int head)
+{
+    struct Peak_Chunk *c;
+    unsigned int k, total = 0;
+
+    if (head - q->tail > q->head - q->tail) return 0;  // not a head of q
+    while (s->n + total < s->max_peaks)
+    {
+        c = s->last;
+        if (c == NULL || c->n == PEAK_CHUNK)
+        {
+            if (head == q->tail) break;         // nothing to add
+            c = Peak_Store_Chunk(s);
+        }
+        if (c == NULL) break;                   // at the limit
+
+        k = PEAK_CHUNK - c->n;
+        if (k > s->max_peaks - s->n - total) k = s->max_peaks - s->n - total;
+        if (k > head - q->tail) k = head - q->tail;
+        k = Peak_Queue_Get(q, c->max + c->n, c->w + c->n, c->cycles + c->n,
+            c->t + c->n, k);
+        if (k == 0) break;
+        c->n += k;
+        total += k;
+    }
+    s->n += total;
+    return total;
+}
+
+//******************************************************************************
+//
+//  Peak_Store_Clear
+//
+//  Put all of the chunks of the second back in the pool.
+//
+//  Parameters: struct Peak_Store *s
+//
+//******************************************************************************
+
+void Peak_Store_Clear(struct Peak_Store *s)
+{
+    if (s->last != NULL)
+    {
+        s->last->next = s->pool;
+        s->pool = s->first;
+    }
+    s->first = s->last = NULL;
+    s->n = 0;
+}
+
+//******************************************************************************
+//
+//  Peak_Store_Bytes
+//
+//  Memory held by the store, used and pooled.
+//
+//  Parameters: const struct Peak_Store *s
+//
+//  Returns: unsigned long (bytes)
+//
+//******************************************************************************
+
+unsigned long Peak_Store_Bytes(const struct Peak_Store *s)
+{
+    return (unsigned long)s->chunks*sizeof(struct Peak_Chunk);
+}
@@ -0,0 +1,59 @@
+// pops_store.h
+// Per second particle store for the POPS program.
+// Project: NOAA - POPS
+
+#ifndef _POPS_STORE_H_
+#define _POPS_STORE_H_
+
+#include "pops_pru.h"
+
+// The peaks of one second are kept in a list of fixed size chunks. Chunks
+// come from a pool and go back to it when the second is cleared, so the
+// store grows without realloc copies and, once the busiest second has been
+// seen, without malloc. The pool never holds more than max_chunks chunks,
+// which bounds the memory at high concentrations.
+#define PEAK_CHUNK 4096                     // peaks per chunk (64 KB)
+
+struct Peak_Chunk {
+    unsigned short max[PEAK_CHUNK];         // peak maximum above baseline
+    unsigned short w[PEAK_CHUNK];           // width, number of points
+    unsigned int cycles[PEAK_CHUNK];        // PRU cycles since last peak
+    unsigned long long t[PEAK_CHUNK];       // absolute time, PRU cycles
+    unsigned int n;                         // peaks used in this chunk
+    struct Peak_Chunk *next;
+};
+
+struct Peak_Store {
+    struct Peak_Chunk *first;               // peaks of this second, in order
+    struct Peak_Chunk *last;                // chunk being filled
+    struct Peak_Chunk *pool;                // free chunks
+    unsigned int n;                         // peaks in the store
+    unsigned int max_peaks;                 // limit on peaks in the store
+    unsigned int chunks;                    // chunks allocated, used or free
+    unsigned int max_chunks;                // limit on chunks allocated
+};
+
+// Set the limit to max_peaks and allocate enough chunks for prealloc peaks.
+// Returns 0, or -1 if the preallocation failed.
+int Peak_Store_Init(struct Peak_Store *s, unsigned int max_peaks,
+    unsigned int prealloc);
+
+// Add n peaks from the columns. Returns the number added, fewer than n only
+// when the limit is reached.
+unsigned int Peak_Store_Add(struct Peak_Store *s, const unsigned short *max,
+    const unsigned short *w, const unsigned int *cycles,
+    const unsigned long long *t, unsigned int n);
+
+// Move the queue up to peak head (q->head for all of it) into the store.
+// Returns the number moved, the rest is left in the queue when the limit is
+// reached (n == max_peaks).
+unsigned int Peak_Store_Fill(struct Peak_Store *s, struct Peak_Queue *q,
+    unsigned int head);
+
+// Return the chunks to the pool for the next second.
+void Peak_Store_Clear(struct Peak_Store *s);
+
+// Bytes allocated for chunks.
+unsigned long Peak_Store_Bytes(const struct Peak_Store *s);
+
+#endif // _POPS_STORE_H_
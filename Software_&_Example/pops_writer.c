@@ -0,0 +1,492 @@
+/*
+// Filename: pops_writer.c
+// Version: 1.0
+//
+// Project: NOAA - POPS
+//
+// Description - File writer thread. The 1 Hz loop formats each second's
+// data into a buffer through a stdio FILE (fopencookie), and the thread
+// writes the queued buffers to files it keeps open, so the loop does not
+// wait on the uSD card. See pops_writer.h.
+//
+// See SOFTWARE DISCLAIMER.md.
+*/
+
+//******************************************************************************
+//
+// Include files:
+//
+//******************************************************************************
+
+#define _GNU_SOURCE                         // fopencookie
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <time.h>
+#include <sys/time.h>
+#include <sys/stat.h>
+#include "pops_writer.h"
+
+//******************************************************************************
+//
+//  Wr_Buf_Write
+//
+//  Append to the buffer, growing it as needed. The allocation is kept for
+//  the next second unless it grew past WR_KEEP_BYTES.
+//
+//  Parameters: void *c (struct Wr_Buf *)
+//              const char *p (bytes)
+//              size_t n (number of bytes)
+//
+//  Returns: ssize_t (bytes written, 0 out of memory)
+//
+//******************************************************************************
+
+static ssize_t Wr_Buf_Write(void *c, const char *p, size_t n)
+{
+    struct Wr_Buf *b = (struct Wr_Buf *)c;
+    size_t cap;
+    char *data;
+
+    if (b->pos + n > b->cap)
+    {
+        cap = (b->cap < 4096) ? 4096 : 2*b->cap;
+        while (cap < b->pos + n) cap *= 2;
+        data = realloc(b->data, cap);
+        if (data == NULL)
+        {
+            b->err = 1;
+            return 0;
+        }
+        b->data = data;
+        b->cap = cap;
+    }
+    memcpy(b->data + b->pos, p, n);
+    b->pos += n;
+    if (b->pos > b->len) b->len = b->pos;
+    return n;
+}
+
+//******************************************************************************
+//
+//  Wr_Buf_Seek
+//
+//  Move the stdio position within the buffer, so fseek and ftell work as on
+//  a file holding only the buffer.
+//
+//  Parameters: void *c (struct Wr_Buf *)
+//              off64_t *off (offset in, position out)
+//              int whence (SEEK_SET, SEEK_CUR or SEEK_END)
+//
+//  Returns: int (0 ok, -1 outside the buffer)
+//
+//******************************************************************************
+
+static int Wr_Buf_Seek(void *c, off64_t *off, int whence)
+{
+    struct Wr_Buf *b = (struct Wr_Buf *)c;
+    off64_t p = *off;
+
+    if (whence == SEEK_CUR) p += b->pos;
+    else if (whence == SEEK_END) p += b->len;
+    if (p < 0 || (size_t)p > b->len) return -1;
+    b->pos = p;
+    *off = p;
+    return 0;
+}
+
+//******************************************************************************
+//
+//  Writer_Replace
+//
+//  Write a buffer over the start of its file, then cut off any of the old
+//  contents past it. The file is never empty in between, as it was when it
+//  was truncated first, so a power cut during the write still leaves a
+//  value of full length (the pump life) to read at the next start.
+//
+//  Parameters: struct Writer *w
+//              struct Wr_File *f (open without O_APPEND)
+//              const struct Wr_Buf *b
+//
+//******************************************************************************
+
+static void Writer_Replace(struct Writer *w, struct Wr_File *f,
+    const struct Wr_Buf *b)
+{
+    size_t off = 0;
+    ssize_t ret;
+
+    while (off < b->len)
+    {
+        ret = pwrite(f->fd, b->data + off, b->len - off, off);
+        if (ret < 0 && errno == EINTR) continue;
+        if (ret <= 0)
+        {
+            __sync_fetch_and_add(&w->errors, 1);
+            return;
+        }
+        off += ret;
+    }
+    if (f->size > b->len && ftruncate(f->fd, b->len) != 0)
+    {
+        __sync_fetch_and_add(&w->errors, 1);
+        return;
+    }
+    f->size = b->len;
+}
+
+//******************************************************************************
+//
+//  Writer_Do
+//
+//  Write a buffer to its file, opening the file if it is not open or its
+//  path changed. The header at the start of the buffer is skipped unless
+//  the file is empty. A buffer that replaces the file is written in place
+//  (Writer_Replace). The time taken goes to the stats.
+//
+//  Parameters: struct Writer *w
+//              struct Wr_Buf *b
+//
+//******************************************************************************
+
+static void Writer_Do(struct Writer *w, struct Wr_Buf *b)
+{
+    struct Wr_File *f = &w->file[b->file];
+    struct timespec t0, t1;
+    struct stat st;
+    size_t off;
+    ssize_t ret;
+    double ms;
+
+    clock_gettime(CLOCK_MONOTONIC, &t0);
+    if (f->fd < 0 || strcmp(f->path, b->path) != 0)
+    {
+        if (f->fd >= 0) close(f->fd);
+        strcpy(f->path, b->path);
+        f->fd = open(f->path, O_WRONLY | O_CREAT
+            | (b->trunc ? 0 : O_APPEND), 0666);
+        f->size = (f->fd >= 0 && fstat(f->fd, &st) == 0) ? st.st_size : 0;
+    }
+    if (f->fd < 0)
+    {
+        __sync_fetch_and_add(&w->errors, 1);
+        f->path[0] = '\0';                  // try again next time
+    }
+    else if (b->trunc) Writer_Replace(w, f, b);
+    else
+    {
+        off = (f->size == 0) ? 0 : b->header;
+        while (off < b->len)
+        {
+            ret = write(f->fd, b->data + off, b->len - off);
+            if (ret < 0 && errno == EINTR) continue;
+            if (ret <= 0)
+            {
+                __sync_fetch_and_add(&w->errors, 1);
+                break;
+            }
+            off += ret;
+            f->size += ret;
+        }
+    }
+
+    if (b->cap > WR_KEEP_BYTES)             // a big second, give it back
+    {
+        free(b->data);
+        b->data = NULL;
+        b->cap = 0;
+    }
+
+    clock_gettime(CLOCK_MONOTONIC, &t1);
+    ms = (t1.tv_sec - t0.tv_sec)*1e3 + (t1.tv_nsec - t0.tv_nsec)/1e6;
+    pthread_mutex_lock(&w->lock);
+    w->writes++;
+    w->lat_sum += ms;
+    if (ms > w->lat_max) w->lat_max = ms;
+    pthread_mutex_unlock(&w->lock);
+}
+
+//******************************************************************************
+//
+//  Writer_Sync
+//
+//  fsync the open files.
+//
+//  Parameters: struct Writer *w
+//
+//******************************************************************************
+
+static void Writer_Sync(struct Writer *w)
+{
+    int i;
+
+    for (i = 0; i < WR_FILES; i++)
+        if (w->file[i].fd >= 0) fsync(w->file[i].fd);
+}
+
+//******************************************************************************
+//
+//  Writer_Thread
+//
+//  Write the queued buffers as they come, waking at least once a second
+//  for the fsync policy, until stopped with the queue empty.
+//
+//  Parameters: void *arg (struct Writer *)
+//
+//******************************************************************************
+
+static void *Writer_Thread(void *arg)
+{
+    struct Writer *w = (struct Writer *)arg;
+    struct timespec until;
+    struct timeval now;
+    time_t last = time(NULL);
+    int stop;
+
+    for (;;)
+    {
+        pthread_mutex_lock(&w->lock);
+        if (w->run && w->head == w->tail)
+        {
+            gettimeofday(&now, NULL);
+            until.tv_sec = now.tv_sec + 1;
+            until.tv_nsec = now.tv_usec*1000L;
+            pthread_cond_timedwait(&w->cond, &w->lock, &until);
+        }
+        stop = !w->run;
+        pthread_mutex_unlock(&w->lock);
+
+        while (w->tail != w->head)
+        {
+            __sync_synchronize();           // head before the buffer
+            Writer_Do(w, &w->buf[w->tail % w->slots]);
+            __sync_synchronize();           // done with the buffer
+            w->tail++;
+        }
+        if (w->fsync_sec > 0 && time(NULL) - last >= (time_t)w->fsync_sec)
+        {
+            Writer_Sync(w);
+            last = time(NULL);
+        }
+        if (stop && w->tail == w->head) break;
+    }
+    return NULL;
+}
+
+//******************************************************************************
+//
+//  Writer_Start
+//
+//  Set up the queue and the files, and start the thread.
+//
+//  Parameters: struct Writer *w
+//              unsigned int slots (queue size, 1 to WR_QUEUE_MAX)
+//              unsigned int fsync_sec (fsync every N s, 0 never)
+//
+//  Returns: int (0 started, -1 writing in Writer_Close)
+//
+//******************************************************************************
+
+int Writer_Start(struct Writer *w, unsigned int slots, unsigned int fsync_sec)
+{
+    int i;
+
+    memset(w, 0, sizeof(*w));
+    if (slots < 1) slots = 1;
+    if (slots > WR_QUEUE_MAX) slots = WR_QUEUE_MAX;
+    w->slots = slots;
+    w->fsync_sec = fsync_sec;
+    for (i = 0; i < WR_FILES; i++) w->file[i].fd = -1;
+    pthread_mutex_init(&w->lock, NULL);
+    pthread_cond_init(&w->cond, NULL);
+
+    w->run = 1;
+    if (pthread_create(&w->thread, NULL, Writer_Thread, w) != 0)
+    {
+        w->run = 0;
+        return -1;
+    }
+    w->running = 1;
+    return 0;
+}
+
+//******************************************************************************
+//
+//  Writer_Stop
+//
+//  Stop the thread once it has written the queue, and close the files.
+//
+//  Parameters: struct Writer *w
+//
+//******************************************************************************
+
+void Writer_Stop(struct Writer *w)
+{
+    int i;
+
+    if (w->running)
+    {
+        pthread_mutex_lock(&w->lock);
+        w->run = 0;
+        pthread_cond_signal(&w->cond);
+        pthread_mutex_unlock(&w->lock);
+        pthread_join(w->thread, NULL);
+        w->running = 0;
+    }
+    if (w->fsync_sec > 0) Writer_Sync(w);
+    for (i = 0; i < WR_FILES; i++)
+    {
+        if (w->file[i].fd >= 0) close(w->file[i].fd);
+        w->file[i].fd = -1;
+    }
+    for (i = 0; i < WR_QUEUE_MAX; i++)
+    {
+        free(w->buf[i].data);
+        w->buf[i].data = NULL;
+        w->buf[i].cap = 0;
+    }
+}
+
+//******************************************************************************
+//
+//  Writer_Open
+//
+//  Take the next free buffer, put the header in it, and open a FILE on it.
+//
+//  Parameters: struct Writer *w
+//              int file (WR_HK ...)
+//              const char *path (file path)
+//              const void *header (NULL for none)
+//              size_t hlen (header bytes)
+//              int trunc (write over the file's contents, in place)
+//
+//  Returns: FILE * (NULL if the queue is full)
+//
+//******************************************************************************
+
+FILE *Writer_Open(struct Writer *w, int file, const char *path,
+    const void *header, size_t hlen, int trunc)
+{
+    static const cookie_io_functions_t io = {NULL, Wr_Buf_Write,
+        Wr_Buf_Seek, NULL};
+    struct Wr_Buf *b;
+    FILE *fp;
+
+    if (w->open != NULL || file < 0 || file >= WR_FILES) return NULL;
+    if (w->head - w->tail >= w->slots)
+    {
+        w->dropped++;
+        return NULL;
+    }
+    __sync_synchronize();                   // tail before the buffer
+    b = &w->buf[w->head % w->slots];
+    b->file = file;
+    b->trunc = trunc;
+    strncpy(b->path, path, WR_PATH - 1);
+    b->path[WR_PATH - 1] = '\0';
+    b->len = 0;
+    b->pos = 0;
+    b->err = 0;
+    b->header = 0;
+    if (header != NULL && hlen > 0)
+    {
+        Wr_Buf_Write(b, (const char *)header, hlen);
+        b->header = hlen;
+    }
+
+    fp = fopencookie(b, "w", io);
+    if (fp != NULL) w->open = b;
+    return fp;
+}
+
+//******************************************************************************
+//
+//  Writer_Close
+//
+//  Flush the FILE into the buffer and queue it, or write it here if the
+//  thread is not running.
+//
+//  Parameters: struct Writer *w
+//              FILE *fp (from Writer_Open)
+//
+//******************************************************************************
+
+void Writer_Close(struct Writer *w, FILE *fp)
+{
+    struct Wr_Buf *b = w->open;
+    unsigned int depth;
+
+    fclose(fp);
+    w->open = NULL;
+    if (b == NULL) return;
+    if (b->err)
+    {
+        __sync_fetch_and_add(&w->errors, 1);
+        return;
+    }
+    if (strcmp(w->qpath[b->file], b->path) != 0)
+    {
+        strcpy(w->qpath[b->file], b->path);
+        w->queued[b->file] = 0;
+    }
+    w->queued[b->file] += b->len;
+    if (!w->running)
+    {
+        Writer_Do(w, b);
+        return;
+    }
+
+    depth = w->head + 1 - w->tail;
+    __sync_synchronize();                   // buffer before the head
+    pthread_mutex_lock(&w->lock);
+    w->head++;
+    if (depth > w->depth) w->depth = depth;
+    pthread_cond_signal(&w->cond);
+    pthread_mutex_unlock(&w->lock);
+}
+
+//******************************************************************************
+//
+//  Writer_Queued
+//
+//  Parameters: const struct Writer *w
+//              int file (WR_HK ...)
+//
+//  Returns: unsigned long long (bytes queued to the file's last path)
+//
+//******************************************************************************
+
+unsigned long long Writer_Queued(const struct Writer *w, int file)
+{
+    return w->queued[file];
+}
+
+//******************************************************************************
+//
+//  Writer_Stats
+//
+//  Take the queue depth and write times since the last call.
+//
+//  Parameters: struct Writer *w
+//              struct Wr_Stats *s
+//
+//******************************************************************************
+
+void Writer_Stats(struct Writer *w, struct Wr_Stats *s)
+{
+    pthread_mutex_lock(&w->lock);
+    s->depth = w->depth;
+    s->writes = w->writes;
+    s->lat_mean = (w->writes > 0) ? w->lat_sum/w->writes : 0;
+    s->lat_max = w->lat_max;
+    w->depth = w->head - w->tail;           // still queued
+    w->writes = 0;
+    w->lat_sum = 0;
+    w->lat_max = 0;
+    pthread_mutex_unlock(&w->lock);
+    s->dropped = w->dropped;
+    s->errors = w->errors;
+}
@@ -0,0 +1,115 @@
+// pops_writer.h
+// File writer thread for the POPS program.
+// Project: NOAA - POPS
+
+#ifndef _POPS_WRITER_H_
+#define _POPS_WRITER_H_
+
+#include <stdio.h>
+#include <pthread.h>
+
+// The 1 Hz loop formats each file's data for the second into a buffer, with
+// the usual stdio calls on a FILE from Writer_Open, and Writer_Close queues
+// it. A thread writes the queue to the files, which it keeps open from one
+// second to the next, so a slow uSD write holds up only the thread. A file
+// is reopened when its path changes (makeFileNames).
+//
+// A buffer can start with the file header. It is written only if the file
+// is empty, so the formatters, which write the header when ftell is 0, are
+// handed a FILE that already holds it.
+//
+// If the queue is full Writer_Open returns NULL and the buffer is dropped
+// and counted. If the thread is not running the buffers are written by
+// Writer_Close, as before.
+#define WR_HK 0                             // the files
+#define WR_LOG 1
+#define WR_PEAK 2
+#define WR_RAW 3
+#define WR_SNIP 4
+#define WR_BLTEL 5
+#define WR_H2D 6
+#define WR_FAST 7
+#define WR_PUMP 8                           // written over, not appended
+#define WR_FILES 9
+#define WR_QUEUE_MAX 64                     // buffers
+#define WR_KEEP_BYTES 65536                 // kept allocated after a write
+#define WR_PATH 100
+
+struct Wr_Buf {                             // one file's data for a second
+    int file;                               // WR_HK ...
+    int trunc;                              // write over the file's contents
+    char path[WR_PATH];
+    char *data;                             // header, then the data
+    size_t len;                             // bytes in data
+    size_t pos;                             // stdio position in data
+    size_t cap;                             // bytes allocated
+    size_t header;                          // leading bytes for a new file
+    int err;                                // out of memory
+};
+
+struct Wr_File {                            // writer thread only
+    char path[WR_PATH];
+    int fd;                                 // -1 closed
+    unsigned long long size;                // bytes in the file
+};
+
+struct Wr_Stats {                           // since the last Writer_Stats
+    unsigned int depth;                     // most buffers queued
+    unsigned int writes;                    // buffers written
+    double lat_mean;                        // write time, ms
+    double lat_max;
+    unsigned int dropped;                   // queue full, since the start
+    unsigned int errors;                    // open or write errors, ditto
+};
+
+struct Writer {
+    struct Wr_Buf buf[WR_QUEUE_MAX];
+    unsigned int slots;                     // queue size, to WR_QUEUE_MAX
+    volatile unsigned int head;             // buffers queued (producer)
+    volatile unsigned int tail;             // buffers written (consumer)
+    struct Wr_Buf *open;                    // buffer being formatted
+    struct Wr_File file[WR_FILES];
+    char qpath[WR_FILES][WR_PATH];          // producer: path last queued
+    unsigned long long queued[WR_FILES];    // and bytes queued to it
+    unsigned int fsync_sec;                 // fsync every N s, 0 never
+    volatile unsigned int dropped;
+    volatile unsigned int errors;           // added to by both threads
+    unsigned int depth;                     // stats, under lock
+    unsigned int writes;
+    double lat_sum;
+    double lat_max;
+    pthread_t thread;
+    pthread_mutex_t lock;
+    pthread_cond_t cond;                    // buffers queued or stop
+    volatile int run;
+    int running;
+};
+
+// Set up the queue of slots buffers and start the thread. Returns 0, or -1
+// if the thread could not be started, when the buffers are written by
+// Writer_Close.
+int Writer_Start(struct Writer *w, unsigned int slots, unsigned int fsync_sec);
+
+// Write what is queued, stop the thread and close the files.
+void Writer_Stop(struct Writer *w);
+
+// Producer: a FILE to format the data for file (WR_HK ...) at path into,
+// starting with hlen bytes of header (NULL for none). trunc writes over
+// the file's contents from the start, in place, and never truncates it to
+// empty first. Such a file is opened without O_APPEND, so it must not share
+// its file (WR_PUMP) with appended buffers. Returns NULL if the queue is
+// full.
+FILE *Writer_Open(struct Writer *w, int file, const char *path,
+    const void *header, size_t hlen, int trunc);
+
+// Producer: close the FILE from Writer_Open and queue the buffer.
+void Writer_Close(struct Writer *w, FILE *fp);
+
+// Producer: bytes queued to the path last queued for a file, so its size
+// once written, for starting new files.
+unsigned long long Writer_Queued(const struct Writer *w, int file);
+
+// Queue depth and write times since the last call.
+void Writer_Stats(struct Writer *w, struct Wr_Stats *s);
+
+#endif // _POPS_WRITER_H_